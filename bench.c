@@ -0,0 +1,477 @@
+/*
+ * microbenchmarks for the jfap receive path
+ *
+ * synthetic radiotap + 802.11 frames are pushed through the parsers and
+ * handle_packet with the transmit side stubbed out. for every stage and frame
+ * type we report the average cost and frames/s from one timed run, and
+ * latency percentiles from timing each call on its own (less the cost of
+ * reading the clock, which swamps the cheaper stages).
+ *
+ * build with:
+ *   gcc -O2 -o bench bench.c station.c bss.c chan.c timer.c tsf.c ring.c filter.c radiotap.c ie.c pipeline.c evlog.c shmstats.c latency.c tap.c classify.c decode.c hexdump.c record.c -lpcap -lpthread
+ */
+
+#define JFAP_NO_MAIN
+#include "jfap.c"
+
+#include <fcntl.h>
+
+
+#define BENCH_ITERATIONS 200000
+#define BENCH_STATIONS 64
+#define BENCH_FRAME_MAX 256
+
+/* which part of the receive path to run */
+enum {
+	STAGE_RADIOTAP = 0,
+	STAGE_DOT11,
+	STAGE_CLASSIFY,
+	STAGE_IE_INDEX,
+	STAGE_DECODE,
+	STAGE_HANDLE,
+	STAGE_MAX
+};
+
+const char *stage_names[STAGE_MAX] = { "radiotap", "dot11", "classify", "ie_index", "decode", "handle_packet" };
+
+typedef struct bench_frame {
+	const char *name;
+	u_int8_t buf[BENCH_FRAME_MAX];
+	u_int32_t len;
+	u_int32_t ie_off;         /* where the IEs start after the 802.11 header, or ~0 */
+} bench_frame_t;
+
+bss_t *g_target;              /* the network the frames are for */
+u_int8_t g_other_bssid[ETH_ALEN] = { 0x02, 0x11, 0x22, 0x33, 0x44, 0x55 };
+u_int8_t g_sta_base[ETH_ALEN] = { 0x02, 0xaa, 0xbb, 0xcc, 0x00, 0x00 };
+u_int64_t g_sink_frames;
+volatile uintptr_t g_result;  /* keeps the compiler from throwing work away */
+
+
+/*
+ * get a timestamp in ns
+ */
+static inline u_int64_t ns_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u_int64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/*
+ * count what would have been sent
+ */
+void bench_sink(const u_int8_t *frame, u_int32_t len, void *arg)
+{
+	g_sink_frames++;
+}
+
+
+/*
+ * write a typical monitor mode radiotap header (flags, rate, channel, signal)
+ *
+ * returns the length
+ */
+u_int32_t build_radiotap(u_int8_t *p)
+{
+	radiotap_t *rt = (radiotap_t *)p;
+
+	rt->it_version = 0;
+	rt->it_pad = 0;
+	rt->it_len = sizeof(radiotap_t) + 7;
+	rt->it_present = (1 << IEEE80211_RADIOTAP_FLAGS) | (1 << IEEE80211_RADIOTAP_RATE) |
+		(1 << IEEE80211_RADIOTAP_CHANNEL) | (1 << IEEE80211_RADIOTAP_DBM_ANTSIGNAL);
+	p += sizeof(radiotap_t);
+	*p++ = 0;                    /* flags */
+	*p++ = 2;                    /* rate (1Mbps) */
+	*p++ = 0x6c; *p++ = 0x09;    /* channel 1 (2412MHz) */
+	*p++ = 0xa0; *p++ = 0x00;    /* 2GHz, CCK */
+	*p++ = (u_int8_t)-42;        /* signal (dBm) */
+	return rt->it_len;
+}
+
+
+/*
+ * write an 802.11 header after the radiotap header
+ *
+ * returns the total length so far
+ */
+u_int32_t build_dot11(bench_frame_t *f, u_int8_t type, u_int8_t subtype, u_int8_t flags,
+		const u_int8_t *dst, const u_int8_t *src, const u_int8_t *bssid)
+{
+	u_int32_t off = build_radiotap(f->buf);
+	dot11_frame_t *d11 = (dot11_frame_t *)(f->buf + off);
+
+	memset(d11, 0, sizeof(*d11));
+	d11->type = type;
+	d11->subtype = subtype;
+	d11->ctrlflags = flags;
+	memcpy(d11->dst_mac, dst, ETH_ALEN);
+	memcpy(d11->src_mac, src, ETH_ALEN);
+	memcpy(d11->bssid, bssid, ETH_ALEN);
+	d11->seq = 1234;
+	f->ie_off = ~0;
+	return off + sizeof(*d11);
+}
+
+
+/*
+ * append an IE to a frame
+ */
+void add_ie(bench_frame_t *f, u_int8_t id, const void *data, u_int8_t len)
+{
+	f->buf[f->len++] = id;
+	f->buf[f->len++] = len;
+	memcpy(f->buf + f->len, data, len);
+	f->len += len;
+}
+
+
+/*
+ * append the IEs a typical probe or assoc request carries after the SSID
+ */
+void add_client_ies(bench_frame_t *f)
+{
+	static const u_int8_t rates[] = { 0x82, 0x84, 0x8b, 0x96, 0x0c, 0x12, 0x18, 0x24 };
+	static const u_int8_t ext_rates[] = { 0x30, 0x48, 0x60, 0x6c };
+	static const u_int8_t ht_caps[26] = { 0xef, 0x09, 0x1b, 0xff, 0xff };
+	static const u_int8_t he_caps[22] = { 35, 0x01, 0x08 };
+	static const u_int8_t wmm[7] = { 0x00, 0x50, 0xf2, 0x02, 0x00, 0x01, 0x00 };
+	static const u_int8_t wps[32] = { 0x00, 0x50, 0xf2, 0x04, 0x10, 0x4a, 0x00, 0x01, 0x10 };
+	static const u_int8_t p2p[20] = { 0x50, 0x6f, 0x9a, 0x09, 0x02, 0x02, 0x00, 0x25 };
+
+	add_ie(f, IEID_RATES, rates, sizeof(rates));
+	add_ie(f, IEID_EXT_RATES, ext_rates, sizeof(ext_rates));
+	add_ie(f, IEID_HT_CAPS, ht_caps, sizeof(ht_caps));
+	add_ie(f, IEID_EXTENSION, he_caps, sizeof(he_caps));
+	add_ie(f, IEID_VENDOR, wmm, sizeof(wmm));
+	add_ie(f, IEID_VENDOR, wps, sizeof(wps));
+	add_ie(f, IEID_VENDOR, p2p, sizeof(p2p));
+}
+
+
+/*
+ * build one of every kind of frame we care about
+ *
+ * returns the number of frames built
+ */
+int build_frames(bench_frame_t *frames)
+{
+	bench_frame_t *f = frames;
+	auth_t *auth;
+	assoc_req_t *assoc;
+
+	f->name = "probe-wildcard";
+	f->len = build_dot11(f, T_MGMT, ST_PROBE_REQ, 0, IEEE80211_BROADCAST_ADDR, g_sta_base, IEEE80211_BROADCAST_ADDR);
+	f->ie_off = 0;
+	add_ie(f, IEID_SSID, "", 0);
+	add_client_ies(f);
+	f++;
+
+	f->name = "probe-ssid";
+	f->len = build_dot11(f, T_MGMT, ST_PROBE_REQ, 0, IEEE80211_BROADCAST_ADDR, g_sta_base, IEEE80211_BROADCAST_ADDR);
+	f->ie_off = 0;
+	add_ie(f, IEID_SSID, g_target->ssid, g_target->ssid_len);
+	add_client_ies(f);
+	f++;
+
+	f->name = "probe-other";
+	f->len = build_dot11(f, T_MGMT, ST_PROBE_REQ, 0, IEEE80211_BROADCAST_ADDR, g_sta_base, IEEE80211_BROADCAST_ADDR);
+	f->ie_off = 0;
+	add_ie(f, IEID_SSID, "SomeoneElsesNetwork", 19);
+	add_client_ies(f);
+	f++;
+
+	f->name = "probe-directed";
+	f->len = build_dot11(f, T_MGMT, ST_PROBE_REQ, 0, g_target->bssid, g_sta_base, g_target->bssid);
+	f->ie_off = 0;
+	add_ie(f, IEID_SSID, g_target->ssid, g_target->ssid_len);
+	add_client_ies(f);
+	f++;
+
+	f->name = "auth";
+	f->len = build_dot11(f, T_MGMT, ST_AUTH, 0, g_target->bssid, g_sta_base, g_target->bssid);
+	auth = (auth_t *)(f->buf + f->len);
+	auth->algorithm = 0;
+	auth->seq = 1;
+	auth->status = 0;
+	f->len += sizeof(*auth);
+	f++;
+
+	f->name = "assoc";
+	f->len = build_dot11(f, T_MGMT, ST_ASSOC_REQ, 0, g_target->bssid, g_sta_base, g_target->bssid);
+	assoc = (assoc_req_t *)(f->buf + f->len);
+	assoc->caps = 0x0431;
+	assoc->interval = 10;
+	f->len += sizeof(*assoc);
+	f->ie_off = sizeof(*assoc);
+	add_ie(f, IEID_SSID, g_target->ssid, g_target->ssid_len);
+	add_client_ies(f);
+	f++;
+
+	f->name = "data";
+	f->len = build_dot11(f, T_DATA, 0, 0x01, g_target->bssid, g_sta_base, g_target->bssid);
+	memset(f->buf + f->len, 0xaa, 64);
+	f->len += 64;
+	f++;
+
+	f->name = "retry";
+	f->len = build_dot11(f, T_MGMT, ST_AUTH, CF_RETRY, g_target->bssid, g_sta_base, g_target->bssid);
+	auth = (auth_t *)(f->buf + f->len);
+	auth->algorithm = 0;
+	auth->seq = 1;
+	auth->status = 0;
+	f->len += sizeof(*auth);
+	f++;
+
+	f->name = "other-bss";
+	f->len = build_dot11(f, T_MGMT, ST_BEACON, 0, IEEE80211_BROADCAST_ADDR, g_other_bssid, g_other_bssid);
+	memset(f->buf + f->len, 0, sizeof(beacon_t));
+	f->len += sizeof(beacon_t);
+	add_ie(f, IEID_SSID, "SomeoneElsesNetwork", 19);
+	add_client_ies(f);
+	f++;
+
+	return f - frames;
+}
+
+
+/*
+ * run one stage on a frame
+ */
+static inline void run_stage(int stage, const bench_frame_t *f)
+{
+	const u_char *p = f->buf;
+	u_int32_t left = f->len;
+	rt_meta_t rt;
+	ie_index_t ies;
+
+	switch (stage) {
+		case STAGE_RADIOTAP:
+			g_result = process_radiotap(&p, &left, &rt) + rt.signal;
+			break;
+
+		case STAGE_DOT11:
+			p += ((radiotap_t *)p)->it_len;
+			left -= ((radiotap_t *)f->buf)->it_len;
+			g_result = (uintptr_t)get_dot11_frame(&p, &left);
+			break;
+
+		case STAGE_CLASSIFY:
+			p += ((radiotap_t *)p)->it_len;
+			g_result = cl_classify(&p, 1);
+			break;
+
+		case STAGE_IE_INDEX:
+			p += ((radiotap_t *)p)->it_len + sizeof(dot11_frame_t) + f->ie_off;
+			left -= ((radiotap_t *)f->buf)->it_len + sizeof(dot11_frame_t) + f->ie_off;
+			ie_index(&ies, p, left);
+			g_result = (uintptr_t)ie_get(&ies, IEID_SSID);
+			break;
+
+		/* everything -d 3 would write, to /dev/null */
+		case STAGE_DECODE:
+			radiotap_parse(p, left, &rt);
+			dc_frame(&g_ifaces[0].dec, 1, &rt, p + rt.len, left - rt.len);
+			g_result = g_ifaces[0].dec.frames;
+			break;
+
+		case STAGE_HANDLE:
+			g_result = handle_packet(p, left, 0);
+			break;
+	}
+}
+
+
+/*
+ * make the frame come from the i'th station, and keep everything it might
+ * have queued or armed from piling up. none of this is timed
+ */
+static inline void prepare(int stage, bench_frame_t *f, u_int32_t i)
+{
+	dot11_frame_t *d11;
+
+	if (stage != STAGE_HANDLE)
+		return;
+
+	d11 = (dot11_frame_t *)(f->buf + ((radiotap_t *)f->buf)->it_len);
+	if (memcmp(d11->src_mac, g_other_bssid, ETH_ALEN)) {
+		d11->src_mac[4] = (i % BENCH_STATIONS) >> 8;
+		d11->src_mac[5] = i % BENCH_STATIONS;
+	}
+
+	tx_flush(&g_ifaces[0].tx);
+	if (!(i & 1023))
+		tw_advance(&g_wheel, now_ms());
+}
+
+
+int compare_u32(const void *a, const void *b)
+{
+	u_int32_t x = *(const u_int32_t *)a, y = *(const u_int32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+
+/*
+ * benchmark a stage on a frame type and print a line of results
+ */
+void bench(int stage, bench_frame_t *f, u_int32_t iters, u_int32_t *samples, u_int32_t overhead)
+{
+	u_int64_t total = 0, t0, t1;
+	double avg;
+	u_int32_t i;
+
+	/* warm up the caches, the branch predictor and the station table */
+	for (i = 0; i < iters / 10 + BENCH_STATIONS; i++) {
+		prepare(stage, f, i);
+		run_stage(stage, f);
+	}
+
+	/* throughput - the (cheap) setup is timed along with the stage */
+	t0 = ns_now();
+	for (i = 0; i < iters; i++) {
+		prepare(stage, f, i);
+		run_stage(stage, f);
+	}
+	total = ns_now() - t0;
+	avg = (double)total / iters;
+
+	/* per-frame latency */
+	for (i = 0; i < iters; i++) {
+		prepare(stage, f, i);
+		t0 = ns_now();
+		run_stage(stage, f);
+		t1 = ns_now();
+		samples[i] = t1 - t0 > overhead ? t1 - t0 - overhead : 0;
+	}
+	qsort(samples, iters, sizeof(*samples), compare_u32);
+
+	dprintf(STDERR_FILENO, "%-14s %-15s %9.1f %12.0f %7u %7u %7u %7u %8u\n",
+			stage_names[stage], f->name, avg, 1e9 / avg,
+			samples[iters / 2], samples[iters * 90 / 100],
+			samples[iters * 99 / 100], samples[iters * 999 / 1000],
+			samples[iters - 1]);
+}
+
+
+/*
+ * find out what an empty timed region costs so it can be taken out
+ */
+u_int32_t timer_overhead(void)
+{
+	u_int32_t samples[10001];
+	u_int64_t t0;
+	int i;
+
+	for (i = 0; i < 10001; i++) {
+		t0 = ns_now();
+		samples[i] = ns_now() - t0;
+	}
+	qsort(samples, 10001, sizeof(*samples), compare_u32);
+	return samples[5000];
+}
+
+
+int main(int argc, char *argv[])
+{
+	bench_frame_t frames[16];
+	u_int32_t iters = BENCH_ITERATIONS, overhead, *samples;
+	int nframes, stage, i, c, devnull;
+	char *only = NULL, ssid[BSS_SSID_MAX + 1];
+	u_int32_t networks = 1;
+
+	while ((c = getopt(argc, argv, "f:n:s:")) != -1) {
+		switch (c) {
+			case 'f':
+				only = optarg;
+				break;
+
+			case 'n':
+				iters = atoi(optarg);
+				break;
+
+			case 's':
+				networks = atoi(optarg);
+				break;
+
+			default:
+				fprintf(stderr, "usage: %s [-n <iterations>] [-f <frame type>] [-s <networks>]\n", argv[0]);
+				return 1;
+		}
+	}
+	if (iters < 1000) {
+		fprintf(stderr, "[!] need at least 1000 iterations\n");
+		return 1;
+	}
+
+	if (!(samples = malloc(iters * sizeof(*samples)))) {
+		perror("[!] Unable to allocate samples");
+		return 1;
+	}
+
+	/* the frames are for the last network, so lookups can't get lucky */
+	memcpy(g_bssid, "\x02\x00\x00\x00\x00\x01", ETH_ALEN);
+	for (i = 0; i < (int)networks; i++) {
+		snprintf(ssid, sizeof(ssid), i ? "jfap-bench-%d" : "jfap-bench", i);
+		if (!bss_add((u_int8_t *)ssid, strlen(ssid)))
+			return 1;
+	}
+	if (!networks) {
+		fprintf(stderr, "[!] need at least 1 network\n");
+		return 1;
+	}
+	bss_set_base(g_bssid);
+	cl_setup();
+	g_target = bss_get(networks - 1);
+	nframes = build_frames(frames);
+	if (!add_iface("bench"))
+		return 1;
+	g_ifaces[0].channel = DEFAULT_CHANNEL;
+	build_templates(&g_ifaces[0]);
+
+	tw_init(&g_wheel, clock_ms());
+	tsf_init(clock_us());
+	sta_init(&g_wheel, retransmit_timer);
+	if (!tx_setup_sink(&g_ifaces[0].tx, bench_sink, NULL))
+		return 1;
+
+	/* handle_packet logs events. queueing them is part of its cost, but we
+	 * don't want to see them, so results go to stderr and stdout goes
+	 * nowhere */
+	fflush(stdout);
+	if ((devnull = open("/dev/null", O_WRONLY)) == -1 || dup2(devnull, STDOUT_FILENO) == -1) {
+		perror("[!] Unable to silence stdout");
+		return 1;
+	}
+	dc_out_init(&g_decode_out, devnull);
+	if (!evlog_start(EVLOG_TEXT, stdout) || !dc_open(&g_ifaces[0].dec, &g_decode_out, DC_HEX))
+		return 1;
+
+	overhead = timer_overhead();
+	dprintf(STDERR_FILENO, "[*] %u iterations per test, %u networks, %u ns timer overhead subtracted\n\n",
+			iters, networks, overhead);
+	dprintf(STDERR_FILENO, "%-14s %-15s %9s %12s %7s %7s %7s %7s %8s\n",
+			"stage", "frame", "ns/frame", "frames/s", "p50", "p90", "p99", "p99.9", "max");
+
+	for (stage = 0; stage < STAGE_MAX; stage++) {
+		for (i = 0; i < nframes; i++) {
+			if (only && strcmp(only, frames[i].name))
+				continue;
+			if (stage == STAGE_IE_INDEX && frames[i].ie_off == ~0U)
+				continue;
+			bench(stage, &frames[i], iters, samples, overhead);
+		}
+	}
+
+	evlog_stop();
+	dprintf(STDERR_FILENO, "\n[*] %llu frames sent to the stub, %u stations, %llu events dropped\n",
+			(unsigned long long)g_sink_frames, sta_count(), (unsigned long long)evlog_dropped());
+
+	ring_close(NULL, &g_ifaces[0].tx);
+	free(samples);
+	return 0;
+}
@@ -0,0 +1,141 @@
+/*
+ * virtual BSSes (networks) for jfap
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "bss.h"
+
+
+static bss_t bss_list[BSS_MAX];
+static u_int32_t bss_num;
+static u_int8_t bss_base_addr[ETH_ALEN];
+
+/* index + 1 of the BSS with each SSID, 0 when empty */
+static u_int8_t bss_hash[BSS_HASH_SIZE];
+
+
+/*
+ * FNV-1a over the SSID element's length and data, as it is in the frame
+ */
+static inline u_int32_t bss_ssid_hash(const u_int8_t *ssid, u_int8_t len)
+{
+	u_int32_t h = 2166136261U;
+	u_int32_t i;
+
+	h = (h ^ len) * 16777619U;
+	for (i = 0; i < len; i++)
+		h = (h ^ ssid[i]) * 16777619U;
+	return h;
+}
+
+
+/*
+ * add a network with the specified SSID. its BSSID is filled in by
+ * bss_set_base()
+ *
+ * on success, we return 1, on failure, 0
+ */
+int bss_add(const u_int8_t *ssid, u_int32_t len)
+{
+	bss_t *b;
+	u_int32_t i;
+
+	if (bss_num >= BSS_MAX) {
+		fprintf(stderr, "[!] too many networks, at most %d are supported\n", BSS_MAX);
+		return 0;
+	}
+	if (len > BSS_SSID_MAX) {
+		fprintf(stderr, "[!] SSID is longer than %d bytes: %.*s\n", BSS_SSID_MAX, (int)len, ssid);
+		return 0;
+	}
+	if (bss_by_ssid(ssid, len)) {
+		fprintf(stderr, "[!] duplicate SSID: %.*s\n", (int)len, ssid);
+		return 0;
+	}
+
+	b = &bss_list[bss_num];
+	memset(b, 0, sizeof(*b));
+	b->index = bss_num;
+	b->ssid_len = len;
+	memcpy(b->ssid, ssid, len);
+
+	/* the table is never more than a quarter full, so this ends */
+	i = bss_ssid_hash(ssid, len) & (BSS_HASH_SIZE - 1);
+	while (bss_hash[i])
+		i = (i + 1) & (BSS_HASH_SIZE - 1);
+	bss_hash[i] = ++bss_num;
+
+	bss_set_base(bss_base_addr);
+	return 1;
+}
+
+
+/*
+ * derive every network's BSSID from our base address
+ */
+void bss_set_base(const u_int8_t *mac)
+{
+	u_int32_t i;
+
+	memmove(bss_base_addr, mac, ETH_ALEN);
+	for (i = 0; i < bss_num; i++) {
+		bss_t *b = &bss_list[i];
+
+		memcpy(b->bssid, bss_base_addr, ETH_ALEN);
+		if (i) {
+			b->bssid[0] |= 0x02;
+			b->bssid[5] ^= i;
+		}
+	}
+}
+
+
+bss_t *bss_get(u_int32_t index)
+{
+	return index < bss_num ? &bss_list[index] : NULL;
+}
+
+
+/*
+ * find the network with the specified BSSID
+ */
+bss_t *bss_by_addr(const u_int8_t *mac)
+{
+	u_int32_t i = mac[5] ^ bss_base_addr[5];
+
+	if (i >= bss_num || memcmp(mac, bss_list[i].bssid, ETH_ALEN))
+		return NULL;
+	return &bss_list[i];
+}
+
+
+/*
+ * find the network with the specified SSID, straight from the frame
+ */
+bss_t *bss_by_ssid(const u_int8_t *ssid, u_int8_t len)
+{
+	u_int32_t i = bss_ssid_hash(ssid, len) & (BSS_HASH_SIZE - 1);
+
+	while (bss_hash[i]) {
+		bss_t *b = &bss_list[bss_hash[i] - 1];
+
+		if (bss_ssid_is(b, ssid, len))
+			return b;
+		i = (i + 1) & (BSS_HASH_SIZE - 1);
+	}
+	return NULL;
+}
+
+
+u_int32_t bss_count(void)
+{
+	return bss_num;
+}
+
+
+const u_int8_t *bss_base(void)
+{
+	return bss_base_addr;
+}
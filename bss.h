@@ -0,0 +1,52 @@
+/*
+ * virtual BSSes (networks) for jfap
+ *
+ * one radio can host up to BSS_MAX networks, each with its own SSID. the
+ * first one uses our base address as its BSSID. the rest set the locally
+ * administered bit and XOR their index into the last octet, so finding a
+ * network by address is an index and a compare. SSIDs are found through a
+ * small open-addressing hash of the raw, length-prefixed SSID element, so
+ * neither lookup gets slower as networks are added.
+ */
+
+#ifndef JFAP_BSS_H
+#define JFAP_BSS_H
+
+#include <string.h>
+#include <sys/types.h>
+#include <net/ethernet.h>
+
+
+#define BSS_MAX 16
+#define BSS_SSID_MAX 32
+
+/* slots in the SSID hash, a power of 2 well over BSS_MAX */
+#define BSS_HASH_SIZE 64
+
+
+typedef struct bss {
+	u_int8_t bssid[ETH_ALEN];
+	u_int8_t index;
+	u_int8_t ssid_len;
+	u_int8_t ssid[BSS_SSID_MAX];
+} bss_t;
+
+
+int bss_add(const u_int8_t *ssid, u_int32_t len);
+void bss_set_base(const u_int8_t *mac);
+bss_t *bss_get(u_int32_t index);
+bss_t *bss_by_addr(const u_int8_t *mac);
+bss_t *bss_by_ssid(const u_int8_t *ssid, u_int8_t len);
+u_int32_t bss_count(void);
+const u_int8_t *bss_base(void);
+
+
+/*
+ * does a BSS have the specified SSID?
+ */
+static inline int bss_ssid_is(const bss_t *b, const u_int8_t *ssid, u_int8_t len)
+{
+	return b->ssid_len == len && !memcmp(b->ssid, ssid, len);
+}
+
+#endif
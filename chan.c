@@ -0,0 +1,350 @@
+/*
+ * channel control for jfap
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <net/if.h>
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+#include <linux/nl80211.h>
+
+#include "chan.h"
+
+
+/* how long (ms) to wait for the kernel to answer */
+#define NL_TIMEOUT 1000
+
+/* room for one request or reply */
+#define NL_BUF_SIZE 4096
+
+typedef struct nl_msg {
+	struct nlmsghdr n;
+	struct genlmsghdr g;
+	u_int8_t attrs[256];
+} nl_msg_t;
+
+
+static const chan_backend_t *chan_backends[] = { &chan_nl80211, &chan_mock, NULL };
+
+
+/*
+ * get the center frequency (MHz) of a 2.4 or 5 GHz channel, 0 if there isn't
+ * one
+ */
+u_int32_t chan_to_freq(u_int8_t channel)
+{
+	if (channel >= 1 && channel <= 13)
+		return 2407 + 5 * channel;
+	if (channel == 14)
+		return 2484;
+	if (channel >= 32 && channel <= 177)
+		return 5000 + 5 * channel;
+	return 0;
+}
+
+
+/*
+ * parse a hop schedule - <channel>[/<dwell ms>][,<channel>[/<dwell ms>]...]
+ *
+ * on success, we return 1, on failure, 0
+ */
+int chan_parse_sched(const char *spec, chan_sched_t *s)
+{
+	const char *p = spec;
+	char *end;
+	long ch, dwell;
+
+	memset(s, 0, sizeof(*s));
+	while (1) {
+		if (s->num >= CHAN_SCHED_MAX) {
+			fprintf(stderr, "[!] too many channels, at most %d are supported: %s\n", CHAN_SCHED_MAX, spec);
+			return 0;
+		}
+
+		ch = strtol(p, &end, 10);
+		if (end == p || ch < 1 || ch > 255 || !chan_to_freq(ch)) {
+			fprintf(stderr, "[!] invalid channel: %s\n", spec);
+			return 0;
+		}
+		dwell = CHAN_DWELL_DEFAULT;
+		if (*end == '/') {
+			p = end + 1;
+			dwell = strtol(p, &end, 10);
+			if (end == p || dwell < 1) {
+				fprintf(stderr, "[!] invalid dwell time: %s\n", spec);
+				return 0;
+			}
+		}
+		s->channels[s->num] = ch;
+		s->dwell[s->num] = dwell;
+		s->num++;
+
+		if (!*end)
+			return 1;
+		if (*end != ',') {
+			fprintf(stderr, "[!] invalid channel list: %s\n", spec);
+			return 0;
+		}
+		p = end + 1;
+	}
+}
+
+
+/*
+ * find a backend by name
+ */
+const chan_backend_t *chan_backend(const char *name)
+{
+	u_int32_t i;
+
+	for (i = 0; chan_backends[i]; i++)
+		if (!strcmp(chan_backends[i]->name, name))
+			return chan_backends[i];
+	return NULL;
+}
+
+
+/*
+ * get a controller ready to tune an interface
+ *
+ * on success, we return 1, on failure, 0
+ */
+int chan_open(chan_ctl_t *c, const chan_backend_t *be, const char *ifname)
+{
+	memset(c, 0, sizeof(*c));
+	c->fd = -1;
+	c->be = be;
+	return be->open(c, ifname);
+}
+
+
+/*
+ * tune to a channel, unless we're already on it
+ *
+ * on success, we return 1, on failure, 0
+ */
+int chan_set(chan_ctl_t *c, u_int8_t channel)
+{
+	struct timespec t0, t1;
+	u_int32_t freq;
+	int ok;
+
+	if (channel == c->channel)
+		return 1;
+	if (!(freq = chan_to_freq(channel))) {
+		fprintf(stderr, "[!] invalid channel: %u\n", channel);
+		return 0;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	ok = c->be->set(c, channel, freq);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	c->switch_ns += (t1.tv_sec - t0.tv_sec) * 1000000000LL + (t1.tv_nsec - t0.tv_nsec);
+
+	if (!ok) {
+		c->failures++;
+		c->channel = 0;
+		return 0;
+	}
+	c->switches++;
+	c->channel = channel;
+	return 1;
+}
+
+
+void chan_close(chan_ctl_t *c)
+{
+	if (c->be && c->be->close)
+		c->be->close(c);
+	c->be = NULL;
+}
+
+
+/*
+ * append an attribute to a generic netlink message
+ */
+static void nl_put(nl_msg_t *m, u_int16_t type, const void *data, u_int16_t len)
+{
+	struct nlattr *a = (struct nlattr *)((u_int8_t *)m + NLMSG_ALIGN(m->n.nlmsg_len));
+
+	a->nla_type = type;
+	a->nla_len = NLA_HDRLEN + len;
+	memcpy((u_int8_t *)a + NLA_HDRLEN, data, len);
+	m->n.nlmsg_len = NLMSG_ALIGN(m->n.nlmsg_len) + NLA_ALIGN(a->nla_len);
+}
+
+
+static void nl_start(nl_msg_t *m, chan_ctl_t *c, u_int16_t family, u_int8_t cmd)
+{
+	memset(m, 0, sizeof(*m));
+	m->n.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+	m->n.nlmsg_type = family;
+	m->n.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+	m->n.nlmsg_seq = ++c->seq;
+	m->g.cmd = cmd;
+	m->g.version = 1;
+}
+
+
+/*
+ * send a request and wait for the kernel's answer. if reply is given, the
+ * first message that isn't an ack is copied there
+ *
+ * on success, we return 1, on failure, 0 (with errno set)
+ */
+static int nl_talk(chan_ctl_t *c, nl_msg_t *m, u_int8_t *reply, size_t reply_len)
+{
+	u_int8_t buf[NL_BUF_SIZE];
+	struct nlmsghdr *n;
+	ssize_t len;
+
+	if (send(c->fd, m, m->n.nlmsg_len, 0) == -1)
+		return 0;
+
+	while (1) {
+		if ((len = recv(c->fd, buf, sizeof(buf), 0)) == -1) {
+			if (errno == EINTR)
+				continue;
+			return 0;
+		}
+
+		for (n = (struct nlmsghdr *)buf; NLMSG_OK(n, len); n = NLMSG_NEXT(n, len)) {
+			if (n->nlmsg_seq != m->n.nlmsg_seq)
+				continue;
+
+			/* the ack (or error) always comes last */
+			if (n->nlmsg_type == NLMSG_ERROR) {
+				struct nlmsgerr *err = NLMSG_DATA(n);
+
+				if (err->error) {
+					errno = -err->error;
+					return 0;
+				}
+				return 1;
+			}
+			if (reply && n->nlmsg_len <= reply_len) {
+				memcpy(reply, n, n->nlmsg_len);
+				reply = NULL;
+			}
+		}
+	}
+}
+
+
+/*
+ * open a generic netlink socket and look up nl80211 on it
+ */
+static int nl80211_open(chan_ctl_t *c, const char *ifname)
+{
+	struct timeval tv = { NL_TIMEOUT / 1000, (NL_TIMEOUT % 1000) * 1000 };
+	struct sockaddr_nl sa;
+	u_int8_t reply[NL_BUF_SIZE];
+	struct nlmsghdr *n = (struct nlmsghdr *)reply;
+	struct nlattr *a;
+	nl_msg_t m;
+	int left;
+
+	if (!(c->ifindex = if_nametoindex(ifname))) {
+		fprintf(stderr, "[!] Unable to find interface \"%s\": %s\n", ifname, strerror(errno));
+		return 0;
+	}
+
+	if ((c->fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC)) == -1) {
+		perror("[!] Unable to open a netlink socket");
+		return 0;
+	}
+	memset(&sa, 0, sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+	if (bind(c->fd, (struct sockaddr *)&sa, sizeof(sa)) == -1
+			|| setsockopt(c->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == -1) {
+		perror("[!] Unable to set up the netlink socket");
+		goto fail;
+	}
+
+	nl_start(&m, c, GENL_ID_CTRL, CTRL_CMD_GETFAMILY);
+	nl_put(&m, CTRL_ATTR_FAMILY_NAME, NL80211_GENL_NAME, sizeof(NL80211_GENL_NAME));
+	memset(reply, 0, sizeof(reply));
+	if (!nl_talk(c, &m, reply, sizeof(reply)) || !n->nlmsg_len) {
+		perror("[!] Unable to find nl80211");
+		goto fail;
+	}
+
+	a = (struct nlattr *)((u_int8_t *)NLMSG_DATA(n) + GENL_HDRLEN);
+	left = n->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+	while (left >= NLA_HDRLEN && a->nla_len >= NLA_HDRLEN && a->nla_len <= left) {
+		if ((a->nla_type & NLA_TYPE_MASK) == CTRL_ATTR_FAMILY_ID) {
+			c->family = *(u_int16_t *)((u_int8_t *)a + NLA_HDRLEN);
+			return 1;
+		}
+		left -= NLA_ALIGN(a->nla_len);
+		a = (struct nlattr *)((u_int8_t *)a + NLA_ALIGN(a->nla_len));
+	}
+	fprintf(stderr, "[!] nl80211 didn't tell us its family id\n");
+
+fail:
+	close(c->fd);
+	c->fd = -1;
+	return 0;
+}
+
+
+/*
+ * same as "iw dev <ifname> set freq <freq>"
+ */
+static int nl80211_set(chan_ctl_t *c, u_int8_t channel, u_int32_t freq)
+{
+	u_int32_t ifindex = c->ifindex, type = NL80211_CHAN_NO_HT;
+	nl_msg_t m;
+
+	nl_start(&m, c, c->family, NL80211_CMD_SET_WIPHY);
+	nl_put(&m, NL80211_ATTR_IFINDEX, &ifindex, sizeof(ifindex));
+	nl_put(&m, NL80211_ATTR_WIPHY_FREQ, &freq, sizeof(freq));
+	nl_put(&m, NL80211_ATTR_WIPHY_CHANNEL_TYPE, &type, sizeof(type));
+	if (!nl_talk(c, &m, NULL, 0)) {
+		fprintf(stderr, "[!] Unable to switch to channel %u (%u MHz): %s\n", channel, freq, strerror(errno));
+		return 0;
+	}
+	return 1;
+}
+
+
+static void nl80211_close(chan_ctl_t *c)
+{
+	if (c->fd != -1)
+		close(c->fd);
+	c->fd = -1;
+}
+
+
+const chan_backend_t chan_nl80211 = {
+	"nl80211", nl80211_open, nl80211_set, nl80211_close
+};
+
+
+/*
+ * the mock backend - nothing to talk to, so every switch works. it keeps
+ * track of what it's asked, so the scheduler can be checked
+ */
+static int mock_open(chan_ctl_t *c, const char *ifname)
+{
+	return 1;
+}
+
+static int mock_set(chan_ctl_t *c, u_int8_t channel, u_int32_t freq)
+{
+	c->mock_channel = channel;
+	c->mock_freq = freq;
+	c->mock_sets++;
+	return 1;
+}
+
+const chan_backend_t chan_mock = {
+	"mock", mock_open, mock_set, NULL
+};
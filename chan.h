@@ -0,0 +1,74 @@
+/*
+ * channel control for jfap
+ *
+ * each interface has its own channel controller, which tunes the card
+ * through a backend: nl80211 talks to the kernel over a generic netlink
+ * socket kept open for the life of the interface, and mock just remembers
+ * and counts what it was asked (for replay and testing, where there's no
+ * card).
+ *
+ * an interface can also hop through a schedule of channels, staying on each
+ * for its own dwell time.
+ */
+
+#ifndef JFAP_CHAN_H
+#define JFAP_CHAN_H
+
+#include <sys/types.h>
+
+
+/* channels in a hop schedule */
+#define CHAN_SCHED_MAX 32
+
+/* how long (ms) we stay on a channel unless the schedule says otherwise */
+#define CHAN_DWELL_DEFAULT 100
+
+struct chan_ctl;
+
+typedef struct chan_backend {
+	const char *name;
+	int (*open)(struct chan_ctl *c, const char *ifname);
+	int (*set)(struct chan_ctl *c, u_int8_t channel, u_int32_t freq);
+	void (*close)(struct chan_ctl *c);
+} chan_backend_t;
+
+typedef struct chan_ctl {
+	const chan_backend_t *be;
+	u_int8_t channel;         /* what the card is on, 0 if we don't know */
+
+	/* nl80211 */
+	int fd;
+	int ifindex;
+	u_int16_t family;
+	u_int32_t seq;
+
+	/* mock - the last switch it was asked for, and how many */
+	u_int8_t mock_channel;
+	u_int32_t mock_freq;
+	u_int64_t mock_sets;
+
+	/* counters */
+	u_int64_t switches;
+	u_int64_t failures;
+	u_int64_t switch_ns;      /* total time spent switching */
+} chan_ctl_t;
+
+typedef struct chan_sched {
+	u_int8_t channels[CHAN_SCHED_MAX];
+	u_int32_t dwell[CHAN_SCHED_MAX];  /* ms */
+	u_int32_t num;
+} chan_sched_t;
+
+
+extern const chan_backend_t chan_nl80211;
+extern const chan_backend_t chan_mock;
+
+const chan_backend_t *chan_backend(const char *name);
+int chan_open(chan_ctl_t *c, const chan_backend_t *be, const char *ifname);
+int chan_set(chan_ctl_t *c, u_int8_t channel);
+void chan_close(chan_ctl_t *c);
+
+u_int32_t chan_to_freq(u_int8_t channel);
+int chan_parse_sched(const char *spec, chan_sched_t *s);
+
+#endif
@@ -0,0 +1,121 @@
+/*
+ * batch frame classifier for jfap
+ */
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "classify.h"
+#include "bss.h"
+
+
+/* offsets within the 802.11 header */
+#define FC0_OFF 0
+#define ADDR1_OFF 4
+#define ADDR2_OFF 10
+
+/* frame control - the first byte is version:2, type:2, subtype:4 */
+#define FC_MGMT 0
+#define FC_DATA 2
+#define FC_PROBE_REQ 4
+#define FC_TYPE(fc0) (((fc0) >> 2) & 3)
+#define FC_SUBTYPE(fc0) ((fc0) >> 4)
+
+#ifdef __SSE2__
+/* addr1 and addr2 of a frame, as one 16-byte vector starting at addr1, match
+ * our networks if (v | la) ^ base is 0 in all but their last octets, and
+ * below the number of networks in those */
+static __m128i cl_base, cl_la, cl_lim;
+static u_int8_t cl_first[BSS_MAX];  /* first octet of each BSSID */
+static u_int8_t cl_last;            /* last octet of the first one */
+static u_int32_t cl_num;
+#endif
+
+
+/*
+ * get ready to classify frames for the networks we have. call again whenever
+ * they change
+ */
+void cl_setup(void)
+{
+#ifdef __SSE2__
+	const u_int8_t *base = bss_base();
+	u_int8_t b[16], la[16], lim[16];
+	u_int32_t i, j;
+
+	/* more than one network means some have the locally administered bit
+	 * and some might not, so ignore it here and check the first octet
+	 * afterwards */
+	cl_num = bss_count();
+	memset(b, 0, sizeof(b));
+	memset(la, 0, sizeof(la));
+	memset(lim, 0xff, sizeof(lim));
+	for (j = 0; j < 2 * ETH_ALEN; j += ETH_ALEN) {
+		memcpy(b + j, base, ETH_ALEN);
+		if (cl_num > 1) {
+			b[j] |= 0x02;
+			la[j] = 0x02;
+		}
+		memset(lim + j, 0, ETH_ALEN);
+		lim[j + ETH_ALEN - 1] = cl_num ? cl_num - 1 : 0;
+	}
+
+	cl_base = _mm_loadu_si128((const __m128i *)b);
+	cl_la = _mm_loadu_si128((const __m128i *)la);
+	cl_lim = _mm_loadu_si128((const __m128i *)lim);
+	for (i = 0; i < cl_num; i++)
+		cl_first[i] = bss_get(i)->bssid[0];
+	cl_last = base[ETH_ALEN - 1];
+#endif
+}
+
+
+/*
+ * work out which of a batch of frames (at most CL_BATCH) to keep. hdrs point
+ * at their 802.11 headers, each with at least the 24 bytes every management
+ * and data frame header has
+ *
+ * returns a bit for each frame, set if it's worth handling
+ */
+u_int64_t cl_classify(const u_int8_t *const *hdrs, u_int32_t n)
+{
+	u_int64_t keep = 0;
+	u_int32_t i;
+
+	if (n > CL_BATCH)
+		n = CL_BATCH;
+
+	for (i = 0; i < n; i++) {
+		const u_int8_t *hdr = hdrs[i];
+		u_int32_t type = FC_TYPE(hdr[FC0_OFF]);
+		int to_us, from_us, probe;
+
+#ifdef __SSE2__
+		__m128i v, t;
+		int ok;
+
+		v = _mm_loadu_si128((const __m128i *)(hdr + ADDR1_OFF));
+		t = _mm_xor_si128(_mm_or_si128(v, cl_la), cl_base);
+		ok = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(t, cl_lim), t));
+
+		to_us = cl_num && (ok & 0x3f) == 0x3f
+			&& hdr[ADDR1_OFF] == cl_first[hdr[ADDR1_OFF + 5] ^ cl_last];
+		from_us = cl_num && (ok & 0xfc0) == 0xfc0
+			&& hdr[ADDR2_OFF] == cl_first[hdr[ADDR2_OFF + 5] ^ cl_last];
+#else
+		to_us = bss_by_addr(hdr + ADDR1_OFF) != NULL;
+		from_us = bss_by_addr(hdr + ADDR2_OFF) != NULL;
+#endif
+
+		/* probe requests are looked at whoever they're for (they're
+		 * logged, even when they aren't answered), everything else has
+		 * to be a management or data frame for one of our networks */
+		probe = type == FC_MGMT && FC_SUBTYPE(hdr[FC0_OFF]) == FC_PROBE_REQ;
+		if (!from_us && (probe || (to_us && (type == FC_MGMT || type == FC_DATA))))
+			keep |= 1ULL << i;
+	}
+	return keep;
+}
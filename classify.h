@@ -0,0 +1,27 @@
+/*
+ * batch frame classifier for jfap
+ *
+ * works out which frames in a batch we'd only throw away, before any of
+ * them is handled, so they never get near the state lock. the rest are
+ * handled in the order they came in. a frame is kept if it isn't from us,
+ * and is either a probe request (for anyone) or a management or data frame
+ * for one of our networks. each frame's first two addresses are checked
+ * against every BSSID we have with one 16-byte load and a few SSE2
+ * instructions, whatever the number of networks (see bss.h for why they can
+ * all be matched at once). without SSE2 it falls back to bss_by_addr().
+ */
+
+#ifndef JFAP_CLASSIFY_H
+#define JFAP_CLASSIFY_H
+
+#include <sys/types.h>
+
+
+/* largest batch we classify at once, a bit each */
+#define CL_BATCH 64
+
+
+void cl_setup(void);
+u_int64_t cl_classify(const u_int8_t *const *hdrs, u_int32_t n);
+
+#endif
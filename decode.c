@@ -0,0 +1,721 @@
+/*
+ * tcpdump-style frame decoder for jfap
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "decode.h"
+#include "hexdump.h"
+
+
+/* offsets within the 802.11 header */
+#define FC0_OFF 0
+#define FC1_OFF 1
+#define ADDR1_OFF 4
+#define ADDR2_OFF 10
+#define ADDR3_OFF 16
+#define SEQ_OFF 22
+#define ADDR4_OFF 24
+#define HDR_LEN 24
+
+/* frame control - the first byte is version:2, type:2, subtype:4 */
+#define FC_MGMT 0
+#define FC_CTRL 1
+#define FC_DATA 2
+#define FC1_TO_DS 0x01
+#define FC1_FROM_DS 0x02
+#define FC1_MORE_FRAGS 0x04
+#define FC1_RETRY 0x08
+#define FC1_PWR_MGMT 0x10
+#define FC1_MORE_DATA 0x20
+#define FC1_PROTECTED 0x40
+#define FC1_ORDER 0x80
+#define FC1_DS_MASK (FC1_TO_DS | FC1_FROM_DS)
+
+#define FC_QOS 8                  /* data subtype bit */
+#define FC_CTS 12                 /* control frames with only addr1 */
+#define FC_ACK 13
+
+#define QOS_TID_MASK 0x0f
+#define QOS_AMSDU 0x80
+
+/* the longest header line we write, and what the fixed fields and IEs of a
+ * frame can take on top of that per byte and in all */
+#define DC_LINE_MAX 512
+#define DC_IE_PER_BYTE 16
+#define DC_FIXED_MAX 128
+
+/* what a frame can need, all told */
+#define DC_NEED(level, len) (DC_LINE_MAX \
+		+ ((level) >= DC_IES ? DC_FIXED_MAX + DC_IE_PER_BYTE * (len) : 0) \
+		+ ((level) >= DC_HEX ? HEXDUMP_SIZE(len) : 0))
+
+/* SSIDs are cut short past this */
+#define DC_SSID_MAX 32
+
+
+const char *dot11_types[4] = { "mgmt", "ctrl", "data", "resv" };
+const char *dot11_subtypes[4][16] = {
+	/* mgmt */
+	{ "assoc-req", "assoc-resp",
+		"re-assoc-req", "re-assoc-resp",
+		"probe-req", "probe-resp",
+		"6?", "7?",
+		"beacon", "atim",
+		"dis-assoc", "auth",
+		"de-auth", "action",
+		"14?", "15?" },
+	/* ctrl */
+	{ "0?", "1?", "2?", "3?", "4?", "5?", "6?", "7?",
+		"8?", "block-ack", "ps-poll", "rts", "cts", "ack", "cf-end", "cf-end-ack" },
+	/* data */
+	{ "0?", "1?", "2?", "3?", "4?", "5?", "6?", "7?", "8?", "9?", "10?", "11?", "12?", "13?", "14?", "15?" },
+	/* reserved */
+	{ "0?", "1?", "2?", "3?", "4?", "5?", "6?", "7?", "8?", "9?", "10?", "11?", "12?", "13?", "14?", "15?" }
+};
+
+/* data subtypes are flags, name them by what they add up to */
+static const char *dc_data_subtypes[16] = {
+	"data", "data-cf-ack", "data-cf-poll", "data-cf-ack-poll",
+	"null", "cf-ack", "cf-poll", "cf-ack-poll",
+	"qos-data", "qos-data-cf-ack", "qos-data-cf-poll", "qos-data-cf-ack-poll",
+	"qos-null", "13?", "qos-cf-poll", "qos-cf-ack-poll"
+};
+
+static const char *dc_ie_names[256] = {
+	[0] = "ssid",
+	[1] = "rates",
+	[3] = "ds",
+	[5] = "tim",
+	[7] = "country",
+	[42] = "erp",
+	[45] = "ht-caps",
+	[48] = "rsn",
+	[50] = "ext-rates",
+	[61] = "ht-op",
+	[127] = "ext-caps",
+	[191] = "vht-caps",
+	[192] = "vht-op",
+	[221] = "vendor",
+	[255] = "ext",
+};
+
+
+/*
+ * little pieces of text. each writes at p and returns where it stopped
+ */
+static inline char *dc_str(char *p, const char *s)
+{
+	while (*s)
+		*p++ = *s++;
+	return p;
+}
+
+static inline char *dc_hex8(char *p, u_int8_t v)
+{
+	*p++ = hex_pairs[2 * v];
+	*p++ = hex_pairs[2 * v + 1];
+	return p;
+}
+
+static inline char *dc_hex16(char *p, u_int16_t v)
+{
+	*p++ = '0';
+	*p++ = 'x';
+	p = dc_hex8(p, v >> 8);
+	return dc_hex8(p, v & 0xff);
+}
+
+static inline char *dc_mac(char *p, const u_int8_t *mac)
+{
+	int i;
+
+	p = dc_hex8(p, mac[0]);
+	for (i = 1; i < 6; i++) {
+		*p++ = ':';
+		p = dc_hex8(p, mac[i]);
+	}
+	return p;
+}
+
+static char *dc_uint(char *p, u_int64_t v)
+{
+	char tmp[20];
+	int n = 0;
+
+	do {
+		tmp[n++] = '0' + v % 10;
+		v /= 10;
+	} while (v);
+	while (n)
+		*p++ = tmp[--n];
+	return p;
+}
+
+static inline char *dc_int(char *p, int v)
+{
+	if (v < 0) {
+		*p++ = '-';
+		return dc_uint(p, -(int64_t)v);
+	}
+	return dc_uint(p, v);
+}
+
+/* rates are in 500kbps units */
+static inline char *dc_rate(char *p, u_int8_t rate)
+{
+	p = dc_uint(p, rate / 2);
+	*p++ = '.';
+	*p++ = (rate & 1) ? '5' : '0';
+	return p;
+}
+
+/* printable as is, anything else as a dot */
+static inline char *dc_text(char *p, const u_int8_t *s, u_int32_t len)
+{
+	u_int32_t i;
+
+	for (i = 0; i < len; i++)
+		*p++ = (s[i] >= 0x20 && s[i] < 0x7f) ? s[i] : '.';
+	return p;
+}
+
+static inline u_int16_t dc_le16(const u_int8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+
+/*
+ * the time of day in ts (ns since the epoch), to the us. localtime_r() is
+ * only called when the second changes
+ */
+static char *dc_time(decoder_t *dc, char *p, u_int64_t ts)
+{
+	time_t sec = ts / 1000000000;
+	u_int32_t us = ts % 1000000000 / 1000, div;
+	struct tm tm;
+
+	if (sec != dc->sec) {
+		localtime_r(&sec, &tm);
+		dc->clock[0] = '0' + tm.tm_hour / 10;
+		dc->clock[1] = '0' + tm.tm_hour % 10;
+		dc->clock[2] = ':';
+		dc->clock[3] = '0' + tm.tm_min / 10;
+		dc->clock[4] = '0' + tm.tm_min % 10;
+		dc->clock[5] = ':';
+		dc->clock[6] = '0' + tm.tm_sec / 10;
+		dc->clock[7] = '0' + tm.tm_sec % 10;
+		dc->sec = sec;
+	}
+
+	memcpy(p, dc->clock, sizeof(dc->clock));
+	p += sizeof(dc->clock);
+	*p++ = '.';
+	for (div = 100000; div; div /= 10)
+		*p++ = '0' + us / div % 10;
+	return p;
+}
+
+
+/*
+ * where a management frame's IEs start, after the header and fixed fields,
+ * or 0 if it has none we can read
+ */
+static u_int32_t dc_ie_off(const u_int8_t *f, u_int32_t len)
+{
+	u_int32_t off = HDR_LEN + ((f[FC1_OFF] & FC1_ORDER) ? 4 : 0);
+
+	if (f[FC1_OFF] & FC1_PROTECTED)
+		return 0;
+
+	switch (f[FC0_OFF] >> 4) {
+		case 0: off += 4; break;        /* assoc-req */
+		case 1: case 3: off += 6; break;/* (re-)assoc-resp */
+		case 2: off += 10; break;       /* re-assoc-req */
+		case 4: break;                  /* probe-req */
+		case 5: case 8: off += 12; break;/* probe-resp, beacon */
+		case 11: off += 6; break;       /* auth */
+		default: return 0;
+	}
+	return off <= len ? off : 0;
+}
+
+
+/*
+ * the line for the radiotap metadata and 802.11 header
+ */
+static char *dc_header(decoder_t *dc, char *p, u_int64_t ts, const rt_meta_t *rt, const u_int8_t *f, u_int32_t len)
+{
+	u_int32_t type, subtype, hdr = HDR_LEN, off;
+	u_int8_t fc1;
+
+	p = dc_time(dc, p, ts);
+	if (RT_HAVE(rt, CHANNEL)) {
+		*p++ = ' ';
+		p = dc_uint(p, rt->freq);
+		p = dc_str(p, "MHz");
+	}
+	if (RT_HAVE(rt, RATE)) {
+		*p++ = ' ';
+		p = dc_rate(p, rt->rate);
+		p = dc_str(p, "Mb/s");
+	}
+	if (RT_HAVE(rt, DBM_ANTSIGNAL)) {
+		*p++ = ' ';
+		p = dc_int(p, rt->signal);
+		p = dc_str(p, "dBm");
+	}
+	if (RT_HAVE(rt, DBM_ANTNOISE)) {
+		p = dc_str(p, " noise ");
+		p = dc_int(p, rt->noise);
+		p = dc_str(p, "dBm");
+	}
+	if (RT_HAVE(rt, ANTENNA)) {
+		p = dc_str(p, " ant ");
+		p = dc_uint(p, rt->antenna);
+	}
+	if (RT_HAVE(rt, FLAGS) && (rt->flags & IEEE80211_RADIOTAP_F_BADFCS))
+		p = dc_str(p, " bad-fcs");
+
+	if (len < ADDR2_OFF) {
+		p = dc_str(p, " truncated len ");
+		p = dc_uint(p, len);
+		*p++ = '\n';
+		return p;
+	}
+
+	type = (f[FC0_OFF] >> 2) & 3;
+	subtype = f[FC0_OFF] >> 4;
+	fc1 = f[FC1_OFF];
+	*p++ = ' ';
+	p = dc_str(p, dot11_types[type]);
+	*p++ = '/';
+	p = dc_str(p, type == FC_DATA ? dc_data_subtypes[subtype] : dot11_subtypes[type][subtype]);
+
+	/* who it's from and to. control frames only have one or two
+	 * addresses, and data frames put them where the DS bits say */
+	if (type == FC_CTRL) {
+		if (subtype != FC_CTS && subtype != FC_ACK && len >= ADDR3_OFF) {
+			*p++ = ' ';
+			p = dc_mac(p, f + ADDR2_OFF);
+			p = dc_str(p, " >");
+		}
+		p = dc_str(p, " ra ");
+		p = dc_mac(p, f + ADDR1_OFF);
+	} else if (len < HDR_LEN)
+		p = dc_str(p, " truncated");
+	else {
+		const u_int8_t *sa = f + ADDR2_OFF, *da = f + ADDR1_OFF, *bssid = f + ADDR3_OFF;
+		u_int32_t ds = type == FC_DATA ? fc1 & FC1_DS_MASK : 0;
+
+		if (ds == FC1_TO_DS) {
+			bssid = f + ADDR1_OFF;
+			da = f + ADDR3_OFF;
+		} else if (ds == FC1_FROM_DS) {
+			bssid = f + ADDR2_OFF;
+			sa = f + ADDR3_OFF;
+		} else if (ds == FC1_DS_MASK) {
+			hdr += 6;
+			da = f + ADDR3_OFF;
+			sa = len >= hdr ? f + ADDR4_OFF : NULL;
+			bssid = NULL;
+		}
+
+		if (sa) {
+			*p++ = ' ';
+			p = dc_mac(p, sa);
+			p = dc_str(p, " > ");
+			p = dc_mac(p, da);
+		}
+		if (bssid) {
+			p = dc_str(p, " bssid ");
+			p = dc_mac(p, bssid);
+		} else {
+			p = dc_str(p, " ra ");
+			p = dc_mac(p, f + ADDR1_OFF);
+			p = dc_str(p, " ta ");
+			p = dc_mac(p, f + ADDR2_OFF);
+		}
+
+		p = dc_str(p, " seq ");
+		p = dc_uint(p, dc_le16(f + SEQ_OFF) >> 4);
+		if (dc_le16(f + SEQ_OFF) & 0xf || (fc1 & FC1_MORE_FRAGS)) {
+			p = dc_str(p, " frag ");
+			p = dc_uint(p, dc_le16(f + SEQ_OFF) & 0xf);
+		}
+
+		if (type == FC_DATA && (subtype & FC_QOS) && len >= hdr + 2) {
+			u_int16_t qos = dc_le16(f + hdr);
+
+			p = dc_str(p, " tid ");
+			p = dc_uint(p, qos & QOS_TID_MASK);
+			if (qos & QOS_AMSDU)
+				p = dc_str(p, " a-msdu");
+		}
+	}
+
+	if (fc1 & FC1_RETRY)
+		p = dc_str(p, " retry");
+	if (fc1 & FC1_MORE_FRAGS)
+		p = dc_str(p, " more-frags");
+	if (fc1 & FC1_PWR_MGMT)
+		p = dc_str(p, " pwr-mgmt");
+	if (fc1 & FC1_MORE_DATA)
+		p = dc_str(p, " more-data");
+	if (fc1 & FC1_PROTECTED)
+		p = dc_str(p, " protected");
+	p = dc_str(p, " len ");
+	p = dc_uint(p, len);
+
+	/* the SSID, when it's the first IE like it's supposed to be */
+	if (type == FC_MGMT && (off = dc_ie_off(f, len)) && off + 2 <= len
+			&& f[off] == 0 && off + 2 + f[off + 1] <= len) {
+		p = dc_str(p, " \"");
+		p = dc_text(p, f + off + 2, f[off + 1] < DC_SSID_MAX ? f[off + 1] : DC_SSID_MAX);
+		*p++ = '"';
+	}
+
+	*p++ = '\n';
+	return p;
+}
+
+
+/*
+ * a line for a management frame's fixed fields, and one for each IE
+ */
+static char *dc_body(char *p, const u_int8_t *f, u_int32_t len)
+{
+	u_int32_t off = HDR_LEN + ((f[FC1_OFF] & FC1_ORDER) ? 4 : 0), ie, n, i;
+	const u_int8_t *b = f + off;
+	char *line = p;
+
+	if (len < HDR_LEN || ((f[FC0_OFF] >> 2) & 3) != FC_MGMT || (f[FC1_OFF] & FC1_PROTECTED))
+		return p;
+
+	/* the fixed fields, by subtype */
+	p = dc_str(p, "   ");
+	switch (f[FC0_OFF] >> 4) {
+		case 0:
+		case 2:
+			if (len < off + 4)
+				break;
+			p = dc_str(p, " caps ");
+			p = dc_hex16(p, dc_le16(b));
+			p = dc_str(p, " interval ");
+			p = dc_uint(p, dc_le16(b + 2));
+			if ((f[FC0_OFF] >> 4) == 2 && len >= off + 10) {
+				p = dc_str(p, " current ap ");
+				p = dc_mac(p, b + 4);
+			}
+			break;
+
+		case 1:
+		case 3:
+			if (len < off + 6)
+				break;
+			p = dc_str(p, " caps ");
+			p = dc_hex16(p, dc_le16(b));
+			p = dc_str(p, " status ");
+			p = dc_uint(p, dc_le16(b + 2));
+			p = dc_str(p, " aid ");
+			p = dc_uint(p, dc_le16(b + 4) & 0x3fff);
+			break;
+
+		case 5:
+		case 8:
+			if (len < off + 12)
+				break;
+			p = dc_str(p, " tsf ");
+			p = dc_uint(p, dc_le16(b) | (u_int64_t)dc_le16(b + 2) << 16
+					| (u_int64_t)dc_le16(b + 4) << 32 | (u_int64_t)dc_le16(b + 6) << 48);
+			p = dc_str(p, " interval ");
+			p = dc_uint(p, dc_le16(b + 8));
+			p = dc_str(p, " caps ");
+			p = dc_hex16(p, dc_le16(b + 10));
+			break;
+
+		case 10:
+		case 12:
+			if (len < off + 2)
+				break;
+			p = dc_str(p, " reason ");
+			p = dc_uint(p, dc_le16(b));
+			break;
+
+		case 11:
+			if (len < off + 6)
+				break;
+			p = dc_str(p, " alg ");
+			p = dc_uint(p, dc_le16(b));
+			p = dc_str(p, " seq ");
+			p = dc_uint(p, dc_le16(b + 2));
+			p = dc_str(p, " status ");
+			p = dc_uint(p, dc_le16(b + 4));
+			break;
+
+		case 13:
+			if (len < off + 1)
+				break;
+			p = dc_str(p, " category ");
+			p = dc_uint(p, b[0]);
+			break;
+	}
+	/* no fixed fields after all */
+	if (p == line + 3)
+		p = line;
+	else
+		*p++ = '\n';
+
+	if (!(off = dc_ie_off(f, len)))
+		return p;
+
+	for (ie = off; ie + 2 <= len; ie += 2 + n) {
+		u_int8_t id = f[ie];
+
+		n = f[ie + 1];
+		p = dc_str(p, "    ie ");
+		p = dc_uint(p, id);
+		if (dc_ie_names[id]) {
+			*p++ = ' ';
+			p = dc_str(p, dc_ie_names[id]);
+		}
+		if (ie + 2 + n > len) {
+			p = dc_str(p, " truncated\n");
+			break;
+		}
+
+		b = f + ie + 2;
+		switch (id) {
+			case 0:
+				p = dc_str(p, " \"");
+				p = dc_text(p, b, n);
+				*p++ = '"';
+				break;
+
+			case 1:
+			case 50:
+				/* the top bit says it's a basic rate */
+				for (i = 0; i < n; i++) {
+					*p++ = ' ';
+					p = dc_rate(p, b[i] & 0x7f);
+					if (b[i] & 0x80)
+						*p++ = '*';
+				}
+				break;
+
+			case 3:
+				if (n < 1)
+					break;
+				p = dc_str(p, " channel ");
+				p = dc_uint(p, b[0]);
+				break;
+
+			default:
+				p = dc_str(p, " len ");
+				p = dc_uint(p, n);
+				if (n)
+					*p++ = ':';
+				for (i = 0; i < n; i++) {
+					*p++ = ' ';
+					p = dc_hex8(p, b[i]);
+				}
+				break;
+		}
+		*p++ = '\n';
+	}
+	return p;
+}
+
+
+/*
+ * set up an output for decoders to share. the fd is the caller's
+ */
+void dc_out_init(dc_out_t *out, int fd)
+{
+	out->fd = fd;
+	pthread_mutex_init(&out->lock, NULL);
+	out->partial = NULL;
+}
+
+
+/*
+ * get ready to decode frames to out, at a level from the enum in decode.h
+ *
+ * on success, we return 1, on failure, 0
+ */
+int dc_open(decoder_t *dc, dc_out_t *out, int level)
+{
+	memset(dc, 0, sizeof(*dc));
+	dc->out = out;
+	dc->level = level;
+	dc->sec = (time_t)-1;
+	if (!(dc->buf = malloc(DC_BUF_SIZE))) {
+		perror("[!] Unable to allocate the decode buffer");
+		return 0;
+	}
+	return 1;
+}
+
+
+/*
+ * find room for need bytes of text after what's pending, wrapping around to
+ * the start of the ring if there's more there
+ *
+ * returns NULL if there isn't any
+ */
+static char *dc_reserve(decoder_t *dc, u_int32_t need)
+{
+	if (dc->wrapped)
+		return dc->tail - dc->head >= need ? dc->buf + dc->head : NULL;
+
+	if (dc->tail == dc->head)
+		dc->tail = dc->head = 0;
+	if (DC_BUF_SIZE - dc->head >= need)
+		return dc->buf + dc->head;
+	if (dc->tail >= need) {
+		dc->end = dc->head;
+		dc->head = 0;
+		dc->wrapped = 1;
+		return dc->buf;
+	}
+	return NULL;
+}
+
+
+/*
+ * decode a frame. ts is when it was captured (ns since the epoch, 0 for now),
+ * and frame is its 802.11 header and body, without the FCS
+ */
+void dc_frame(decoder_t *dc, u_int64_t ts, const rt_meta_t *rt, const u_int8_t *frame, u_int32_t len)
+{
+	u_int32_t shown = len < DC_FRAME_MAX ? len : DC_FRAME_MAX;
+	u_int32_t pending;
+	char *start, *p;
+
+	if (!ts) {
+		struct timespec now;
+
+		clock_gettime(CLOCK_REALTIME, &now);
+		ts = (u_int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+	}
+
+	/* make room by writing out what we have, and if that isn't enough
+	 * (the reader is behind), skip this one */
+	if (!(start = dc_reserve(dc, DC_NEED(dc->level, shown)))) {
+		dc_flush(dc);
+		if (!(start = dc_reserve(dc, DC_NEED(dc->level, shown)))) {
+			dc->dropped++;
+			return;
+		}
+	}
+
+	p = dc_header(dc, start, ts, rt, frame, len);
+	if (dc->level >= DC_IES)
+		p = dc_body(p, frame, shown);
+	if (dc->level >= DC_HEX)
+		p += hexdump_format(p, frame, shown);
+	dc->head = p - dc->buf;
+	dc->frames++;
+
+	pending = dc->wrapped ? dc->end - dc->tail + dc->head : dc->head - dc->tail;
+	if (pending >= DC_FLUSH_AT)
+		dc_flush(dc);
+}
+
+
+/*
+ * write out as much of the pending text as the fd takes without blocking (if
+ * it's non-blocking), in one writev() per try. if another decoder is halfway
+ * through a line, ours waits for next time
+ *
+ * on success, we return 1, on failure, 0
+ */
+int dc_flush(decoder_t *dc)
+{
+	dc_out_t *out = dc->out;
+	struct iovec iov[2];
+	char last;
+	ssize_t n;
+	int cnt, ret = 1;
+
+	if (!dc->wrapped && dc->tail == dc->head)
+		return 1;
+
+	pthread_mutex_lock(&out->lock);
+	if (out->partial && out->partial != dc) {
+		pthread_mutex_unlock(&out->lock);
+		return 1;
+	}
+
+	/* where the last write left off, if it was us */
+	last = out->partial == dc ? 0 : '\n';
+	while (dc->wrapped || dc->tail != dc->head) {
+		if (dc->wrapped) {
+			iov[0].iov_base = dc->buf + dc->tail;
+			iov[0].iov_len = dc->end - dc->tail;
+			iov[1].iov_base = dc->buf;
+			iov[1].iov_len = dc->head;
+			cnt = 2;
+		} else {
+			iov[0].iov_base = dc->buf + dc->tail;
+			iov[0].iov_len = dc->head - dc->tail;
+			cnt = 1;
+		}
+
+		if ((n = writev(out->fd, iov, cnt)) == -1) {
+			if (errno == EINTR)
+				continue;
+			/* the rest goes next time */
+			if (errno != EAGAIN) {
+				perror("[-] Unable to write decoded frames");
+				ret = 0;
+			}
+			break;
+		}
+		if (!n)
+			break;
+		dc->bytes += n;
+
+		if (dc->wrapped) {
+			if ((u_int32_t)n < iov[0].iov_len) {
+				dc->tail += n;
+				last = dc->buf[dc->tail - 1];
+				continue;
+			}
+			n -= iov[0].iov_len;
+			last = dc->buf[dc->end - 1];
+			dc->tail = 0;
+			dc->wrapped = 0;
+		}
+		dc->tail += n;
+		if (dc->tail)
+			last = dc->buf[dc->tail - 1];
+	}
+
+	/* every frame's text ends a line */
+	out->partial = last == '\n' ? NULL : dc;
+	pthread_mutex_unlock(&out->lock);
+
+	if (!dc->wrapped && dc->tail == dc->head)
+		dc->tail = dc->head = 0;
+	return ret;
+}
+
+
+/*
+ * write out what's left and let go of the ring. the fd is the caller's
+ */
+void dc_close(decoder_t *dc)
+{
+	if (!dc->buf)
+		return;
+	dc_flush(dc);
+	free(dc->buf);
+	dc->buf = NULL;
+}
@@ -0,0 +1,86 @@
+/*
+ * tcpdump-style frame decoder for jfap
+ *
+ * every frame we capture can be decoded as it comes in: a line with its
+ * radiotap metadata and 802.11 header, then optionally its fixed fields and
+ * IEs, and a hex/ASCII dump. nothing is formatted with stdio, the text is
+ * built with tables straight into a big ring owned by the calling thread and
+ * written out with writev() once enough has piled up (or when asked). a
+ * frame is only decoded if its worst case fits, so with a non-blocking
+ * output a slow reader costs us decoded frames, which are counted, rather
+ * than captured ones. a blocking output (a regular file, say) holds up the
+ * thread instead.
+ *
+ * the threads decoding share their output. whoever's write stops partway
+ * through a line keeps it until the line is done, so lines from different
+ * threads never run into each other.
+ */
+
+#ifndef JFAP_DECODE_H
+#define JFAP_DECODE_H
+
+#include <sys/types.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "radiotap.h"
+
+
+/* how much is decoded */
+enum {
+	DC_OFF = 0,
+	DC_HEADER,                /* one line per frame */
+	DC_IES,                   /* ... plus fixed fields and IEs */
+	DC_HEX,                   /* ... plus a hex/ASCII dump */
+	DC_MAX
+};
+
+/* size of each thread's ring, and how full it gets before it's written out */
+#define DC_BUF_SIZE (1 << 20)
+#define DC_FLUSH_AT (64 << 10)
+
+/* frames are only decoded this far */
+#define DC_FRAME_MAX 8192
+
+struct decoder;
+
+/* where decoded text goes, shared by every decoder writing there */
+typedef struct dc_out {
+	int fd;
+	pthread_mutex_t lock;
+	struct decoder *partial;  /* stopped mid-line, nobody else writes */
+} dc_out_t;
+
+typedef struct decoder {
+	dc_out_t *out;
+	int level;
+
+	/* pending text is tail..head, or tail..end and then 0..head once the
+	 * writer has wrapped around */
+	char *buf;
+	u_int32_t head;
+	u_int32_t tail;
+	u_int32_t end;
+	int wrapped;
+
+	/* the time of day of the last frame's second, already formatted */
+	time_t sec;
+	char clock[8];
+
+	/* counters */
+	u_int64_t frames;
+	u_int64_t dropped;        /* no room to decode them */
+	u_int64_t bytes;          /* written out */
+} decoder_t;
+
+extern const char *dot11_types[4];
+extern const char *dot11_subtypes[4][16];
+
+
+void dc_out_init(dc_out_t *out, int fd);
+int dc_open(decoder_t *dc, dc_out_t *out, int level);
+void dc_frame(decoder_t *dc, u_int64_t ts, const rt_meta_t *rt, const u_int8_t *frame, u_int32_t len);
+int dc_flush(decoder_t *dc);
+void dc_close(decoder_t *dc);
+
+#endif
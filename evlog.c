@@ -0,0 +1,402 @@
+/*
+ * asynchronous event log for jfap
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "evlog.h"
+
+
+typedef struct ev_ring {
+	/* producer */
+	u_int32_t head __attribute__((aligned(64)));
+	u_int32_t tail_cache;
+	u_int64_t dropped;
+
+	/* consumer */
+	u_int32_t tail __attribute__((aligned(64)));
+
+	ev_t recs[EVLOG_RING_SIZE] __attribute__((aligned(64)));
+} ev_ring_t;
+
+/* how each event is named in JSON, and what its numbers mean */
+static const struct {
+	const char *name;
+	const char *a, *b, *c;
+	int warn;                 /* goes to stderr in text mode */
+} ev_info[EV_MAX] = {
+	[EV_PROBE_DIRECTED] = { "probe-directed", "ssid_match", NULL, NULL, 0 },
+	[EV_PROBE_OURS] = { "probe-ours", NULL, NULL, NULL, 0 },
+	[EV_PROBE_OTHER] = { "probe-other", NULL, NULL, NULL, 0 },
+	[EV_PROBE_WILDCARD] = { "probe-wildcard", NULL, NULL, NULL, 0 },
+	[EV_PROBE_UNHANDLED] = { "probe-unhandled", "ssid_len", NULL, NULL, 0 },
+	[EV_PROBE_NO_SSID] = { "probe-no-ssid", NULL, NULL, NULL, 1 },
+	[EV_IE_TRUNCATED] = { "ie-truncated", NULL, NULL, NULL, 1 },
+	[EV_AUTH] = { "auth", "algorithm", "seq", "status", 0 },
+	[EV_AUTH_SHORT] = { "auth-short", NULL, NULL, NULL, 1 },
+	[EV_AUTH_BAD_SEQ] = { "auth-bad-seq", NULL, "seq", NULL, 1 },
+	[EV_ASSOC] = { "assoc", "caps", "interval", NULL, 0 },
+	[EV_ASSOC_NO_SSID] = { "assoc", "caps", "interval", NULL, 0 },
+	[EV_ASSOC_SHORT] = { "assoc-short", NULL, NULL, NULL, 1 },
+	[EV_ESTABLISHED] = { "established", NULL, NULL, NULL, 0 },
+};
+
+static ev_ring_t *ev_rings[EVLOG_MAX_THREADS];
+static u_int32_t ev_nrings;
+static u_int64_t ev_unregistered;     /* from threads past EVLOG_MAX_THREADS */
+static __thread ev_ring_t *ev_my_ring;
+static __thread int ev_no_ring;
+
+static int ev_format;
+static FILE *ev_out;
+static pthread_t ev_thread;
+static int ev_running;
+static int ev_stop;
+
+
+/*
+ * give the calling thread a ring of its own
+ */
+static ev_ring_t *ev_register(void)
+{
+	ev_ring_t *r;
+	u_int32_t idx;
+
+	if (ev_no_ring)
+		return NULL;
+
+	idx = __atomic_fetch_add(&ev_nrings, 1, __ATOMIC_ACQ_REL);
+	if (idx >= EVLOG_MAX_THREADS || !(r = aligned_alloc(64, sizeof(*r)))) {
+		ev_no_ring = 1;
+		return NULL;
+	}
+	memset(r, 0, sizeof(*r));
+
+	__atomic_store_n(&ev_rings[idx], r, __ATOMIC_RELEASE);
+	return ev_my_ring = r;
+}
+
+
+/*
+ * reserve the next record in this thread's ring. it isn't seen by the log
+ * thread until ev_commit()
+ *
+ * returns NULL (and counts a drop) if the ring is full
+ */
+ev_t *ev_new(u_int16_t type, u_int64_t ts, const u_int8_t *mac)
+{
+	ev_ring_t *r = ev_my_ring;
+	ev_t *ev;
+
+	if (!r && !(r = ev_register())) {
+		__atomic_fetch_add(&ev_unregistered, 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+
+	if (r->head - r->tail_cache >= EVLOG_RING_SIZE) {
+		r->tail_cache = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+		if (r->head - r->tail_cache >= EVLOG_RING_SIZE) {
+			__atomic_store_n(&r->dropped, r->dropped + 1, __ATOMIC_RELAXED);
+			return NULL;
+		}
+	}
+
+	ev = &r->recs[r->head & (EVLOG_RING_SIZE - 1)];
+	ev->ts = ts;
+	ev->type = type;
+	memcpy(ev->mac, mac, sizeof(ev->mac));
+	ev->a = ev->b = ev->c = 0;
+	ev->ssid_len = 0;
+	ev->pad = 0;
+	return ev;
+}
+
+
+/*
+ * publish the record from ev_new()
+ */
+void ev_commit(ev_t *ev)
+{
+	ev_ring_t *r = ev_my_ring;
+
+	__atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * format the SSID the way the old messages did - up to 31 characters, and
+ * stopping at a nul
+ */
+static int ev_ssid_len(const ev_t *ev)
+{
+	int len = strnlen((const char *)ev->ssid, ev->ssid_len);
+
+	return len > EV_SSID_MAX - 1 ? EV_SSID_MAX - 1 : len;
+}
+
+
+static void ev_write_text(const ev_t *ev)
+{
+	FILE *fp = ev_info[ev->type].warn ? stderr : ev_out;
+	char mac[18];
+	int len = ev_ssid_len(ev);
+	const char *ssid = (const char *)ev->ssid;
+
+	snprintf(mac, sizeof(mac), "%02x:%02x:%02x:%02x:%02x:%02x",
+			ev->mac[0], ev->mac[1], ev->mac[2], ev->mac[3], ev->mac[4], ev->mac[5]);
+
+	switch (ev->type) {
+		case EV_PROBE_DIRECTED:
+			fprintf(fp, "[*] (%s) Probe request for our BSSID%s, replying...\n", mac, ev->a ? " and SSID" : "");
+			break;
+
+		case EV_PROBE_OURS:
+			fprintf(fp, "[*] (%s) Broadcast probe request for our SSID \"%.*s\" received, replying...\n", mac, len, ssid);
+			break;
+
+		case EV_PROBE_OTHER:
+			fprintf(fp, "[*] (%s) Broadcast probe request for \"%.*s\" received, NOT replying...\n", mac, len, ssid);
+			break;
+
+		case EV_PROBE_WILDCARD:
+			fprintf(fp, "[*] (%s) Broadcast probe request received, replying...\n", mac);
+			break;
+
+		case EV_PROBE_UNHANDLED:
+			if (ev->a)
+				fprintf(fp, "[*] (%s) Unhandled probe request for SSID (%u bytes): \"%.*s\"\n", mac, ev->a, len, ssid);
+			else
+				fprintf(fp, "[*] (%s) Unhandled probe request for empty SSID\n", mac);
+			break;
+
+		case EV_PROBE_NO_SSID:
+			fprintf(fp, "[-] Probe request with no SSID encountered!\n");
+			break;
+
+		case EV_IE_TRUNCATED:
+			fprintf(fp, "[-] (%s) Not enough data for the IE's data!\n", mac);
+			break;
+
+		case EV_AUTH:
+			fprintf(fp, "[*] (%s) Auth request received (alg:0x%x, seq:%u, status:%u), replying...\n",
+					mac, ev->a, ev->b, ev->c);
+			break;
+
+		case EV_AUTH_SHORT:
+			fprintf(fp, "[-] (%s) Auth request without parameters!\n", mac);
+			break;
+
+		case EV_AUTH_BAD_SEQ:
+			fprintf(fp, "[-] Authentication sequence is not 0x0001 !!\n");
+			break;
+
+		case EV_ASSOC:
+			fprintf(fp, "[*] (%s) Association request for \"%.*s\" received (caps:0x%x, interval: %u), replying...\n",
+					mac, len, ssid, ev->a, ev->b);
+			break;
+
+		case EV_ASSOC_NO_SSID:
+			fprintf(fp, "[*] (%s) Association request without SSID received (caps:0x%x, interval: %u), replying...\n",
+					mac, ev->a, ev->b);
+			break;
+
+		case EV_ASSOC_SHORT:
+			fprintf(fp, "[-] (%s) Association request without parameters!\n", mac);
+			break;
+
+		case EV_ESTABLISHED:
+			fprintf(fp, "[*] (%s) Station successfully associated and is sending data...\n", mac);
+			break;
+	}
+}
+
+
+static void ev_write_json(const ev_t *ev)
+{
+	u_int32_t i;
+
+	fprintf(ev_out, "{\"ts\":%llu,\"event\":\"%s\",\"mac\":\"%02x:%02x:%02x:%02x:%02x:%02x\"",
+			(unsigned long long)ev->ts, ev_info[ev->type].name,
+			ev->mac[0], ev->mac[1], ev->mac[2], ev->mac[3], ev->mac[4], ev->mac[5]);
+
+	if (ev->type == EV_PROBE_OURS || ev->type == EV_PROBE_OTHER
+			|| ev->type == EV_PROBE_UNHANDLED || ev->type == EV_ASSOC) {
+		fputs(",\"ssid\":\"", ev_out);
+		for (i = 0; i < ev->ssid_len; i++) {
+			u_int8_t ch = ev->ssid[i];
+
+			if (ch == '"' || ch == '\\')
+				fprintf(ev_out, "\\%c", ch);
+			else if (ch < 0x20 || ch >= 0x7f)
+				fprintf(ev_out, "\\u%04x", ch);
+			else
+				fputc(ch, ev_out);
+		}
+		fputc('"', ev_out);
+	}
+
+	if (ev_info[ev->type].a)
+		fprintf(ev_out, ",\"%s\":%u", ev_info[ev->type].a, ev->a);
+	if (ev_info[ev->type].b)
+		fprintf(ev_out, ",\"%s\":%u", ev_info[ev->type].b, ev->b);
+	if (ev_info[ev->type].c)
+		fprintf(ev_out, ",\"%s\":%u", ev_info[ev->type].c, ev->c);
+	fputs("}\n", ev_out);
+}
+
+
+static void ev_write(const ev_t *ev)
+{
+	if (ev->type == 0 || ev->type >= EV_MAX)
+		return;
+
+	switch (ev_format) {
+		case EVLOG_TEXT:
+			ev_write_text(ev);
+			break;
+
+		case EVLOG_JSON:
+			ev_write_json(ev);
+			break;
+
+		case EVLOG_RAW:
+			fwrite(ev, sizeof(*ev), 1, ev_out);
+			break;
+	}
+}
+
+
+/*
+ * write out everything that's been logged, and any new drops
+ *
+ * returns the number of records written
+ */
+static u_int32_t ev_drain(u_int64_t *reported)
+{
+	u_int32_t i, n, cnt = 0;
+	u_int64_t dropped;
+
+	n = __atomic_load_n(&ev_nrings, __ATOMIC_ACQUIRE);
+	if (n > EVLOG_MAX_THREADS)
+		n = EVLOG_MAX_THREADS;
+
+	for (i = 0; i < n; i++) {
+		ev_ring_t *r = __atomic_load_n(&ev_rings[i], __ATOMIC_ACQUIRE);
+		u_int32_t head;
+
+		if (!r)
+			continue;
+
+		head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		while (r->tail != head) {
+			ev_write(&r->recs[r->tail & (EVLOG_RING_SIZE - 1)]);
+			__atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+			cnt++;
+		}
+	}
+
+	dropped = evlog_dropped();
+	if (dropped != *reported) {
+		if (ev_format == EVLOG_JSON)
+			fprintf(ev_out, "{\"event\":\"dropped\",\"count\":%llu}\n",
+					(unsigned long long)(dropped - *reported));
+		else
+			fprintf(ev_format == EVLOG_RAW ? stderr : ev_out,
+					"[-] Event log full, dropped %llu events (%llu total)\n",
+					(unsigned long long)(dropped - *reported), (unsigned long long)dropped);
+		*reported = dropped;
+		cnt++;
+	}
+
+	if (cnt)
+		fflush(ev_out);
+	return cnt;
+}
+
+
+static void *ev_thread_main(void *arg)
+{
+	struct timespec idle = { 0, EVLOG_IDLE_MS * 1000000L };
+	u_int64_t reported = 0;
+
+	while (!__atomic_load_n(&ev_stop, __ATOMIC_ACQUIRE)) {
+		if (!ev_drain(&reported))
+			nanosleep(&idle, NULL);
+	}
+
+	/* whatever was logged before we were told to stop */
+	ev_drain(&reported);
+	return NULL;
+}
+
+
+/*
+ * start the log thread, writing to out in the specified format
+ *
+ * on success, we return 1, on failure, 0
+ */
+int evlog_start(int format, FILE *out)
+{
+	sigset_t all, old;
+	int err;
+
+	ev_format = format;
+	ev_out = out;
+	ev_stop = 0;
+
+	/* leave signals to the main thread */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	err = pthread_create(&ev_thread, NULL, ev_thread_main, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (err) {
+		fprintf(stderr, "[!] Unable to start the event log thread: %s\n", strerror(err));
+		return 0;
+	}
+	ev_running = 1;
+	return 1;
+}
+
+
+/*
+ * write out anything still queued and stop the log thread
+ */
+void evlog_stop(void)
+{
+	if (!ev_running)
+		return;
+
+	__atomic_store_n(&ev_stop, 1, __ATOMIC_RELEASE);
+	pthread_join(ev_thread, NULL);
+	ev_running = 0;
+	fflush(ev_out);
+}
+
+
+/*
+ * how many events have been lost to full rings
+ */
+u_int64_t evlog_dropped(void)
+{
+	u_int64_t total = __atomic_load_n(&ev_unregistered, __ATOMIC_RELAXED);
+	u_int32_t i, n;
+
+	n = __atomic_load_n(&ev_nrings, __ATOMIC_ACQUIRE);
+	if (n > EVLOG_MAX_THREADS)
+		n = EVLOG_MAX_THREADS;
+
+	for (i = 0; i < n; i++) {
+		ev_ring_t *r = __atomic_load_n(&ev_rings[i], __ATOMIC_ACQUIRE);
+
+		if (r)
+			total += __atomic_load_n(&r->dropped, __ATOMIC_RELAXED);
+	}
+	return total;
+}
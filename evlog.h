@@ -0,0 +1,110 @@
+/*
+ * asynchronous event log for jfap
+ *
+ * the packet handlers don't format anything. they fill in a fixed-size binary
+ * record in a ring owned by the calling thread, and a background thread
+ * formats the records (as text or JSON lines) or writes them out raw. a full
+ * ring drops the event and counts it; the log thread reports how many were
+ * lost.
+ *
+ * raw logs are just ev_t records back to back, in host byte order.
+ */
+
+#ifndef JFAP_EVLOG_H
+#define JFAP_EVLOG_H
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+
+
+/* records per thread, a power of 2 */
+#define EVLOG_RING_SIZE 8192
+
+/* threads that can log */
+#define EVLOG_MAX_THREADS 8
+
+/* how long (ms) the log thread naps when there's nothing to do */
+#define EVLOG_IDLE_MS 5
+
+#define EV_SSID_MAX 32
+
+enum {
+	EVLOG_TEXT = 0,
+	EVLOG_JSON,
+	EVLOG_RAW
+};
+
+enum {
+	EV_PROBE_DIRECTED = 1,    /* a: 1 if the SSID matched */
+	EV_PROBE_OURS,
+	EV_PROBE_OTHER,
+	EV_PROBE_WILDCARD,
+	EV_PROBE_UNHANDLED,       /* a: SSID length */
+	EV_PROBE_NO_SSID,
+	EV_IE_TRUNCATED,
+	EV_AUTH,                  /* a: algorithm, b: sequence, c: status */
+	EV_AUTH_SHORT,
+	EV_AUTH_BAD_SEQ,          /* b: sequence */
+	EV_ASSOC,                 /* a: capabilities, b: listen interval */
+	EV_ASSOC_NO_SSID,         /* a: capabilities, b: listen interval */
+	EV_ASSOC_SHORT,
+	EV_ESTABLISHED,
+	EV_MAX
+};
+
+typedef struct ev {
+	u_int64_t ts;             /* ms */
+	u_int16_t type;
+	u_int8_t mac[6];
+	u_int16_t a;
+	u_int16_t b;
+	u_int16_t c;
+	u_int8_t ssid_len;
+	u_int8_t pad;
+	u_int8_t ssid[EV_SSID_MAX];
+} ev_t;
+
+
+int evlog_start(int format, FILE *out);
+void evlog_stop(void);
+u_int64_t evlog_dropped(void);
+
+ev_t *ev_new(u_int16_t type, u_int64_t ts, const u_int8_t *mac);
+void ev_commit(ev_t *ev);
+
+
+/*
+ * log an event with up to three numbers
+ */
+static inline void ev_log(u_int16_t type, u_int64_t ts, const u_int8_t *mac, u_int16_t a, u_int16_t b, u_int16_t c)
+{
+	ev_t *ev;
+
+	if (!(ev = ev_new(type, ts, mac)))
+		return;
+	ev->a = a;
+	ev->b = b;
+	ev->c = c;
+	ev_commit(ev);
+}
+
+/*
+ * log an event that carries an SSID
+ */
+static inline void ev_log_ssid(u_int16_t type, u_int64_t ts, const u_int8_t *mac, const u_int8_t *ssid, u_int8_t len, u_int16_t a, u_int16_t b)
+{
+	ev_t *ev;
+
+	if (!(ev = ev_new(type, ts, mac)))
+		return;
+	if (len > EV_SSID_MAX)
+		len = EV_SSID_MAX;
+	memcpy(ev->ssid, ssid, len);
+	ev->ssid_len = len;
+	ev->a = a;
+	ev->b = b;
+	ev_commit(ev);
+}
+
+#endif
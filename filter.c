@@ -0,0 +1,340 @@
+/*
+ * kernel-side (classic BPF) capture filter for jfap
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <sys/socket.h>
+#include <linux/filter.h>
+
+#include "filter.h"
+#include "bss.h"
+#include "radiotap.h"
+
+
+/* offsets within the 802.11 header */
+#define FC0_OFF 0
+#define FC1_OFF 1
+#define ADDR1_OFF 4
+#define ADDR2_OFF 10
+#define DOT11_HDR_LEN 24
+
+/* what else a header can have - see dot11_hdr_len() in jfap.c */
+#define ADDR4_LEN 6
+#define QOS_CTRL_LEN 2
+#define HT_CTRL_LEN 4
+
+/* first frame control byte - version:2, type:2, subtype:4 */
+#define FC0_TYPE_MASK 0x0c
+#define FC0_TYPE_SUBTYPE_MASK 0xfc
+#define FC0_MGMT 0x00
+#define FC0_DATA 0x08
+#define FC0_QOS 0x80
+#define FC0_PROBE_REQ 0x40
+#define FC0_AUTH 0xb0
+#define FC0_ASSOC_REQ 0x00
+
+/* second frame control byte - flags */
+#define FC1_DS_MASK 0x03
+#define FC1_ORDER 0x80
+
+/* scratch memory */
+enum {
+	M_RT_LEN = 0,             /* the radiotap header's length */
+	M_HDR_END,                /* ... plus the 802.11 header's */
+};
+
+/* jump targets, resolved once the whole program has been emitted */
+enum {
+	L_NEXT = 0,
+	L_DROP,
+	L_ACCEPT,
+	L_SRC_OK,
+	L_DATA,
+	L_PROBE,
+	L_PROBE_ACCEPT,
+	L_HDR_DATA,
+	L_HDR_QOS,
+	L_HDR_ORDER,
+	L_HDR_DONE,
+	L_SSID,                   /* one per network, and one past the last */
+	L_MAX = L_SSID + BSS_MAX + 1
+};
+
+typedef struct filter_builder {
+	struct sock_filter insns[FILTER_MAX_INSNS];
+	u_int8_t jt[FILTER_MAX_INSNS];
+	u_int8_t jf[FILTER_MAX_INSNS];
+	int labels[L_MAX];
+	int len;
+	int overflow;
+} filter_builder_t;
+
+
+static void emit(filter_builder_t *fb, u_int16_t code, u_int32_t k, u_int8_t jt, u_int8_t jf)
+{
+	if (fb->len >= FILTER_MAX_INSNS) {
+		fb->overflow = 1;
+		return;
+	}
+	fb->insns[fb->len].code = code;
+	fb->insns[fb->len].k = k;
+	fb->jt[fb->len] = jt;
+	fb->jf[fb->len] = jf;
+	fb->len++;
+}
+
+#define STMT(code, k) emit(fb, (code), (k), L_NEXT, L_NEXT)
+#define JUMP(code, k, jt, jf) emit(fb, (code), (k), (jt), (jf))
+#define LABEL(l) (fb->labels[(l)] = fb->len)
+
+
+/*
+ * emit a comparison of 6 bytes at X+off against a mac address, jumping to
+ * "match" or "nomatch"
+ */
+static void emit_mac_cmp(filter_builder_t *fb, u_int32_t off, const u_int8_t *mac, u_int8_t match, u_int8_t nomatch)
+{
+	u_int32_t hi = (mac[0] << 24) | (mac[1] << 16) | (mac[2] << 8) | mac[3];
+	u_int32_t lo = (mac[4] << 8) | mac[5];
+
+	STMT(BPF_LD | BPF_W | BPF_IND, off);
+	JUMP(BPF_JMP | BPF_JEQ | BPF_K, hi, L_NEXT, nomatch);
+	STMT(BPF_LD | BPF_H | BPF_IND, off + 4);
+	JUMP(BPF_JMP | BPF_JEQ | BPF_K, lo, match, nomatch);
+}
+
+
+/*
+ * emit a check of the 6 bytes at X+off against every BSSID we have. the
+ * middle four bytes are the same for all of them, the last one holds the
+ * index, and the first may have the locally administered bit set
+ */
+static void emit_bss_cmp(filter_builder_t *fb, u_int32_t off, u_int8_t match, u_int8_t nomatch)
+{
+	const u_int8_t *base = bss_base();
+
+	if (bss_count() <= 1) {
+		emit_mac_cmp(fb, off, base, match, nomatch);
+		return;
+	}
+
+	STMT(BPF_LD | BPF_W | BPF_IND, off + 1);
+	JUMP(BPF_JMP | BPF_JEQ | BPF_K, (base[1] << 24) | (base[2] << 16) | (base[3] << 8) | base[4], L_NEXT, nomatch);
+	STMT(BPF_LD | BPF_B | BPF_IND, off + 5);
+	STMT(BPF_ALU | BPF_XOR | BPF_K, base[5]);
+	JUMP(BPF_JMP | BPF_JGE | BPF_K, bss_count(), nomatch, L_NEXT);
+	STMT(BPF_LD | BPF_B | BPF_IND, off);
+	STMT(BPF_ALU | BPF_OR | BPF_K, 0x02);
+	JUMP(BPF_JMP | BPF_JEQ | BPF_K, base[0] | 0x02, match, nomatch);
+}
+
+
+/*
+ * emit a comparison of the SSID element at X (the end of the 802.11 header)
+ * against one network's.
+ * a match is accepted right here, so nothing has to jump far, and anything
+ * else goes on to the next network
+ */
+static void emit_ssid_cmp(filter_builder_t *fb, const bss_t *b)
+{
+	const u_int8_t *ssid = b->ssid;
+	u_int8_t next = L_SSID + b->index + 1;
+	u_int32_t i;
+
+	LABEL(L_SSID + b->index);
+	STMT(BPF_LD | BPF_B | BPF_IND, 1);
+	JUMP(BPF_JMP | BPF_JEQ | BPF_K, b->ssid_len, L_NEXT, next);
+	for (i = 0; i + 4 <= b->ssid_len; i += 4) {
+		STMT(BPF_LD | BPF_W | BPF_IND, 2 + i);
+		JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+				(ssid[i] << 24) | (ssid[i + 1] << 16) | (ssid[i + 2] << 8) | ssid[i + 3],
+				L_NEXT, next);
+	}
+	for (; i < b->ssid_len; i++) {
+		STMT(BPF_LD | BPF_B | BPF_IND, 2 + i);
+		JUMP(BPF_JMP | BPF_JEQ | BPF_K, ssid[i], L_NEXT, next);
+	}
+	STMT(BPF_RET | BPF_K, 0x40000);
+}
+
+
+/*
+ * turn label references into relative jump offsets
+ *
+ * on success, we return 1, on failure, 0
+ */
+static int resolve(filter_builder_t *fb)
+{
+	int i;
+
+	for (i = 0; i < fb->len; i++) {
+		int t = fb->jt[i] ? fb->labels[fb->jt[i]] - i - 1 : 0;
+		int f = fb->jf[i] ? fb->labels[fb->jf[i]] - i - 1 : 0;
+
+		if (t < 0 || t > 255 || f < 0 || f > 255)
+			return 0;
+		fb->insns[i].jt = t;
+		fb->insns[i].jf = f;
+	}
+	return 1;
+}
+
+
+/*
+ * build the filter program
+ *
+ * returns the number of instructions, or 0 on failure
+ */
+static int filter_build(filter_builder_t *fb, int truncate_data)
+{
+	u_int32_t i;
+
+	memset(fb, 0, sizeof(*fb));
+
+	/* X = radiotap header length (little endian) */
+	STMT(BPF_LD | BPF_B | BPF_ABS, 3);
+	STMT(BPF_ALU | BPF_LSH | BPF_K, 8);
+	STMT(BPF_MISC | BPF_TAX, 0);
+	STMT(BPF_LD | BPF_B | BPF_ABS, 2);
+	STMT(BPF_ALU | BPF_OR | BPF_X, 0);
+	STMT(BPF_MISC | BPF_TAX, 0);
+	STMT(BPF_STX, M_RT_LEN);
+
+	/* work out where the 802.11 header ends, like userland will: data
+	 * frames can have a 4th address and QoS control, and QoS data and
+	 * management frames an HT control field */
+	STMT(BPF_MISC | BPF_TXA, 0);
+	STMT(BPF_ALU | BPF_ADD | BPF_K, DOT11_HDR_LEN);
+	STMT(BPF_ST, M_HDR_END);
+	STMT(BPF_LD | BPF_B | BPF_IND, FC0_OFF);
+	STMT(BPF_ALU | BPF_AND | BPF_K, FC0_TYPE_MASK);
+	JUMP(BPF_JMP | BPF_JEQ | BPF_K, FC0_DATA, L_HDR_DATA, L_NEXT);
+	JUMP(BPF_JMP | BPF_JEQ | BPF_K, FC0_MGMT, L_HDR_ORDER, L_HDR_DONE);
+
+	LABEL(L_HDR_DATA);
+	STMT(BPF_LD | BPF_B | BPF_IND, FC1_OFF);
+	STMT(BPF_ALU | BPF_AND | BPF_K, FC1_DS_MASK);
+	JUMP(BPF_JMP | BPF_JEQ | BPF_K, FC1_DS_MASK, L_NEXT, L_HDR_QOS);
+	STMT(BPF_LD | BPF_MEM, M_HDR_END);
+	STMT(BPF_ALU | BPF_ADD | BPF_K, ADDR4_LEN);
+	STMT(BPF_ST, M_HDR_END);
+
+	LABEL(L_HDR_QOS);
+	STMT(BPF_LD | BPF_B | BPF_IND, FC0_OFF);
+	JUMP(BPF_JMP | BPF_JSET | BPF_K, FC0_QOS, L_NEXT, L_HDR_DONE);
+	STMT(BPF_LD | BPF_MEM, M_HDR_END);
+	STMT(BPF_ALU | BPF_ADD | BPF_K, QOS_CTRL_LEN);
+	STMT(BPF_ST, M_HDR_END);
+
+	LABEL(L_HDR_ORDER);
+	STMT(BPF_LD | BPF_B | BPF_IND, FC1_OFF);
+	JUMP(BPF_JMP | BPF_JSET | BPF_K, FC1_ORDER, L_NEXT, L_HDR_DONE);
+	STMT(BPF_LD | BPF_MEM, M_HDR_END);
+	STMT(BPF_ALU | BPF_ADD | BPF_K, HT_CTRL_LEN);
+	STMT(BPF_ST, M_HDR_END);
+
+	/* need all of it */
+	LABEL(L_HDR_DONE);
+	STMT(BPF_LDX | BPF_MEM, M_HDR_END);
+	STMT(BPF_LD | BPF_W | BPF_LEN, 0);
+	JUMP(BPF_JMP | BPF_JGE | BPF_X, 0, L_NEXT, L_DROP);
+	STMT(BPF_LDX | BPF_MEM, M_RT_LEN);
+
+	/* ignore anything from us */
+	emit_bss_cmp(fb, ADDR2_OFF, L_DROP, L_SRC_OK);
+	LABEL(L_SRC_OK);
+
+	/* probe requests can be broadcast */
+	STMT(BPF_LD | BPF_B | BPF_IND, FC0_OFF);
+	STMT(BPF_ALU | BPF_AND | BPF_K, FC0_TYPE_SUBTYPE_MASK);
+	JUMP(BPF_JMP | BPF_JEQ | BPF_K, FC0_PROBE_REQ, L_PROBE, L_NEXT);
+
+	/* from here on out, we only want unicast frames for us */
+	emit_bss_cmp(fb, ADDR1_OFF, L_NEXT, L_DROP);
+	STMT(BPF_LD | BPF_B | BPF_IND, FC0_OFF);
+	STMT(BPF_ALU | BPF_AND | BPF_K, FC0_TYPE_SUBTYPE_MASK);
+	JUMP(BPF_JMP | BPF_JEQ | BPF_K, FC0_AUTH, L_ACCEPT, L_NEXT);
+	JUMP(BPF_JMP | BPF_JEQ | BPF_K, FC0_ASSOC_REQ, L_ACCEPT, L_NEXT);
+	STMT(BPF_ALU | BPF_AND | BPF_K, FC0_TYPE_MASK);
+	JUMP(BPF_JMP | BPF_JEQ | BPF_K, FC0_DATA, L_DATA, L_DROP);
+
+	/* data frames - only the header matters unless we're bridging. the
+	 * FCS is gone once we cut the frame, but userland still takes its
+	 * length off the end when radiotap says there is one, so leave room */
+	LABEL(L_DATA);
+	if (truncate_data) {
+		STMT(BPF_LD | BPF_MEM, M_HDR_END);
+		STMT(BPF_ALU | BPF_ADD | BPF_K, RT_FCS_LEN);
+		STMT(BPF_RET | BPF_A, 0);
+	} else {
+		STMT(BPF_RET | BPF_K, 0x40000);
+	}
+
+	LABEL(L_ACCEPT);
+	STMT(BPF_RET | BPF_K, 0x40000);
+
+	LABEL(L_DROP);
+	STMT(BPF_RET | BPF_K, 0);
+
+	/* probe requests - the SSID should be the first IE. if it isn't, let
+	 * userland sort it out. jumps only go forward, so this comes last and
+	 * has its own accept and drop. the IEs start right after the header,
+	 * which is longer with an HT control field */
+	LABEL(L_PROBE);
+	STMT(BPF_LDX | BPF_MEM, M_HDR_END);
+	STMT(BPF_LD | BPF_B | BPF_IND, 0);
+	JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, L_NEXT, L_PROBE_ACCEPT);
+	STMT(BPF_LD | BPF_B | BPF_IND, 1);
+	JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, L_PROBE_ACCEPT, L_SSID);
+
+	LABEL(L_PROBE_ACCEPT);
+	STMT(BPF_RET | BPF_K, 0x40000);
+
+	for (i = 0; i < bss_count(); i++)
+		emit_ssid_cmp(fb, bss_get(i));
+
+	LABEL(L_SSID + bss_count());
+	STMT(BPF_RET | BPF_K, 0);
+
+	if (fb->overflow || !resolve(fb))
+		return 0;
+	return fb->len;
+}
+
+
+/*
+ * build a filter for our networks and attach it to a packet socket
+ *
+ * on success, we return 1, on failure, 0
+ */
+int filter_attach(int fd, int truncate_data)
+{
+	filter_builder_t fb;
+	struct sock_fprog fprog;
+
+	if (!filter_build(&fb, truncate_data)) {
+		fprintf(stderr, "[!] Unable to build the packet filter\n");
+		return 0;
+	}
+
+#ifdef DEBUG_FILTER
+	{
+		int i;
+
+		printf("[*] packet filter (%d instructions):\n", fb.len);
+		for (i = 0; i < fb.len; i++)
+			printf("    { 0x%02x, %3u, %3u, 0x%08x },\n", fb.insns[i].code,
+					fb.insns[i].jt, fb.insns[i].jf, fb.insns[i].k);
+	}
+#endif
+
+	fprog.len = fb.len;
+	fprog.filter = fb.insns;
+	if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) == -1) {
+		perror("[!] Unable to attach the packet filter");
+		return 0;
+	}
+	return 1;
+}
@@ -0,0 +1,30 @@
+/*
+ * kernel-side (classic BPF) capture filter for jfap
+ *
+ * the program mirrors the checks at the top of handle_packet, so frames we'd
+ * throw away anyway never get copied to us:
+ *
+ *  - anything from one of our BSSIDs is dropped
+ *  - probe requests are kept if they're for the wildcard SSID or one of ours
+ *  - otherwise only auth, assoc and data frames addressed to us are kept
+ *
+ * with more than one network, the BSSID checks only look at the parts of
+ * the address that the networks share (see bss.h), and leave the rest to
+ * userland.
+ *
+ * data frames can also be cut down to just their 802.11 header (and room for
+ * an FCS).
+ */
+
+#ifndef JFAP_FILTER_H
+#define JFAP_FILTER_H
+
+#include <sys/types.h>
+
+
+#define FILTER_MAX_INSNS 512
+
+
+int filter_attach(int fd, int truncate_data);
+
+#endif
@@ -12,15 +12,18 @@
 
 
 #include <stdio.h>
-#include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
 #include <sys/types.h>
 
+#include "hexdump.h"
 
-#define BYTES_IN_MINOR_GROUP 	4
-#define MINOR_GROUPS_IN_MAJOR 	2
-#define MAJOR_GROUPS_PER_LINE 	2
+
+/* 4 spaces, then 3 per byte, with an extra one after each group of 4 and 8,
+ * then the ASCII */
+#define ASCII_OFF 		58
+
+/* lines hexdump() builds before writing them out */
+#define HEXDUMP_CHUNK 		32
 
 
 #ifndef OUT_FILEP
@@ -28,86 +31,78 @@
 #endif
 
 
-void hexdump(u_char *ptr, u_int len)
+const char hex_pairs[512] =
+	"000102030405060708090a0b0c0d0e0f"
+	"101112131415161718191a1b1c1d1e1f"
+	"202122232425262728292a2b2c2d2e2f"
+	"303132333435363738393a3b3c3d3e3f"
+	"404142434445464748494a4b4c4d4e4f"
+	"505152535455565758595a5b5c5d5e5f"
+	"606162636465666768696a6b6c6d6e6f"
+	"707172737475767778797a7b7c7d7e7f"
+	"808182838485868788898a8b8c8d8e8f"
+	"909192939495969798999a9b9c9d9e9f"
+	"a0a1a2a3a4a5a6a7a8a9aaabacadaeaf"
+	"b0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+	"c0c1c2c3c4c5c6c7c8c9cacbcccdcecf"
+	"d0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+	"e0e1e2e3e4e5e6e7e8e9eaebecedeeef"
+	"f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+
+/* where each byte's digits go within a line */
+static const u_int8_t hex_off[HEXDUMP_BYTES_PER_LINE] = {
+	4, 7, 10, 13,   17, 20, 23, 26,   31, 34, 37, 40,   44, 47, 50, 53
+};
+
+
+/*
+ * build the dump of len bytes into out, which has to have HEXDUMP_SIZE(len)
+ * bytes of room
+ *
+ * returns how many bytes were written (no terminating NUL)
+ */
+u_int hexdump_format(char *out, const u_char *ptr, u_int len)
 {
-	u_char *line, *line_p;
-	u_char *hex_p, *asc_p;
-	u_int line_len = 0;
-	u_int min_cnt = 0;
-	u_int maj_cnt = 0;
-	u_int byte_cnt = 0;
-
-	/* can't dump 0 bytes! */
-	if (!len)
-		return;
-
-	/* allocate enuff memory for our output */
-	line_len = 3 * BYTES_IN_MINOR_GROUP; 	/* 3 bytes per byte */
-	line_len *= MINOR_GROUPS_IN_MAJOR; 		/* this many groups of those */
-	line_len += MINOR_GROUPS_IN_MAJOR; 		/* this many extra spaces */
-	line_len *= MAJOR_GROUPS_PER_LINE; 		/* this many major groups */
-	line_len += MAJOR_GROUPS_PER_LINE;  	       	/* this many extra spaces */
-	/* ascii area */
-	line_len += (BYTES_IN_MINOR_GROUP * MINOR_GROUPS_IN_MAJOR) * MAJOR_GROUPS_PER_LINE;
-	line_len += 1; 				/* trailing newline */
-	line_len += 4; 				/* prefix spaces */
-#ifdef TEST_HEXDUMP
-	printf("allocating line of %u bytes\n", line_len);
-#endif
-	line = (u_char *)malloc(line_len + 1);
-
-	/* init our pointers */
-	hex_p = ptr;
-	asc_p = ptr;
-
-	/* ok.. dump the amount specified */
-	while (hex_p - ptr < len) {
-		line_p = line;
-
-		/* put some prefix spaces */
-		*line_p++ = ' ';
-		*line_p++ = ' ';
-		*line_p++ = ' ';
-		*line_p++ = ' ';
-
-		/* build X bytes into X minor groups into X major groups for each line */
-		for (maj_cnt = 0; maj_cnt < MAJOR_GROUPS_PER_LINE; maj_cnt++) {
-			for (min_cnt = 0; min_cnt < MINOR_GROUPS_IN_MAJOR; min_cnt++) {
-				for (byte_cnt = 0; byte_cnt < BYTES_IN_MINOR_GROUP; byte_cnt++) {
-					if (hex_p - ptr < len) {
-						sprintf((char *)line_p, "%02x ", *hex_p & 0xff);
-						hex_p ++;
-					} else {
-						strcpy((char *)line_p, "   ");
-					}
-					line_p += 3;
-				}
-				*line_p++ = ' ';
-			}
-			*line_p++ = ' ';
-		}
+	char *line = out;
+	u_int i, n;
 
-		/* now put the ascii stuff after it */
-		for (byte_cnt = 0; byte_cnt < (BYTES_IN_MINOR_GROUP * MINOR_GROUPS_IN_MAJOR) * MAJOR_GROUPS_PER_LINE; byte_cnt++) {
-			if (asc_p - ptr < len) {
-				if (isprint(*asc_p))
-					*line_p++ = *asc_p;
-				else
-					*line_p++ = '.';
-				asc_p++;
-			} else {
-				*line_p++ = ' ';
-			}
-		}
+	while (len) {
+		n = len < HEXDUMP_BYTES_PER_LINE ? len : HEXDUMP_BYTES_PER_LINE;
 
-		*line_p++ = '\n';
-		*line_p++ = '\0';
+		/* the part of a short last line that has no bytes is spaces */
+		memset(line, ' ', ASCII_OFF);
+		for (i = 0; i < n; i++) {
+			const char *hex = hex_pairs + 2 * ptr[i];
 
-		fprintf(OUT_FILEP, "%s", line);
+			line[hex_off[i]] = hex[0];
+			line[hex_off[i] + 1] = hex[1];
+			line[ASCII_OFF + i] = (ptr[i] >= 0x20 && ptr[i] < 0x7f) ? ptr[i] : '.';
+		}
+		for (; i < HEXDUMP_BYTES_PER_LINE; i++)
+			line[ASCII_OFF + i] = ' ';
+		line[HEXDUMP_LINE_LEN - 1] = '\n';
+
+		line += HEXDUMP_LINE_LEN;
+		ptr += n;
+		len -= n;
 	}
+	return line - out;
+}
 
-#ifdef TEST_HEXDUMP
-	printf("actual line length: %d\n", strlen(line));
-#endif
-	free(line);
+
+/*
+ * dump len bytes to OUT_FILEP, a chunk of lines at a time
+ */
+void hexdump(const u_char *ptr, u_int len)
+{
+	char buf[HEXDUMP_CHUNK * HEXDUMP_LINE_LEN];
+	u_int n;
+
+	while (len) {
+		n = len < sizeof(buf) / HEXDUMP_LINE_LEN * HEXDUMP_BYTES_PER_LINE
+			? len : sizeof(buf) / HEXDUMP_LINE_LEN * HEXDUMP_BYTES_PER_LINE;
+		fwrite(buf, 1, hexdump_format(buf, ptr, n), OUT_FILEP);
+		ptr += n;
+		len -= n;
+	}
 }
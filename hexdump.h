@@ -0,0 +1,30 @@
+/*
+ * hex/ASCII dumps
+ *
+ * 16 bytes a line, in groups of 4 and 8, with the printable ones repeated on
+ * the right. every line is the same length, even the last, so the space a
+ * dump needs is known up front and the lines can be built straight into an
+ * output buffer.
+ */
+
+#ifndef JFAP_HEXDUMP_H
+#define JFAP_HEXDUMP_H
+
+#include <sys/types.h>
+
+
+#define HEXDUMP_BYTES_PER_LINE 16
+#define HEXDUMP_LINE_LEN 75
+
+/* how much hexdump_format() writes for len bytes */
+#define HEXDUMP_SIZE(len) \
+	(((len) + HEXDUMP_BYTES_PER_LINE - 1) / HEXDUMP_BYTES_PER_LINE * HEXDUMP_LINE_LEN)
+
+/* the two hex digits of every byte value */
+extern const char hex_pairs[512];
+
+
+u_int hexdump_format(char *out, const u_char *ptr, u_int len);
+void hexdump(const u_char *ptr, u_int len);
+
+#endif
@@ -0,0 +1,61 @@
+/*
+ * 802.11 information element indexing for jfap
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "ie.h"
+
+
+/*
+ * index every element in a management frame body
+ *
+ * on success, we return 1. if the list is cut short or an element runs off
+ * the end, we return 0, but everything before that point is still indexed
+ */
+int ie_index(ie_index_t *idx, const u_int8_t *data, u_int32_t len)
+{
+	u_int32_t off = 0;
+
+	idx->base = data;
+	idx->count = 0;
+	memset(idx->have, 0, sizeof(idx->have));
+	memset(idx->have_ext, 0, sizeof(idx->have_ext));
+
+	/* offsets are 16 bits, and no frame comes close to that */
+	if (len > 0xffff)
+		len = 0xffff;
+
+	while (off < len) {
+		const ie_t *ie = (const ie_t *)(data + off);
+		u_int64_t *have = idx->have;
+		u_int16_t *offs = idx->off;
+		u_int8_t id;
+
+		/* see if we have enough for the IE header, and all of its data */
+		if (len - off < sizeof(*ie) || len - off - sizeof(*ie) < ie->len) {
+#ifdef DEBUG_IE_INDEX
+			fprintf(stderr, "[-] Truncated IE at offset %u!\n", off);
+#endif
+			return 0;
+		}
+
+		id = ie->id;
+		if (id == IEID_EXTENSION && ie->len > 0) {
+			have = idx->have_ext;
+			offs = idx->ext_off;
+			id = ie->data[0];
+		}
+
+		/* the first one wins */
+		if (!(have[id >> 6] & (1ULL << (id & 63)))) {
+			have[id >> 6] |= 1ULL << (id & 63);
+			offs[id] = off;
+		}
+
+		idx->count++;
+		off += sizeof(*ie) + ie->len;
+	}
+	return 1;
+}
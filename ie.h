@@ -0,0 +1,65 @@
+/*
+ * 802.11 information element indexing for jfap
+ *
+ * the elements in a management frame body are walked once, and the offset of
+ * the first element with each ID (and each extension ID) is recorded in a
+ * fixed table. a bitmap says which entries are valid, so only it has to be
+ * cleared per frame. after that, finding any element is O(1).
+ */
+
+#ifndef JFAP_IE_H
+#define JFAP_IE_H
+
+#include <sys/types.h>
+
+
+#define IEID_SSID 0
+#define IEID_RATES 1
+#define IEID_DSPARAMS 3
+#define IEID_HT_CAPS 45
+#define IEID_RSN 48
+#define IEID_EXT_RATES 50
+#define IEID_VENDOR 221
+#define IEID_EXTENSION 255    /* the first data byte is the extension ID */
+
+struct ieee80211_information_element {
+	u_int8_t id;
+	u_int8_t len;
+	u_int8_t data[0];
+} __attribute__((__packed__));
+typedef struct ieee80211_information_element ie_t;
+
+typedef struct ie_index {
+	const u_int8_t *base;
+	u_int64_t have[4];        /* bit per element ID */
+	u_int64_t have_ext[4];    /* bit per extension ID */
+	u_int16_t off[256];
+	u_int16_t ext_off[256];
+	u_int16_t count;          /* elements seen, including repeats */
+} ie_index_t;
+
+
+int ie_index(ie_index_t *idx, const u_int8_t *data, u_int32_t len);
+
+/*
+ * find the first element with the given ID, or NULL
+ */
+static inline ie_t *ie_get(const ie_index_t *idx, u_int8_t id)
+{
+	if (!(idx->have[id >> 6] & (1ULL << (id & 63))))
+		return NULL;
+	return (ie_t *)(idx->base + idx->off[id]);
+}
+
+/*
+ * find the first extension element with the given extension ID, or NULL.
+ * the extension ID is data[0] of what's returned
+ */
+static inline ie_t *ie_get_ext(const ie_index_t *idx, u_int8_t ext_id)
+{
+	if (!(idx->have_ext[ext_id >> 6] & (1ULL << (ext_id & 63))))
+		return NULL;
+	return (ie_t *)(idx->base + idx->ext_off[ext_id]);
+}
+
+#endif
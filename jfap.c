@@ -2,20 +2,38 @@
  * jduck's fake AP for WiFi hax.
  *
  * by Joshua J. Drake (@jduck) on 2017-06-13
+ *
+ * build with:
+ *   gcc -o jfap jfap.c station.c bss.c chan.c timer.c tsf.c ring.c filter.c radiotap.c ie.c pipeline.c evlog.c shmstats.c latency.c tap.c classify.c decode.c hexdump.c record.c -lpcap -lpthread
  */
 
+/* cpu affinity */
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <pthread.h>
 
 /* hi-res time */
 #include <time.h>
 
+/* event loop */
+#include <errno.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
 /* internet networking / packet sending */
 #include <sys/socket.h>
 #include <sys/ioctl.h>
+#include <arpa/inet.h>
 #include <netinet/ether.h>
 #include <linux/if.h>
 #include <linux/if_packet.h>
@@ -23,11 +41,64 @@
 /* packet capturing */
 #include <pcap/pcap.h>
 
+#include "timer.h"
+#include "tsf.h"
+#include "station.h"
+#include "bss.h"
+#include "chan.h"
+#include "ring.h"
+#include "filter.h"
+#include "radiotap.h"
+#include "ie.h"
+#include "pipeline.h"
+#include "evlog.h"
+#include "shmstats.h"
+#include "latency.h"
+#include "tap.h"
+#include "classify.h"
+#include "decode.h"
+#include "hexdump.h"
+#include "record.h"
+
 
 /* global hardcoded parameters */
 #define SNAPLEN 4096
-#define BEACON_INTERVAL 500
+#define BEACON_INTERVAL 500      /* TUs */
 #define DEFAULT_CHANNEL 1
+#define DEFAULT_IFACE "mon0"
+
+/* monitor interfaces we can serve at once, each with its own worker */
+#define IFACE_MAX 8
+
+#if IFACE_MAX > REC_MAX_IFACES
+#error "IFACE_MAX is too large for the recorder"
+#endif
+
+#if IFACE_MAX > SHM_STATS_IFACES
+#error "IFACE_MAX is too large for the shared stats"
+#endif
+
+#if RING_BATCH > CL_BATCH
+#error "RING_BATCH is too large for the classifier"
+#endif
+
+/* other workers put station timers on the main wheel without telling the
+ * main thread. none of them are due sooner than this (ms) after they're set */
+#define MAIN_WAKE_INTERVAL 1000
+
+/* max frames to pull from libpcap per wakeup, so timers aren't starved */
+#define PCAP_BATCH 64
+
+/* responses get re-sent this many times, this many ms apart */
+#define RETRANSMIT_COUNT 3
+#define RETRANSMIT_INTERVAL 50
+
+/* counters that cost a syscall or a walk to collect are only refreshed for
+ * the statistics page this often (ms) */
+#define SHM_SLOW_INTERVAL 1000
+
+/* room for the biggest frame we build */
+#define TEMPLATE_MAX 256
 
 
 /* some bits borrowed from tcpdump! thanks guys! */
@@ -38,76 +109,96 @@
 
 #define ST_ASSOC_REQ 0
 #define ST_ASSOC_RESP 1
+#define ST_REASSOC_REQ 2
+#define ST_REASSOC_RESP 3
 #define ST_PROBE_REQ 4
 #define ST_PROBE_RESP 5
 #define ST_BEACON 8
 #define ST_AUTH 11
 
+/* data subtypes are flags */
+#define ST_DATA 0
+#define ST_NULL 4   /* no frame body */
+#define ST_QOS 8
+
+#define CF_TO_DS 1
+#define CF_FROM_DS 2
+#define CF_MORE_FRAGS 4
 #define CF_RETRY 8
+#define CF_PROTECTED 0x40
+#define CF_ORDER 0x80
+#define CF_DS_MASK (CF_TO_DS | CF_FROM_DS)
 
-#define IEID_SSID 0
-#define IEID_RATES 1
-#define IEID_DSPARAMS 3
+/* QoS data has a QoS control field after the addresses, with the TID and
+ * whether the body is an A-MSDU. with the order bit, HT control follows */
+#define QOS_CTRL_LEN 2
+#define QOS_TID_MASK 0x0f
+#define QOS_AMSDU 0x80
+#define HT_CTRL_LEN 4
 
-#define IEEE80211_RADIOTAP_RATE 2
+/* each A-MSDU subframe starts with its destination, source and length (big
+ * endian), and all but the last are padded to a multiple of 4 */
+#define AMSDU_HDR_LEN 14
 
 #define IEEE80211_BROADCAST_ADDR ((u_int8_t *)"\xff\xff\xff\xff\xff\xff")
 
-
-const char *dot11_types[4] = { "mgmt", "ctrl", "data", "resv" };
-const char *dot11_subtypes[4][16] = {
-	/* mgmt */
-	{ "assoc-req", "assoc-resp",
-		"re-assoc-req", "re-assoc-resp",
-		"probe-req", "probe-resp",
-		"6?", "7?",
-		"beacon", "atim",
-		"dis-assoc", "auth",
-		"de-auth", "action",
-		"14?", "15?" },
-	/* ctrl */
-	{ "0?", "1?", "2?", "3?", "4?", "5?", "6?", "7?",
-		"8?", "block-ack", "ps-poll", "rts", "cts", "ack", "cf-end", "cf-end-ack" },
-	/* data */
-	{ "0?", "1?", "2?", "3?", "4?", "5?", "6?", "7?", "8?", "9?", "10?", "11?", "12?", "13?", "14?", "15?" },
-	/* reserved */
-	{ "0?", "1?", "2?", "3?", "4?", "5?", "6?", "7?", "8?", "9?", "10?", "11?", "12?", "13?", "14?", "15?" }
+/* data frame bodies start with an LLC/SNAP header carrying the ethertype.
+ * RFC 1042 is the usual one, 802.1H bridge tunnel is for AARP and IPX */
+#define LLC_SNAP_LEN 8
+const u_int8_t rfc1042_hdr[6] = { 0xaa, 0xaa, 0x03, 0x00, 0x00, 0x00 };
+const u_int8_t bridge_tunnel_hdr[6] = { 0xaa, 0xaa, 0x03, 0x00, 0x00, 0xf8 };
+
+/* the radiotap, 802.11 and LLC/SNAP headers a bridged frame gets, and then
+ * some */
+#define BRIDGE_HDR_ROOM 64
+
+
+/* how many bytes of fixed fields come before the IEs, by management subtype */
+const u_int8_t mgmt_fixed_len[16] = {
+	[ST_ASSOC_REQ] = 4,
+	[ST_ASSOC_RESP] = 6,
+	[ST_REASSOC_REQ] = 10,
+	[ST_REASSOC_RESP] = 6,
+	[ST_PROBE_RESP] = 12,
+	[ST_BEACON] = 12,
+	[ST_AUTH] = 6,
 };
 
-int g_sock;
-char g_iface[64];
-
-u_int8_t g_bssid[ETH_ALEN];
-u_int8_t g_ssid[32];
-u_int8_t g_ssid_len;
-u_int8_t g_channel = DEFAULT_CHANNEL;
-
-u_int8_t g_pkt[4096];
-size_t g_pkt_len = 0;
-struct timespec last_retransmit;
+u_int8_t g_bssid[ETH_ALEN];  /* our base address, see bss.h */
+chan_sched_t g_sched;         /* for interfaces without their own */
+const chan_backend_t *g_chan_backend = &chan_nl80211;
 
 /* global options */
 int g_send_beacons = 0;
-struct timespec last_beacon;
+int g_use_pcap = 0;
+int g_use_pipeline = 0;
+int g_cpus[PIPE_CPU_MAX] = { -1, -1, -1 };
+int g_use_filter = 1;
+u_int32_t g_stats_interval = 0;
+int g_log_format = EVLOG_TEXT;
+char *g_log_file = NULL;
+char *g_stats_path = NULL;
+shm_stats_t *g_shm = NULL;
+char *g_tap_name = NULL;
+tap_t g_tap = { .fd = -1 };   /* the data-plane bridge, if there is one */
+int g_decode = DC_OFF;
+char *g_decode_file = NULL;
+int g_decode_fd = STDOUT_FILENO;
+dc_out_t g_decode_out;        /* shared by every interface's decoder */
+char *g_record_file = NULL;
+u_int64_t g_record_bytes = 0; /* start a new file after this much, 0 = never */
+u_int32_t g_record_secs = 0;  /* ... or this long */
+
+/* offline replay */
+char *g_replay_in = NULL;
+char *g_replay_out = NULL;
+pcap_dumper_t *g_dumper = NULL;
+u_int64_t g_replay_us;        /* replay clock, driven by input timestamps */
+
+/* station aging, stats, and everything for the first interface */
+tw_wheel_t g_wheel;
+tw_timer_t g_stats_timer;
 
-typedef enum {
-	S_AWAITING_PROBE_REQ = 0,
-	S_SENT_PROBE_RESP = 1,
-	S_SENT_AUTH = 2,
-	S_SENT_ASSOC_RESP = 3,
-	S_ESTABLISHED = 4
-} state_t;
-
-state_t g_state = S_AWAITING_PROBE_REQ;
-
-
-struct ieee80211_radiotap_header {
-	u_int8_t it_version;      /* set to 0 */
-	u_int8_t it_pad;
-	u_int16_t it_len;         /* entire length */
-	u_int32_t it_present;     /* fields present */
-} __attribute__((__packed__));
-typedef struct ieee80211_radiotap_header radiotap_t;
 
 struct ieee80211_frame_header {
 	u_int version:2;
@@ -123,6 +214,52 @@ struct ieee80211_frame_header {
 } __attribute__((__packed__));
 typedef struct ieee80211_frame_header dot11_frame_t;
 
+
+/*
+ * the fourth address, on frames going from one DS to another
+ */
+static inline const u_int8_t *dot11_addr4(const dot11_frame_t *d11)
+{
+	return (const u_int8_t *)(d11 + 1);
+}
+
+
+/*
+ * get the QoS control field of QoS data, or 0 for anything else
+ */
+static inline u_int16_t dot11_qos_ctrl(const dot11_frame_t *d11)
+{
+	const u_int8_t *p = (const u_int8_t *)(d11 + 1);
+
+	if (d11->type != T_DATA || !(d11->subtype & ST_QOS))
+		return 0;
+	if ((d11->ctrlflags & CF_DS_MASK) == CF_DS_MASK)
+		p += ETH_ALEN;
+	return p[0] | (p[1] << 8);
+}
+
+
+/*
+ * how long a frame's 802.11 header really is. the struct only has the part
+ * every management and data frame starts with
+ */
+static inline u_int32_t dot11_hdr_len(const dot11_frame_t *d11)
+{
+	u_int32_t len = sizeof(dot11_frame_t);
+
+	if (d11->type == T_DATA) {
+		if ((d11->ctrlflags & CF_DS_MASK) == CF_DS_MASK)
+			len += ETH_ALEN;
+		if (d11->subtype & ST_QOS) {
+			len += QOS_CTRL_LEN;
+			if (d11->ctrlflags & CF_ORDER)
+				len += HT_CTRL_LEN;
+		}
+	} else if (d11->type == T_MGMT && (d11->ctrlflags & CF_ORDER))
+		len += HT_CTRL_LEN;
+	return len;
+}
+
 struct ieee80211_beacon {
 	u_int64_t timestamp;
 	u_int16_t interval;
@@ -130,13 +267,6 @@ struct ieee80211_beacon {
 } __attribute__((__packed__));
 typedef struct ieee80211_beacon beacon_t;
 
-struct ieee80211_information_element {
-	u_int8_t id;
-	u_int8_t len;
-	u_int8_t data[0];
-} __attribute__((__packed__));
-typedef struct ieee80211_information_element ie_t;
-
 struct ieee80211_authentication {
 	u_int16_t algorithm;
 	u_int16_t seq;
@@ -157,47 +287,266 @@ struct ieee80211_assoc_response {
 } __attribute__((__packed__));
 typedef struct ieee80211_assoc_response assoc_resp_t;
 
+/* a frame we send, built once up front */
+typedef struct frame_template {
+	u_int8_t buf[TEMPLATE_MAX];
+	u_int32_t len;
+	u_int32_t dot11_off;      /* where the 802.11 header starts */
+} template_t;
+
+enum {
+	TMPL_BEACON = 0,
+	TMPL_PROBE_RESP,
+	TMPL_AUTH_RESP,
+	TMPL_ASSOC_RESP,
+	TMPL_MAX
+};
+
+/* responses we time, and where their turnaround goes */
+enum {
+	LAT_PROBE = 0,
+	LAT_AUTH,
+	LAT_ASSOC,
+	LAT_KINDS
+};
 
-void timespec_diff(struct timespec *newer, struct timespec *older, struct timespec *diff);
+enum {
+	LAT_CAPTURE = 0,          /* captured -> handler (kernel, queues) */
+	LAT_HANDLER,              /* handler -> response queued */
+	LAT_FLUSH,                /* queued -> flushed (batching, syscall) */
+	LAT_TOTAL,
+	LAT_STAGES
+};
 
-char *mac_string(u_int8_t *mac);
-void hexdump(const u_char *ptr, u_int len);
-char *ssid_string(ie_t *ie);
+/* a response waiting to be flushed */
+typedef struct lat_pending {
+	u_int64_t captured;
+	u_int64_t queued;
+	u_int32_t kind;
+} lat_pending_t;
+
+/* what the stats line shows about an interface. its worker keeps a copy up
+ * to date, guarded by a seqlock like the statistics page's blocks */
+typedef struct iface_summary {
+	u_int32_t seq;
+	u_int8_t channel;
+	u_int64_t rx_frames;
+	u_int64_t rx_bad_fcs;
+	u_int64_t rx_dups;
+	u_int64_t tx_frames;
+	u_int64_t tx_retransmits;
+	u_int64_t tx_errors;
+	u_int64_t tx_flushes;
+	u_int32_t tx_max_batch;
+	tbtt_stats_t beacons;
+	u_int64_t switches;
+	u_int64_t switch_failures;
+	u_int64_t switch_ns;
+	u_int64_t bridge_dropped;
+	u_int64_t decoded;
+	u_int64_t decode_dropped;
+	u_int64_t pipe_rx_frames;
+	u_int64_t pipe_rx_drops;
+	u_int64_t pipe_tx_frames;
+	u_int64_t pipe_tx_drops;
+	u_int64_t pipe_tx_errors;
+} iface_summary_t;
+
+/* everything that belongs to one monitor interface */
+typedef struct iface {
+	char name[64];
+	u_int8_t channel;         /* the one we're on, or about to be */
+	chan_ctl_t chan;
+	chan_sched_t sched;
+	u_int32_t hop;            /* where we are in sched */
+	tw_timer_t hop_timer;
+	int hop_due;              /* the timer went off, time to move on */
+	int cpu;                  /* where to pin its worker, -1 = don't */
+	int sock;
+	pcap_t *pch;
+	rx_ring_t ring;
+	tx_ring_t tx;
+	tx_ring_t tx_wire;        /* the socket side of tx in pipeline mode */
+	pipeline_t pipe;
+	tap_queue_t bridge_q;     /* frames from the host for stations on this
+	                           * interface, every one but the first */
+
+	/* beacons, and retransmits of what we sent from here. the first
+	 * interface is served by the main thread and uses g_wheel */
+	tw_wheel_t *wheel;
+	tw_wheel_t own_wheel;
+	tw_timer_t beacon_timers[BSS_MAX];
+	u_int64_t next_tbtt[BSS_MAX];  /* in our TSF */
+	u_int32_t beacons_due;         /* networks whose beacon timer went off */
+	tbtt_stats_t beacon_stats;
+
+	/* our beacons say which channel we're on */
+	template_t templates[BSS_MAX][TMPL_MAX];
+
+	pthread_t thread;
+	int running;
+	int failed;
+
+	/* counters, each written by its worker only */
+	u_int64_t rx_frames;
+	u_int64_t rx_bad_fcs;
+	u_int64_t rx_dups;
+	u_int64_t rx_malformed;
+	u_int64_t rx_ie_truncated;
+	u_int64_t frames[4][16];
+	u_int64_t kernel_drops;
+	u_int64_t tx_retransmits;
+	u_int64_t tx_sent[SHM_TX_MAX];
+	u_int64_t bridge_dropped;     /* data frames we couldn't pass on */
+
+	/* what we captured, decoded (with -d) */
+	decoder_t dec;
+
+	/* when (ns) the frame being handled was captured and handed to us,
+	 * 0 if we don't know */
+	u_int64_t rx_captured;
+	u_int64_t rx_entered;
+
+	/* written with g_lock held, so they can be dumped at any time */
+	lat_hist_t lat[LAT_KINDS][LAT_STAGES];
+	lat_pending_t lat_pending[TX_FRAME_NR];
+	u_int32_t lat_npending;
+
+	/* the counters for other threads, and when (ms) they and the
+	 * statistics page were last updated */
+	iface_summary_t summary;
+	u_int64_t published;
+	u_int64_t published_slow;
+} iface_t;
+
+iface_t g_ifaces[IFACE_MAX];
+u_int32_t g_num_ifaces;
+
+/* the interface the calling thread works for */
+__thread iface_t *g_cur = &g_ifaces[0];
+
+/* with more than one worker, the station table and timer wheels are only
+ * touched with this held */
+pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+int g_stop_efd = -1;          /* readable once the workers should stop */
 
-ie_t *get_ssid_ie(const u_int8_t *data, u_int32_t left);
-u_int16_t get_sequence(void);
 
-int start_pcap(pcap_t **pcap);
-int open_raw_socket(void);
-int set_channel(void);
+char *mac_string(u_int8_t *mac);
 
-int handle_packet(const u_char *data, u_int32_t left);
-int process_periodic_tasks(void);
+int index_ies(dot11_frame_t *d11, const u_char *data, u_int32_t left, ie_index_t *ies);
+u_int16_t get_sequence(void);
 
-int process_radiotap(const u_char **ppkt, u_int32_t *pleft);
+u_int64_t now_ms(void);
+u_int64_t now_us(void);
+void wait_until_us(u_int64_t when);
+u_int64_t bss_tsf_adjust(bss_t *bss);
+void stamp_tsf(u_int8_t *pkt, bss_t *bss);
+
+int add_iface(const char *spec);
+int start_live(iface_t *ifc);
+void stop_live(iface_t *ifc);
+int start_workers(void);
+int stop_workers(void);
+void *iface_worker(void *arg);
+int start_pcap(iface_t *ifc);
+int start_replay(pcap_t **pcap);
+int start_bridge(void);
+void stop_bridge(void);
+int start_decoders(void);
+void stop_decoders(void);
+int start_recorder(void);
+void stop_recorder(void);
+u_int64_t record_time(u_int64_t ts);
+void record_tx(const u_int8_t *frame, u_int32_t len, void *arg);
+void start_timers(void);
+int event_loop(iface_t *ifc);
+int replay_loop(pcap_t *pch);
+int process_pcap(pcap_t *pch, ring_handler_t fn);
+int capture_ring(void *arg, ring_handler_t fn);
+int capture_pcap(void *arg, ring_handler_t fn);
+int open_raw_socket(iface_t *ifc, u_int16_t proto);
+int set_channel(iface_t *ifc, u_int8_t channel);
+
+int handle_packet(const u_char *data, u_int32_t left, u_int64_t ts);
+int handle_batch(rx_batch_t *b);
+dot11_frame_t *prepare_packet(const u_char **pdata, u_int32_t *pleft, u_int64_t ts);
+int handle_dot11(dot11_frame_t *d11, const u_char *data, u_int32_t left);
+int process_dot11(dot11_frame_t *d11, station_t *sta, const u_char *data, u_int32_t left, u_int64_t now);
+int process_periodic_tasks(iface_t *ifc);
+int start_stats_page(void);
+void publish_stats(iface_t *ifc);
+void trace_response(const u_int8_t *pkt);
+void trace_flushed(iface_t *ifc);
+void dump_latency(void);
+
+int process_radiotap(const u_char **ppkt, u_int32_t *pleft, rt_meta_t *meta);
 dot11_frame_t *get_dot11_frame(const u_char **ppkt, u_int32_t *pleft);
-int process_probe_request(dot11_frame_t *d11, const u_char *data, u_int32_t left);
-int process_auth_request(dot11_frame_t *d11, const u_char *data, u_int32_t left);
-int process_assoc_request(dot11_frame_t *d11, const u_char *data, u_int32_t left);
-
-int send_beacon();
-int send_probe_response(u_int8_t *dst_mac);
-int send_auth_response(u_int8_t *dst_mac);
-int send_assoc_response(u_int8_t *dst_mac);
+int process_probe_request(dot11_frame_t *d11, ie_index_t *ies, u_int64_t now);
+int process_auth_request(dot11_frame_t *d11, bss_t *bss, const u_char *data, u_int32_t left, u_int64_t now);
+int process_assoc_request(dot11_frame_t *d11, bss_t *bss, const u_char *data, u_int32_t left, ie_index_t *ies, u_int64_t now);
+
+void beacon_timer(tw_timer_t *t, void *arg);
+void hop_timer(tw_timer_t *t, void *arg);
+void stats_timer(tw_timer_t *t, void *arg);
+void retransmit_timer(tw_timer_t *t, void *arg);
+void replay_sink(const u_int8_t *frame, u_int32_t len, void *arg);
+
+void build_templates(iface_t *ifc);
+void build_bss_templates(template_t *templates, bss_t *bss, u_int8_t *channel);
+u_int8_t *frame_from_template(int which, bss_t *bss, u_int8_t *dst_mac);
+int send_beacon(bss_t *bss);
+void send_beacons(iface_t *ifc);
+void hop_channel(iface_t *ifc);
+int send_probe_response(station_t *sta, bss_t *bss);
+int send_auth_response(station_t *sta, bss_t *bss);
+int send_assoc_response(station_t *sta, bss_t *bss);
+void bridge_to_host(dot11_frame_t *d11, const u_char *data, u_int32_t left);
+void bridge_msdu(const u_int8_t *addrs, const u_int8_t *msdu, u_int32_t len);
+int bridge_from_host(const u_int8_t *frame, u_int32_t len, void *arg);
+void bridge_queue(iface_t *from, iface_t *to, const u_int8_t *frame, u_int32_t len, int bss);
+void send_bridged(const u_int8_t *frame, u_int32_t len, int bss);
+void send_data_frame(bss_t *bss, const u_int8_t *frame, u_int32_t len);
 
 
 void usage(char *argv0)
 {
-	fprintf(stderr, "usage: %s [options] <ssid>\n", argv0);
+	fprintf(stderr, "usage: %s [options] <ssid> [<ssid> ...]\n", argv0);
 	fprintf(stderr, "\nsupported options:\n\n"
+			"-a <c>,<w>,<t> pin the first interface's capture, worker and transmit threads\n"
+			"               to cpus (with -t)\n"
 			"-b             send beacons regularly (default: off)\n"
-			"-c <channel>   use the specified channel (default: %d)\n"
-			"-i <interface> interface to use for monitoring/injection (default: %s)\n"
+			"-c <channels>  use the specified channel, or hop through several, staying on\n"
+			"               each for its dwell time: <channel>[/<ms>][,<channel>[/<ms>]...]\n"
+			"               (default: %d, dwell %d ms)\n"
+			"-C <backend>   how to change channels: nl80211 or mock (default: nl80211)\n"
+			"-d <level>     decode every frame we capture: 1 = one line each, 2 = also fixed\n"
+			"               fields and IEs, 3 = also a hex dump (default: off). add -F to\n"
+			"               see the frames the kernel would filter out\n"
+			"-D <file>      write decoded frames to a file or FIFO (default: stdout)\n"
+			"-F             don't filter out uninteresting frames in the kernel\n"
+			"-G <seconds>   with -W, start a new file this often\n"
+			"-i <interface>[:<channels>][@<cpu>]\n"
+			"               interface to use for monitoring/injection, optionally on its\n"
+			"               own channels and with its worker pinned to a cpu. repeat to\n"
+			"               serve up to %d interfaces at once (default: %s)\n"
+			"-l <format>    log events as text, json or raw records (default: text)\n"
+			"-L <file>      write the event log to a file (default: stdout)\n"
 			"-m <mac addr>  use the specified mac address (default: from phys)\n"
-			, DEFAULT_CHANNEL, g_iface);
+			"-p             capture with libpcap instead of a TPACKET_V3 ring\n"
+			"-r <file>      replay radiotap frames from a pcap file (requires -m)\n"
+			"-R <MB>        with -W, start a new file once one reaches this size\n"
+			"-s <seconds>   print statistics at the specified interval (default: off)\n"
+			"-S <file>      keep live statistics in a shared file for jftop, e.g. %s\n"
+			"-t             capture, process and transmit on separate threads\n"
+			"-T <tap>       bridge associated stations' data frames to a TAP interface\n"
+			"-w <file>      when replaying, write the frames we send to a pcap file\n"
+			"-W <file>      record every frame we receive and send to pcapng files\n"
+			"\nsend SIGUSR1 to print response latency histograms (also printed at exit)\n"
+			, DEFAULT_CHANNEL, CHAN_DWELL_DEFAULT, IFACE_MAX, DEFAULT_IFACE, SHM_STATS_DEFAULT);
 }
 
 
+#ifndef JFAP_NO_MAIN
 /*
  * The main function of this program simply checks prelimary arguments and
  * and launches the attack.
@@ -206,14 +555,12 @@ int main(int argc, char *argv[])
 {
 	char *argv0;
 	int ret = 0, c;
+	u_int32_t i;
 	pcap_t *pch = NULL;
-	struct pcap_pkthdr *pchdr = NULL;
-	const u_char *inbuf = NULL;
-	int pcret;
+	FILE *log = stdout;
 
 	/* initalize stuff */
 	srand(getpid());
-	strcpy(g_iface, "mon0");
 
 	argv0 = "jfap";
 	if (argv && argc > 0 && argv[0])
@@ -224,31 +571,86 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
-	while ((c = getopt(argc, argv, "bc:i:m:")) != -1) {
+	while ((c = getopt(argc, argv, "a:bc:C:d:D:FG:i:l:L:m:pr:R:s:S:tT:w:W:")) != -1) {
 		switch (c) {
 			case '?':
 			case 'h':
 				usage(argv0);
 				return 1;
 
+			case 'a':
+				{
+					char *p = optarg;
+					int i;
+
+					for (i = 0; i < PIPE_CPU_MAX && *p; i++) {
+						g_cpus[i] = strtol(p, &p, 10);
+						if (*p == ',')
+							p++;
+					}
+					if (*p) {
+						fprintf(stderr, "[!] invalid cpu list: %s\n", optarg);
+						return 1;
+					}
+				}
+				break;
+
 			case 'b':
 				g_send_beacons = 1;
 				break;
 
 			case 'c':
-				{
-					int tmp = atoi(optarg);
-					if (tmp < 1 || tmp > 12) {
-						fprintf(stderr, "[!] invalid channel: %s\n", optarg);
-						return 1;
-					}
+				if (!chan_parse_sched(optarg, &g_sched))
+					return 1;
+				break;
 
-					g_channel = tmp;
+			case 'C':
+				if (!(g_chan_backend = chan_backend(optarg))) {
+					fprintf(stderr, "[!] unknown channel backend: %s\n", optarg);
+					return 1;
 				}
 				break;
 
+			case 'd':
+				g_decode = atoi(optarg);
+				if (g_decode <= DC_OFF || g_decode >= DC_MAX) {
+					fprintf(stderr, "[!] invalid decode level: %s\n", optarg);
+					return 1;
+				}
+				break;
+
+			case 'D':
+				g_decode_file = optarg;
+				break;
+
+			case 'F':
+				g_use_filter = 0;
+				break;
+
+			case 'G':
+				g_record_secs = atoi(optarg);
+				break;
+
 			case 'i':
-				strncpy(g_iface, optarg, sizeof(g_iface) - 1);
+				if (!add_iface(optarg))
+					return 1;
+				break;
+
+			case 'l':
+				if (!strcmp(optarg, "text"))
+					g_log_format = EVLOG_TEXT;
+				else if (!strcmp(optarg, "json"))
+					g_log_format = EVLOG_JSON;
+				else if (!strcmp(optarg, "raw"))
+					g_log_format = EVLOG_RAW;
+				else {
+					fprintf(stderr, "[!] invalid log format: %s\n", optarg);
+					return 1;
+				}
+				break;
+
+			case 'L':
+				g_log_file = optarg;
 				break;
 
 			case 'm':
@@ -264,6 +666,42 @@ int main(int argc, char *argv[])
 				}
 				break;
 
+			case 'p':
+				g_use_pcap = 1;
+				break;
+
+			case 'r':
+				g_replay_in = optarg;
+				break;
+
+			case 'R':
+				g_record_bytes = (u_int64_t)atoi(optarg) << 20;
+				break;
+
+			case 's':
+				g_stats_interval = atoi(optarg);
+				break;
+
+			case 'S':
+				g_stats_path = optarg;
+				break;
+
+			case 't':
+				g_use_pipeline = 1;
+				break;
+
+			case 'T':
+				g_tap_name = optarg;
+				break;
+
+			case 'w':
+				g_replay_out = optarg;
+				break;
+
+			case 'W':
+				g_record_file = optarg;
+				break;
+
 			default:
 				fprintf(stderr, "[!] invalid option '%c'! try -h ...\n", c);
 				return 1;
@@ -282,239 +720,1762 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
-	strncpy((char *)g_ssid, argv[0], sizeof(g_ssid) - 1);
-	g_ssid_len = strlen((char *)g_ssid);
-
-	printf("[*] Starting access point with SSID \"%s\" via interface \"%s\"\n",
-			g_ssid, g_iface);
-
-	if (!start_pcap(&pch))
-		return 1;
+	/* every SSID gets a network of its own */
+	for (i = 0; i < (u_int32_t)argc; i++) {
+		if (!bss_add((u_int8_t *)argv[i], strlen(argv[i])))
+			return 1;
+	}
 
-	if ((g_sock = open_raw_socket()) == -1)
+	if (!g_num_ifaces && !add_iface(DEFAULT_IFACE))
 		return 1;
+	if (!g_sched.num) {
+		g_sched.channels[0] = DEFAULT_CHANNEL;
+		g_sched.dwell[0] = CHAN_DWELL_DEFAULT;
+		g_sched.num = 1;
+	}
+	for (i = 0; i < g_num_ifaces; i++) {
+		if (!g_ifaces[i].sched.num)
+			g_ifaces[i].sched = g_sched;
+		g_ifaces[i].channel = g_ifaces[i].sched.channels[0];
+	}
 
-	/* set the channel for the wireless card */
-	if (!set_channel())
+	if (g_log_file) {
+		if (!(log = fopen(g_log_file, g_log_format == EVLOG_RAW ? "wb" : "w"))) {
+			fprintf(stderr, "[!] Unable to open \"%s\" for writing: %s\n",
+					g_log_file, strerror(errno));
+			return 1;
+		}
+	}
+	if (!evlog_start(g_log_format, log))
 		return 1;
 
-	while (1) {
-		pcret = pcap_next_ex(pch, &pchdr, &inbuf);
-		if (pcret == -1) {
-			pcap_perror(pch, "[!] Failed to get a packet");
-			continue;
-		}
+	if (g_replay_in) {
+		printf("[*] Replaying access point with SSID \"%s\" from \"%s\"\n",
+				argv[0], g_replay_in);
 
-		/* if we got a packet, process it */
-		if (pcret == 1) {
-			/* check the length against the capture length */
-			if (pchdr->len > pchdr->caplen)
-				fprintf(stderr, "[-] WARNING: truncated frame! (len: %lu > caplen: %lu)\n",
-						(ulong)pchdr->len, (ulong)pchdr->caplen);
+		/* there's only one input, so only one interface to play it on */
+		g_num_ifaces = 1;
 
-			if (!handle_packet(inbuf, pchdr->caplen)) {
-				ret = 1;
-				break;
-			}
+		sta_init(&g_wheel, retransmit_timer);
+		if (!start_replay(&pch) || (g_tap_name && !start_bridge()) || !start_decoders()
+				|| !start_recorder()) {
+			evlog_stop();
+			return 1;
 		}
 
-		if (!process_periodic_tasks()) {
+		if (!replay_loop(pch))
 			ret = 1;
-			break;
+
+		stop_decoders();
+		stop_bridge();
+		pcap_close(pch);
+		ring_close(NULL, &g_ifaces[0].tx);
+		if (g_dumper)
+			pcap_dump_close(g_dumper);
+		stop_recorder();
+		evlog_stop();
+		return ret;
+	}
+
+	printf("[*] Starting access point with SSID \"%s\"", argv[0]);
+	for (i = 1; i < bss_count(); i++)
+		printf(", \"%s\"", argv[i]);
+	printf(" via interface \"%s\"", g_ifaces[0].name);
+	for (i = 1; i < g_num_ifaces; i++)
+		printf(", \"%s\"", g_ifaces[i].name);
+	printf("\n");
+
+	tw_init(&g_wheel, clock_ms());
+	sta_init(&g_wheel, retransmit_timer);
+	tsf_init(clock_us());
+
+	if ((g_stats_path && !start_stats_page()) || !start_decoders()) {
+		evlog_stop();
+		return 1;
+	}
+
+	for (i = 0; i < g_num_ifaces; i++) {
+		if (!start_live(&g_ifaces[i])) {
+			evlog_stop();
+			return 1;
 		}
 	}
+	if ((g_tap_name && !start_bridge()) || !start_recorder()) {
+		evlog_stop();
+		return 1;
+	}
 
-	pcap_close(pch);
+	start_timers();
+
+	/* the main thread looks after the first interface itself */
+	if (!start_workers() || !event_loop(&g_ifaces[0]))
+		ret = 1;
+	if (!stop_workers())
+		ret = 1;
+	dump_latency();
+
+	for (i = 0; i < g_num_ifaces; i++)
+		stop_live(&g_ifaces[i]);
+	stop_decoders();
+	stop_recorder();
+	stop_bridge();
+	shmstats_close(g_shm, g_stats_path);
+	evlog_stop();
 	return ret;
 }
+#endif
 
 
 /*
- * handle a single packet from the wifi nic
+ * get the current time in ms - the replay clock if we're replaying
  */
-int handle_packet(const u_char *data, u_int32_t left)
+u_int64_t now_ms(void)
 {
-	dot11_frame_t *d11;
+	if (g_replay_in)
+		return g_replay_us / 1000;
+	return clock_ms();
+}
 
-	if (!process_radiotap(&data, &left))
-		return 1; /* treat errors as warnings */
 
-	if (!(d11 = get_dot11_frame(&data, &left)))
-		return 1; /* treat errors as warnings */
+/*
+ * get the current time in us - the replay clock if we're replaying
+ */
+u_int64_t now_us(void)
+{
+	if (g_replay_in)
+		return g_replay_us;
+	return clock_us();
+}
 
-	/* ignore anything from us */
-	if (!memcmp(d11->src_mac, g_bssid, ETH_ALEN))
-		return 1; /* finished with this packet */
 
-	/* handle retransmissions */
-	if (d11->ctrlflags & CF_RETRY) {
-		/* if we have a packet that we tried to send, re-send it now */
-		if (g_pkt_len > 0) {
-			/* don't retransmit too fast */
-			struct timespec now, diff;
+/*
+ * wait for the clock to reach the specified time (us). this blocks, so it's
+ * only for closing the last gap (under a tick) to a deadline. when replaying,
+ * time just moves on
+ */
+void wait_until_us(u_int64_t when)
+{
+	struct timespec ts;
+
+	if (g_replay_in) {
+		if (when > g_replay_us)
+			g_replay_us = when;
+		return;
+	}
 
-			if (clock_gettime(CLOCK_REALTIME, &now)) {
-				perror("[!] gettimeofday failed");
-				return 0;
-			}
+	ts.tv_sec = when / 1000000;
+	ts.tv_nsec = (when % 1000000) * 1000;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
 
-			/* see how long since the last retransmit. if it's been
-			 * long enough, send again */
-			timespec_diff(&now, &last_retransmit, &diff);
 
-			if (diff.tv_sec > 0 || diff.tv_nsec > BEACON_INTERVAL * 100000) {
-#ifdef DEBUG_RETRANSMIT
-				printf("[*] Re-transmitting...\n");
-#endif
-				if (send(g_sock, g_pkt, g_pkt_len, 0) == -1) {
-					perror("[!] Unable to re-send packet!");
-					/* just try again later */
-				}
-				last_retransmit = now;
-			}
-		}
+/*
+ * add an interface from a -i argument - <name>[:<channels>][@<cpu>]
+ *
+ * on success, we return 1, on failure, 0
+ */
+int add_iface(const char *spec)
+{
+	iface_t *ifc;
+	char *p;
 
-		/* don't process retransmission packets further */
-		return 1;
+	if (g_num_ifaces >= IFACE_MAX) {
+		fprintf(stderr, "[!] too many interfaces, at most %d are supported\n", IFACE_MAX);
+		return 0;
+	}
+	ifc = &g_ifaces[g_num_ifaces];
+	memset(ifc, 0, sizeof(*ifc));
+	snprintf(ifc->name, sizeof(ifc->name), "%s", spec);
+	ifc->sock = -1;
+	ifc->cpu = -1;
+
+	if ((p = strchr(ifc->name, '@'))) {
+		*p++ = '\0';
+		ifc->cpu = strtol(p, &p, 10);
+		if (*p || ifc->cpu < 0) {
+			fprintf(stderr, "[!] invalid cpu for interface: %s\n", spec);
+			return 0;
+		}
 	}
 
-	/* handle broadcast packets - only probe requests */
-	if (d11->type == T_MGMT && d11->subtype == ST_PROBE_REQ) {
-		if (!process_probe_request(d11, data, left))
-			return 1; /* finished with this packet */
-		return 1; /* finished with this packet */
+	if ((p = strchr(ifc->name, ':'))) {
+		*p++ = '\0';
+		if (!chan_parse_sched(p, &ifc->sched))
+			return 0;
 	}
 
-	/* from here on out, we only handle unicast packets */
-	if (memcmp(d11->dst_mac, g_bssid, ETH_ALEN)) {
-#ifdef DEBUG_IGNORED
-		printf("[*] Ingoring 802.11 packet ver:%u type:%s subtype:%s\n",
-				d11->version, dot11_types[d11->type],
-				dot11_subtypes[d11->type][d11->subtype]);
-		hexdump(data, left);
-#endif
-		return 1; /* finished with this packet */
+	if (!ifc->name[0]) {
+		fprintf(stderr, "[!] invalid interface: %s\n", spec);
+		return 0;
 	}
 
-	if (d11->type == T_MGMT) {
-		if (d11->subtype == ST_AUTH)
-			return process_auth_request(d11, data, left);
+	ifc->wheel = g_num_ifaces ? &ifc->own_wheel : &g_wheel;
+	g_num_ifaces++;
+	return 1;
+}
 
-		else if (d11->subtype == ST_ASSOC_REQ)
-			return process_assoc_request(d11, data, left);
 
-	} /* type check */
+/*
+ * open everything we need to run on a real interface
+ *
+ * on succes, we return 1, on failure, 0
+ */
+int start_live(iface_t *ifc)
+{
+	tx_ring_t *tx = g_use_pipeline ? &ifc->tx_wire : &ifc->tx;
+	int none[PIPE_CPU_MAX] = { -1, -1, -1 };
 
-	else if (d11->type == T_DATA) {
-		if (g_state != S_ESTABLISHED) {
-			g_state = S_ESTABLISHED;
-			g_pkt_len = 0;
-#ifndef DEBUG_DATA
-			printf("[*] Station successfully associated and is sending data...\n");
-#endif
-		}
-#ifdef DEBUG_DATA
-		printf("[*] Unhandled 802.11 packet ver:%u type:%s subtype:%s%s\n",
-				d11->version, dot11_types[d11->type],
-				dot11_subtypes[d11->type][d11->subtype],
-				(d11->subtype >> 3) ? " (QoS)" : "");
-		hexdump(data, left);
-#endif
-		return 1;
+	ifc->pch = NULL;
+	if (ifc->wheel != &g_wheel)
+		tw_init(ifc->wheel, clock_ms());
+
+	if (g_use_pcap) {
+		if (!start_pcap(ifc))
+			return 0;
+
+		/* only used for sending, so don't let it queue up received frames */
+		if ((ifc->sock = open_raw_socket(ifc, 0)) == -1)
+			return 0;
+
+		if (!ring_setup(NULL, tx, ifc->sock))
+			return 0;
+	} else {
+		/* one socket does it all - receive and send via the rings */
+		if ((ifc->sock = open_raw_socket(ifc, htons(ETH_P_ALL))) == -1)
+			return 0;
+
+		printf("[*] Starting capture on \"%s\" ...\n", ifc->name);
+		if (!ring_setup(&ifc->ring, tx, ifc->sock))
+			return 0;
 	}
 
-	/* if we didn't handle this packet somehow, we should display it */
-#ifdef DEBUG_DOT11
-	printf("[*] Unhandled 802.11 packet ver:%u type:%s subtype:%s\n",
-			d11->version, dot11_types[d11->type],
-			dot11_subtypes[d11->type][d11->subtype]);
-	hexdump(data, left);
-#endif
+	bss_set_base(g_bssid);
+	cl_setup();
+
+	/* now that we know our bssids, drop what we don't care about in the
+	 * kernel. unless we're bridging, we don't look past the header of data
+	 * frames, so don't bother copying the rest */
+	if (g_use_filter) {
+		if (!filter_attach(ifc->pch ? pcap_fileno(ifc->pch) : ifc->sock, !g_tap_name))
+			return 0;
+		if (!g_tap_name)
+			ifc->ring.warn_truncated = 0;
+	}
+
+	/* tune the card to the first channel on its schedule */
+	if (!chan_open(&ifc->chan, g_chan_backend, ifc->name)
+			|| !set_channel(ifc, ifc->sched.channels[0]))
+		return 0;
+
+	/* the worker queues frames to the transmit thread, which owns the
+	 * socket's transmit side. -a only applies to the first interface,
+	 * the others' workers pin themselves */
+	if (g_use_pipeline) {
+		const int *cpus = ifc == &g_ifaces[0] ? g_cpus : none;
+
+		if (!tx_setup_sink(&ifc->tx, pipeline_tx_sink, &ifc->pipe))
+			return 0;
+		ifc->tx.sink_done = pipeline_tx_done;
+
+		if (ifc->pch) {
+			if (!pipeline_start(&ifc->pipe, pcap_get_selectable_fd(ifc->pch), capture_pcap, ifc->pch, &ifc->tx_wire, cpus))
+				return 0;
+		} else if (!pipeline_start(&ifc->pipe, ifc->sock, capture_ring, &ifc->ring, &ifc->tx_wire, cpus))
+			return 0;
+		printf("[*] Started the capture and transmit threads for \"%s\"\n", ifc->name);
+	}
 
 	return 1;
 }
 
 
 /*
- * handle periodic tasks that need to be done
+ * close everything start_live() opened
  */
-int process_periodic_tasks(void)
+void stop_live(iface_t *ifc)
 {
-	if (g_send_beacons) {
-		/* we didn't get a pcket yet, do periodic processing */
-		struct timespec now, diff;
+	tx_ring_t *tx = &ifc->tx;
+
+	if (g_use_pipeline) {
+		/* whatever the worker still has queued goes out with the rest */
+		ring_close(NULL, &ifc->tx);
+		pipeline_stop(&ifc->pipe);
+		tx = &ifc->tx_wire;
+	}
+
+	if (ifc->pch) {
+		pcap_close(ifc->pch);
+		ring_close(NULL, tx);
+	} else
+		ring_close(&ifc->ring, tx);
+	close(ifc->sock);
+	chan_close(&ifc->chan);
+}
+
+
+/*
+ * pipeline capture callbacks, run on the capture thread
+ */
+int capture_ring(void *arg, ring_handler_t fn)
+{
+	return ring_read(arg, fn);
+}
+
+int capture_pcap(void *arg, ring_handler_t fn)
+{
+	return process_pcap(arg, fn);
+}
 
-		if (clock_gettime(CLOCK_REALTIME, &now)) {
-			perror("[!] clock_gettime failed");
+
+/*
+ * start a worker thread for every interface but the first, and pin the main
+ * thread if the first one asked for it
+ *
+ * on success, we return 1, on failure, 0
+ */
+int start_workers(void)
+{
+	pthread_attr_t attr;
+	cpu_set_t set;
+	sigset_t all, old;
+	u_int32_t i;
+	int err;
+
+	if (g_ifaces[0].cpu >= 0) {
+		CPU_ZERO(&set);
+		CPU_SET(g_ifaces[0].cpu, &set);
+		if ((err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set))) {
+			fprintf(stderr, "[!] Unable to pin the worker for \"%s\" to cpu %d: %s\n",
+					g_ifaces[0].name, g_ifaces[0].cpu, strerror(err));
 			return 0;
 		}
+	}
 
-		/* see how long since the last beacon. if it's been long enough,
-		 * send another */
-		timespec_diff(&now, &last_beacon, &diff);
-		if (diff.tv_sec > 0 || diff.tv_nsec > BEACON_INTERVAL * 1000000) {
-#ifdef DEBUG_BEACON_INTERVAL
-			printf("%lu.%lu - %lu.%lu = %lu.%lu (vs %lu)\n",
-					(ulong)now.tv_sec, now.tv_nsec,
-					(ulong)last_beacon.tv_sec, last_beacon.tv_nsec,
-					(ulong)diff.tv_sec, diff.tv_nsec,
-					(ulong)BEACON_INTERVAL * 1000000);
-#endif
-			if (!send_beacon())
-				return 1; /* treat error as warning */
-			last_beacon = now;
+	if (g_num_ifaces < 2)
+		return 1;
+
+	if ((g_stop_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+		perror("[!] Unable to create the stop eventfd");
+		return 0;
+	}
+
+	/* only the main thread should ever see signals */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	for (i = 1; i < g_num_ifaces; i++) {
+		iface_t *ifc = &g_ifaces[i];
+
+		pthread_attr_init(&attr);
+		if (ifc->cpu >= 0) {
+			CPU_ZERO(&set);
+			CPU_SET(ifc->cpu, &set);
+			pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+		}
+		err = pthread_create(&ifc->thread, &attr, iface_worker, ifc);
+		pthread_attr_destroy(&attr);
+		if (err) {
+			fprintf(stderr, "[!] Unable to start the worker for \"%s\": %s\n",
+					ifc->name, strerror(err));
+			break;
 		}
-	} /* if (g_send_beacons) */
+		ifc->running = 1;
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (i < g_num_ifaces)
+		return 0;
+	printf("[*] Started %u worker threads\n", g_num_ifaces - 1);
+	return 1;
+}
+
+
+/*
+ * tell the workers to stop, and wait for them
+ *
+ * returns 0 if any of them failed, 1 otherwise
+ */
+int stop_workers(void)
+{
+	u_int32_t i;
+	int ret = 1;
+
+	if (g_stop_efd == -1)
+		return 1;
+
+	eventfd_write(g_stop_efd, 1);
+	for (i = 1; i < g_num_ifaces; i++) {
+		if (!g_ifaces[i].running)
+			continue;
+		pthread_join(g_ifaces[i].thread, NULL);
+		g_ifaces[i].running = 0;
+		if (g_ifaces[i].failed)
+			ret = 0;
+	}
+
+	close(g_stop_efd);
+	g_stop_efd = -1;
+	return ret;
+}
+
+
+/*
+ * worker thread for every interface but the first
+ */
+void *iface_worker(void *arg)
+{
+	iface_t *ifc = arg;
+
+	g_cur = ifc;
+	if (!event_loop(ifc)) {
+		ifc->failed = 1;
+
+		/* take everyone else down with us */
+		eventfd_write(g_stop_efd, 1);
+	}
+	return NULL;
+}
+
+
+/*
+ * with more than one worker, the station table and the timer wheels are
+ * shared. with one, there's nobody to share them with
+ */
+static inline void state_lock(void)
+{
+	if (g_num_ifaces > 1)
+		pthread_mutex_lock(&g_lock);
+}
+
+static inline void state_unlock(void)
+{
+	if (g_num_ifaces > 1)
+		pthread_mutex_unlock(&g_lock);
+}
+
+
+/*
+ * kick off the periodic timers
+ */
+void start_timers(void)
+{
+	u_int64_t tsf = tsf_get(now_us());
+	u_int32_t i, j;
+
+	/* the wheel only has ms, so each beacon timer goes off in the tick its
+	 * TBTT falls in, and beacon_timer() waits out the rest */
+	if (g_send_beacons) {
+		for (i = 0; i < g_num_ifaces; i++) {
+			iface_t *ifc = &g_ifaces[i];
+
+			for (j = 0; j < bss_count(); j++) {
+				ifc->next_tbtt[j] = tsf_next_tbtt(tsf, TU_TO_USEC(BEACON_INTERVAL),
+						bss_tsf_adjust(bss_get(j)));
+				tw_setup(&ifc->beacon_timers[j], beacon_timer, ifc);
+				tw_add(ifc->wheel, &ifc->beacon_timers[j],
+						tsf_to_clock(ifc->next_tbtt[j]) / 1000);
+			}
+		}
+	}
+	/* interfaces with more than one channel start hopping */
+	for (i = 0; i < g_num_ifaces; i++) {
+		iface_t *ifc = &g_ifaces[i];
+
+		if (ifc->sched.num > 1) {
+			tw_setup(&ifc->hop_timer, hop_timer, ifc);
+			tw_add(ifc->wheel, &ifc->hop_timer, ifc->wheel->now + ifc->sched.dwell[0]);
+		}
+	}
+
+	if (g_stats_interval) {
+		tw_setup(&g_stats_timer, stats_timer, NULL);
+		tw_add(&g_wheel, &g_stats_timer, g_wheel.now + g_stats_interval * 1000);
+	}
+}
+
+
+/*
+ * wait for an interface's frames and timer deadlines until we're told to stop
+ *
+ * everything sleeps in one epoll_wait(). the timerfd is always armed for the
+ * earliest deadline on the interface's timer wheel (on CLOCK_MONOTONIC, like
+ * the wheel). the main thread (the first interface) also waits for signals,
+ * and the other workers for the stop eventfd
+ *
+ * on a clean shutdown, we return 1, on failure, 0
+ */
+int event_loop(iface_t *ifc)
+{
+	struct epoll_event ev, events[8];
+	struct itimerspec its;
+	u_int64_t armed = TW_NEVER, next;
+	sigset_t mask;
+	int is_main = ifc->wheel == &g_wheel;
+	int epfd = -1, tfd = -1, sfd = -1, cfd, timeout = -1;
+	int i, n, ret = 0;
+
+	/* turn SIGINT/SIGTERM into something we can wait on */
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGUSR1);
+	if (is_main) {
+		if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1) {
+			perror("[!] Unable to block signals");
+			return 0;
+		}
+		if ((sfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) == -1) {
+			perror("[!] Unable to create signalfd");
+			goto out;
+		}
+		if (g_num_ifaces > 1)
+			timeout = MAIN_WAKE_INTERVAL;
+	}
+
+	if ((tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1) {
+		perror("[!] Unable to create timerfd");
+		goto out;
+	}
+
+	if ((epfd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+		perror("[!] Unable to create epoll instance");
+		goto out;
+	}
+
+	if (g_use_pipeline)
+		cfd = ifc->pipe.rx_efd;
+	else
+		cfd = ifc->pch ? pcap_get_selectable_fd(ifc->pch) : ifc->sock;
+	ev.events = EPOLLIN;
+	ev.data.fd = cfd;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, cfd, &ev) == -1) {
+		perror("[!] Unable to watch the capture socket");
+		goto out;
+	}
+	ev.data.fd = tfd;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev) == -1) {
+		perror("[!] Unable to watch the timerfd");
+		goto out;
+	}
+	ev.data.fd = sfd;
+	if (sfd != -1 && epoll_ctl(epfd, EPOLL_CTL_ADD, sfd, &ev) == -1) {
+		perror("[!] Unable to watch the signalfd");
+		goto out;
+	}
+	ev.data.fd = g_stop_efd;
+	if (g_stop_efd != -1 && epoll_ctl(epfd, EPOLL_CTL_ADD, g_stop_efd, &ev) == -1) {
+		perror("[!] Unable to watch the stop eventfd");
+		goto out;
+	}
+	ev.data.fd = is_main ? g_tap.fd : ifc->bridge_q.efd;
+	if (g_tap.fd != -1 && epoll_ctl(epfd, EPOLL_CTL_ADD, ev.data.fd, &ev) == -1) {
+		perror("[!] Unable to watch the TAP");
+		goto out;
+	}
+
+	while (1) {
+		/* only touch the timerfd when the next deadline moves */
+		state_lock();
+		next = tw_next_expiry(ifc->wheel);
+		state_unlock();
+		if (next != armed) {
+			memset(&its, 0, sizeof(its));
+			if (next != TW_NEVER) {
+				its.it_value.tv_sec = next / 1000;
+				its.it_value.tv_nsec = (next % 1000) * 1000000;
+				/* all zeros would disarm it */
+				if (!its.it_value.tv_sec && !its.it_value.tv_nsec)
+					its.it_value.tv_nsec = 1;
+			}
+			if (timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL) == -1) {
+				perror("[!] Unable to arm timerfd");
+				goto out;
+			}
+			armed = next;
+		}
+
+		n = epoll_wait(epfd, events, sizeof(events) / sizeof(events[0]), timeout);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			perror("[!] epoll_wait failed");
+			goto out;
+		}
+
+		for (i = 0; i < n; i++) {
+			int fd = events[i].data.fd;
+
+			if (fd == cfd) {
+				if (g_use_pipeline) {
+					if (!pipeline_rx(&ifc->pipe, handle_packet))
+						goto out;
+				} else if (ifc->pch) {
+					if (!process_pcap(ifc->pch, handle_packet))
+						goto out;
+				} else if (!ring_read_batch(&ifc->ring, handle_batch))
+					goto out;
+			}
+
+			else if (fd == tfd) {
+				u_int64_t expirations;
+
+				/* it's one-shot, so it's disarmed now */
+				if (read(tfd, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN)
+					perror("[-] Unable to read timerfd");
+				armed = TW_NEVER;
+			}
+
+			else if (fd == sfd) {
+				struct signalfd_siginfo si;
+
+				if (read(sfd, &si, sizeof(si)) == sizeof(si)) {
+					if (si.ssi_signo == SIGUSR1) {
+						dump_latency();
+						continue;
+					}
+					printf("[*] Caught signal %u, shutting down...\n", si.ssi_signo);
+				}
+				ret = 1;
+				goto out;
+			}
+
+			/* someone else is shutting down */
+			else if (fd == g_stop_efd) {
+				ret = 1;
+				goto out;
+			}
+
+			/* the host sent something to our stations */
+			else if (is_main && fd == g_tap.fd) {
+				u_int32_t j;
+
+				state_lock();
+				if (!tap_read(&g_tap, bridge_from_host, ifc)) {
+					state_unlock();
+					goto out;
+				}
+				state_unlock();
+
+				/* one wakeup per batch for the other workers */
+				for (j = 1; j < g_num_ifaces; j++)
+					tap_queue_kick(&g_ifaces[j].bridge_q);
+			}
+
+			/* and some of it is for stations on this interface */
+			else if (!is_main && g_tap.fd != -1 && fd == ifc->bridge_q.efd)
+				tap_queue_drain(&ifc->bridge_q, send_bridged);
+		}
+
+		if (!process_periodic_tasks(ifc))
+			goto out;
+	}
+
+out:
+	if (epfd != -1)
+		close(epfd);
+	if (tfd != -1)
+		close(tfd);
+	if (sfd != -1)
+		close(sfd);
+	if (is_main)
+		sigprocmask(SIG_UNBLOCK, &mask, NULL);
+	return ret;
+}
+
+
+/*
+ * feed every frame in the input file through handle_packet as fast as we
+ * can, with time following the input timestamps. timers fire at the time
+ * they would have, relative to the frames around them
+ *
+ * on succes, we return 1, on failure, 0
+ */
+int replay_loop(pcap_t *pch)
+{
+	struct pcap_pkthdr *pchdr = NULL;
+	const u_char *inbuf = NULL;
+	u_int64_t frames = 0, start, elapsed, ts, next;
+	int pcret;
+
+	start = clock_ms();
+	while ((pcret = pcap_next_ex(pch, &pchdr, &inbuf)) == 1) {
+		ts = (u_int64_t)pchdr->ts.tv_sec * 1000000 + pchdr->ts.tv_usec;
+
+		/* the clock starts with the first frame */
+		if (!frames) {
+			g_replay_us = ts;
+			tw_init(&g_wheel, ts / 1000);
+			tsf_init(ts);
+			start_timers();
+		}
+
+		/* run anything that was due before this frame arrived */
+		while ((next = tw_next_expiry(&g_wheel)) <= ts / 1000) {
+			if (next * 1000 > g_replay_us)
+				g_replay_us = next * 1000;
+			publish_stats(&g_ifaces[0]);
+			tw_advance(&g_wheel, next);
+			if (g_ifaces[0].hop_due)
+				hop_channel(&g_ifaces[0]);
+			send_beacons(&g_ifaces[0]);
+			tx_flush(&g_ifaces[0].tx);
+		}
+		tw_advance(&g_wheel, ts / 1000);
+		if (g_ifaces[0].hop_due)
+			hop_channel(&g_ifaces[0]);
+		send_beacons(&g_ifaces[0]);
+
+		/* merged captures can go backwards, don't let time */
+		if (ts > g_replay_us)
+			g_replay_us = ts;
+
+		frames++;
+		/* the input's timestamps aren't ours to measure against */
+		if (!handle_packet(inbuf, pchdr->caplen, 0))
+			return 0;
+
+		/* the host can answer while we play, whatever it sends just goes
+		 * out with the next frame */
+		if (g_tap.fd != -1 && !tap_read(&g_tap, bridge_from_host, &g_ifaces[0]))
+			return 0;
+		tx_flush(&g_ifaces[0].tx);
+	}
+
+	if (pcret == -1) {
+		pcap_perror(pch, "[!] Failed to read a packet");
+		return 0;
+	}
+
+	elapsed = clock_ms() - start;
+	printf("[*] Replayed %llu frames in %llu ms (%.0f frames/s), sent %llu frames\n",
+			(unsigned long long)frames, (unsigned long long)elapsed,
+			frames * 1000.0 / (elapsed ? elapsed : 1),
+			(unsigned long long)g_ifaces[0].tx.frames);
+	return 1;
+}
+
+
+/*
+ * write a frame we "sent" during replay to the output file, stamped with the
+ * replay clock
+ */
+void replay_sink(const u_int8_t *frame, u_int32_t len, void *arg)
+{
+	struct pcap_pkthdr hdr;
+
+	if (!g_dumper)
+		return;
+
+	hdr.ts.tv_sec = g_replay_us / 1000000;
+	hdr.ts.tv_usec = g_replay_us % 1000000;
+	hdr.caplen = len;
+	hdr.len = len;
+	pcap_dump((u_char *)g_dumper, &hdr, frame);
+}
+
+
+/*
+ * get the packets libpcap has ready and hand them to fn
+ */
+int process_pcap(pcap_t *pch, ring_handler_t fn)
+{
+	struct pcap_pkthdr *pchdr = NULL;
+	const u_char *inbuf = NULL;
+	int pcret, cnt;
+
+	for (cnt = 0; cnt < PCAP_BATCH; cnt++) {
+		pcret = pcap_next_ex(pch, &pchdr, &inbuf);
+		if (pcret == -1) {
+			pcap_perror(pch, "[!] Failed to get a packet");
+			return 1;
+		}
+
+		/* nothing left for now */
+		if (pcret != 1)
+			break;
+
+		/* check the length against the capture length */
+		if (pchdr->len > pchdr->caplen && !g_use_filter)
+			fprintf(stderr, "[-] WARNING: truncated frame! (len: %lu > caplen: %lu)\n",
+					(ulong)pchdr->len, (ulong)pchdr->caplen);
+
+		if (!fn(inbuf, pchdr->caplen,
+					(u_int64_t)pchdr->ts.tv_sec * 1000000000 + (u_int64_t)pchdr->ts.tv_usec * 1000))
+			return 0;
+	}
+	return 1;
+}
+
+
+/*
+ * handle a single packet from the wifi nic, captured at ts (ns, 0 if unknown)
+ */
+int handle_packet(const u_char *data, u_int32_t left, u_int64_t ts)
+{
+	dot11_frame_t *d11;
+	int ret;
+
+	g_cur->rx_captured = ts;
+	g_cur->rx_entered = ts ? lat_clock() : 0;
+
+	if (!(d11 = prepare_packet(&data, &left, ts)))
+		return 1; /* treat errors as warnings */
+
+	/* ignore anything from us, or that isn't for us - the same checks a
+	 * batch from the ring gets */
+	if (!cl_classify((const u_int8_t **)&d11, 1))
+		return 1; /* finished with this packet */
+
+	state_lock();
+	ret = handle_dot11(d11, data, left);
+	state_unlock();
+	return ret;
+}
+
+
+/*
+ * handle a batch of packets from the ring. they're classified all at once,
+ * and then whatever we don't drop is handled in order, with the state lock
+ * taken just once
+ */
+int handle_batch(rx_batch_t *b)
+{
+	const u_int8_t *hdrs[RING_BATCH];
+	const u_char *body[RING_BATCH];
+	u_int32_t left[RING_BATCH];
+	u_int64_t ts[RING_BATCH];
+	u_int64_t keep;
+	u_int32_t i, n = 0;
+	int ret = 1;
+
+	for (i = 0; i < b->num; i++) {
+		const u_char *data = b->data[i];
+		u_int32_t len = b->len[i];
+		dot11_frame_t *d11;
+
+		if (!(d11 = prepare_packet(&data, &len, b->ts[i])))
+			continue; /* treat errors as warnings */
+		hdrs[n] = (u_int8_t *)d11;
+		body[n] = data;
+		left[n] = len;
+		ts[n] = b->ts[i];
+		n++;
+	}
+
+	if (!n)
+		return 1;
+	keep = cl_classify(hdrs, n);
+
+	state_lock();
+	for (i = 0; i < n && ret; i++) {
+		if (!(keep & (1ULL << i)))
+			continue;
+		g_cur->rx_captured = ts[i];
+		g_cur->rx_entered = ts[i] ? lat_clock() : 0;
+		ret = handle_dot11((dot11_frame_t *)hdrs[i], body[i], left[i]);
+	}
+	state_unlock();
+	return ret;
+}
+
+
+/*
+ * count a packet (and record it with -W, and decode it with -d) and get past its radiotap header to
+ * the 802.11 frame. ts is when it was captured (ns, 0 if unknown)
+ *
+ * returns NULL if there's nothing there for us
+ */
+dot11_frame_t *prepare_packet(const u_char **pdata, u_int32_t *pleft, u_int64_t ts)
+{
+	dot11_frame_t *d11;
+	rt_meta_t rt;
+
+	g_cur->rx_frames++;
+	if (g_record_file)
+		rec_frame(g_cur - g_ifaces, REC_RX, record_time(ts), *pdata, *pleft);
+
+	if (!process_radiotap(pdata, pleft, &rt)) {
+		g_cur->rx_malformed++;
+		return NULL;
+	}
+
+	/* when replaying, frames were captured when the input says */
+	if (g_decode)
+		dc_frame(&g_cur->dec, g_replay_in ? g_replay_us * 1000 : ts, &rt, *pdata, *pleft);
+
+	/* the driver already told us this one is garbage */
+	if (rt.flags & IEEE80211_RADIOTAP_F_BADFCS) {
+		g_cur->rx_bad_fcs++;
+		return NULL;
+	}
+
+	if (!(d11 = get_dot11_frame(pdata, pleft))) {
+		g_cur->rx_malformed++;
+		return NULL;
+	}
+	g_cur->frames[d11->type][d11->subtype]++;
+	return d11;
+}
+
+
+/*
+ * handle an 802.11 frame that isn't from us. this is where station state
+ * changes, so with more than one worker it's called with g_lock held
+ */
+int handle_dot11(dot11_frame_t *d11, const u_char *data, u_int32_t left)
+{
+	u_int16_t seq_ctrl = (d11->seq << 4) | d11->frag;
+	u_int32_t cache = STA_SEQ_NON_QOS;
+	int retry = d11->ctrlflags & CF_RETRY;
+	station_t *sta;
+	u_int64_t now;
+	int ret;
+
+	now = now_ms();
+	if (d11->type == T_DATA && (d11->subtype & ST_QOS))
+		cache = dot11_qos_ctrl(d11) & 7;
+
+	/* drop copies of the last frame each station sent, before we look any
+	 * deeper. this also keeps stations we know about from aging out */
+	if ((sta = sta_lookup(d11->src_mac))) {
+		if (!sta_seen(sta, cache, seq_ctrl, retry, now))
+			return process_dot11(d11, sta, data, left, now);
+
+		g_cur->rx_dups++;
+
+		/* the station didn't hear us. if we have a packet that we tried
+		 * to send it and we're done re-sending it, start over right away.
+		 * if we're still re-sending, the timer will take care of it */
+		if (retry && sta->pkt_len > 0 && !tw_pending(&sta->retransmit_timer)) {
+			sta->retransmits_left = RETRANSMIT_COUNT;
+			sta_retransmit_at(sta, g_cur->wheel, now);
+		}
+		return 1; /* finished with this packet */
+	}
+
+	/* if this frame got us tracking a new station, start its cache with it */
+	ret = process_dot11(d11, NULL, data, left, now);
+	if ((sta = sta_lookup(d11->src_mac)))
+		sta_seen(sta, cache, seq_ctrl, retry, now);
+	return ret;
+}
+
+
+/*
+ * handle a frame that isn't a duplicate. sta is the station that sent it, if
+ * we were already tracking it
+ */
+int process_dot11(dot11_frame_t *d11, station_t *sta, const u_char *data, u_int32_t left, u_int64_t now)
+{
+	bss_t *bss;
+	ie_index_t ies;
+
+	/* handle broadcast packets - only probe requests */
+	if (d11->type == T_MGMT && d11->subtype == ST_PROBE_REQ) {
+		index_ies(d11, data, left, &ies);
+		if (!process_probe_request(d11, &ies, now))
+			return 1; /* finished with this packet */
+		return 1; /* finished with this packet */
+	}
+
+	/* from here on out, we only handle unicast packets */
+	if (!(bss = bss_by_addr(d11->dst_mac)))
+		return 1; /* finished with this packet */
+
+	if (d11->type == T_MGMT) {
+		if (d11->subtype == ST_AUTH)
+			return process_auth_request(d11, bss, data, left, now);
+
+		else if (d11->subtype == ST_ASSOC_REQ) {
+			index_ies(d11, data, left, &ies);
+			return process_assoc_request(d11, bss, data, left, &ies, now);
+		}
+
+	} /* type check */
+
+	else if (d11->type == T_DATA) {
+		/* only stations we've answered an association request from get
+		 * to send data. anyone else could fill the table, or reach the
+		 * host through the bridge */
+		if (!sta || (sta->state != S_SENT_ASSOC_RESP && sta->state != S_ESTABLISHED)) {
+			g_cur->bridge_dropped++;
+			return 1;
+		}
+		if (sta->state != S_ESTABLISHED) {
+			sta->state = S_ESTABLISHED;
+			sta->bss = bss->index;
+			sta->iface = g_cur - g_ifaces;
+			sta->pkt_len = 0;
+			tw_cancel(sta->retransmit_wheel, &sta->retransmit_timer);
+			ev_log(EV_ESTABLISHED, now, sta->mac, 0, 0, 0);
+		}
+		if (g_tap.fd != -1) {
+			bridge_to_host(d11, data, left);
+			return 1;
+		}
+		return 1;
+	}
+
+	/* anything we didn't handle shows up with -d */
+	return 1;
+}
+
+
+/*
+ * handle periodic tasks that need to be done
+ */
+int process_periodic_tasks(iface_t *ifc)
+{
+	state_lock();
+	tw_advance(ifc->wheel, now_ms());
+	state_unlock();
+
+	/* switching channels can block, so it's done without the lock too */
+	if (ifc->hop_due)
+		hop_channel(ifc);
+
+	/* beacons wait for their TBTTs, so what's queued goes out first */
+	if (ifc->beacons_due) {
+		tx_flush(&ifc->tx);
+		if (ifc->lat_npending)
+			trace_flushed(ifc);
+		send_beacons(ifc);
+	}
+
+	/* send everything the packet handlers and timers queued up */
+	tx_flush(&ifc->tx);
+	if (ifc->lat_npending)
+		trace_flushed(ifc);
+
+	/* and then what we decoded, which can wait */
+	if (g_decode && !dc_flush(&ifc->dec))
+		return 0;
+
+	publish_stats(ifc);
+	return 1;
+}
+
+
+/*
+ * note how long the frame we're answering took to reach its handler, and how
+ * long the handler took to queue this response to it. the rest is filled in
+ * by trace_flushed()
+ */
+void trace_response(const u_int8_t *pkt)
+{
+	iface_t *ifc = g_cur;
+	dot11_frame_t *d11 = (dot11_frame_t *)(pkt + ((radiotap_t *)pkt)->it_len);
+	lat_pending_t *lp;
+	u_int32_t kind;
+
+	if (!ifc->rx_captured || ifc->lat_npending >= TX_FRAME_NR)
+		return;
+
+	switch (d11->subtype) {
+		case ST_PROBE_RESP:
+			kind = LAT_PROBE;
+			break;
+		case ST_AUTH:
+			kind = LAT_AUTH;
+			break;
+		case ST_ASSOC_RESP:
+			kind = LAT_ASSOC;
+			break;
+		default:
+			return;
+	}
+
+	lp = &ifc->lat_pending[ifc->lat_npending++];
+	lp->captured = ifc->rx_captured;
+	lp->queued = lat_clock();
+	lp->kind = kind;
+	lat_record(&ifc->lat[kind][LAT_CAPTURE], lat_since(ifc->rx_captured, ifc->rx_entered));
+	lat_record(&ifc->lat[kind][LAT_HANDLER], lat_since(ifc->rx_entered, lp->queued));
+}
+
+
+/*
+ * finish timing the responses that were just flushed
+ */
+void trace_flushed(iface_t *ifc)
+{
+	u_int64_t now = lat_clock();
+	u_int32_t i;
+
+	state_lock();
+	for (i = 0; i < ifc->lat_npending; i++) {
+		lat_pending_t *lp = &ifc->lat_pending[i];
+
+		lat_record(&ifc->lat[lp->kind][LAT_FLUSH], lat_since(lp->queued, now));
+		lat_record(&ifc->lat[lp->kind][LAT_TOTAL], lat_since(lp->captured, now));
+	}
+	state_unlock();
+	ifc->lat_npending = 0;
+}
+
+
+/*
+ * print the response latency histograms, summed over every interface
+ */
+void dump_latency(void)
+{
+	static const char *kinds[LAT_KINDS] = { "probe", "auth", "assoc" };
+	static const char *stages[LAT_STAGES] = {
+		"capture->handler", "handler->queued", "queued->flushed", "total"
+	};
+	static lat_hist_t sum[LAT_KINDS][LAT_STAGES];
+	char label[64];
+	u_int32_t i, k, j, shown = 0;
+
+	memset(sum, 0, sizeof(sum));
+	state_lock();
+	for (i = 0; i < g_num_ifaces; i++)
+		for (k = 0; k < LAT_KINDS; k++)
+			for (j = 0; j < LAT_STAGES; j++)
+				lat_merge(&sum[k][j], &g_ifaces[i].lat[k][j]);
+	state_unlock();
+
+	printf("%-32s %10s %9s %9s %9s %9s %9s %9s %9s\n", "[*] Response latency (us):",
+			"count", "min", "mean", "p50", "p90", "p99", "p99.9", "max");
+	for (k = 0; k < LAT_KINDS; k++) {
+		if (!sum[k][LAT_CAPTURE].count)
+			continue;
+		for (j = 0; j < LAT_STAGES; j++) {
+			snprintf(label, sizeof(label), "[*]   %s %s", kinds[k], stages[j]);
+			lat_print(stdout, label, &sum[k][j]);
+		}
+		shown++;
+	}
+	if (!shown)
+		printf("[*]   nothing answered yet\n");
+	fflush(stdout);
+}
+
+
+/*
+ * create the shared statistics page, with everything that never changes
+ *
+ * on success, we return 1, on failure, 0
+ */
+int start_stats_page(void)
+{
+	static const char *state_names[SHM_STATS_STATES] = {
+		"awaiting probe", "sent probe resp", "sent auth", "sent assoc resp", "established"
+	};
+	u_int32_t i, j;
+
+	if (!(g_shm = shmstats_create(g_stats_path)))
+		return 0;
+
+	for (i = 0; i < 4; i++) {
+		snprintf(g_shm->type_names[i], sizeof(g_shm->type_names[i]), "%s", dot11_types[i]);
+		for (j = 0; j < 16; j++)
+			snprintf(g_shm->subtype_names[i][j], sizeof(g_shm->subtype_names[i][j]), "%s",
+					dot11_subtypes[i][j]);
+	}
+	for (i = 0; i < SHM_STATS_STATES; i++)
+		snprintf(g_shm->state_names[i], sizeof(g_shm->state_names[i]), "%s", state_names[i]);
+	for (i = 0; i < g_num_ifaces; i++)
+		snprintf(g_shm->ifaces[i].name, sizeof(g_shm->ifaces[i].name), "%s", g_ifaces[i].name);
+	g_shm->global.num_ifaces = g_num_ifaces;
+
+	shmstats_ready(g_shm);
+	printf("[*] Keeping statistics in \"%s\"\n", g_stats_path);
+	return 1;
+}
+
+
+/*
+ * copy an interface's counters where other threads can read them, at most
+ * once per ms: its summary for the stats line, and the statistics page. the
+ * main thread looks after the page's global block too
+ */
+void publish_stats(iface_t *ifc)
+{
+	iface_summary_t *s = &ifc->summary;
+	shm_iface_stats_t *b;
+	shm_global_stats_t *g;
+	struct pcap_stat ps;
+	u_int32_t states[SHM_STATS_STATES], stations;
+	u_int64_t now, pipe_drops, tx_errors;
+
+	if ((now = now_ms()) == ifc->published)
+		return;
+	ifc->published = now;
+
+	/* in pipeline mode, these are counted by the capture and transmit
+	 * threads */
+	pipe_drops = __atomic_load_n(&ifc->pipe.rx_drops, __ATOMIC_RELAXED) + ifc->pipe.tx_drops;
+	tx_errors = g_use_pipeline ? __atomic_load_n(&ifc->tx_wire.errors, __ATOMIC_RELAXED) : ifc->tx.errors;
+
+	shm_write_begin(&s->seq);
+	s->channel = ifc->channel;
+	s->rx_frames = ifc->rx_frames;
+	s->rx_bad_fcs = ifc->rx_bad_fcs;
+	s->rx_dups = ifc->rx_dups;
+	s->tx_frames = ifc->tx.frames;
+	s->tx_retransmits = ifc->tx_retransmits;
+	s->tx_errors = ifc->tx.errors;
+	s->tx_flushes = ifc->tx.flushes;
+	s->tx_max_batch = ifc->tx.max_batch;
+	s->beacons = ifc->beacon_stats;
+	s->switches = ifc->chan.switches;
+	s->switch_failures = ifc->chan.failures;
+	s->switch_ns = ifc->chan.switch_ns;
+	s->bridge_dropped = ifc->bridge_dropped;
+	s->decoded = ifc->dec.frames;
+	s->decode_dropped = ifc->dec.dropped;
+	s->pipe_rx_frames = __atomic_load_n(&ifc->pipe.rx_frames, __ATOMIC_RELAXED);
+	s->pipe_rx_drops = __atomic_load_n(&ifc->pipe.rx_drops, __ATOMIC_RELAXED);
+	s->pipe_tx_frames = __atomic_load_n(&ifc->pipe.tx_frames, __ATOMIC_RELAXED);
+	s->pipe_tx_drops = ifc->pipe.tx_drops;
+	s->pipe_tx_errors = __atomic_load_n(&ifc->tx_wire.errors, __ATOMIC_RELAXED);
+	shm_write_end(&s->seq);
+
+	if (!g_shm)
+		return;
+
+	if (now - ifc->published_slow >= SHM_SLOW_INTERVAL) {
+		ifc->published_slow = now;
+
+		/* libpcap's handle belongs to the capture thread in pipeline mode */
+		if (!ifc->pch)
+			ring_drops(&ifc->ring, &ifc->kernel_drops);
+		else if (!g_use_pipeline && !pcap_stats(ifc->pch, &ps))
+			ifc->kernel_drops = (u_int64_t)ps.ps_drop + ps.ps_ifdrop;
+
+		if (ifc->wheel == &g_wheel) {
+			state_lock();
+			stations = sta_count();
+			sta_count_states(states, SHM_STATS_STATES);
+			state_unlock();
+
+			g = &g_shm->global;
+			shm_write_begin(&g->seq);
+			g->updated = now;
+			g->stations = stations;
+			memcpy(g->states, states, sizeof(g->states));
+			g->events_dropped = evlog_dropped();
+			shm_write_end(&g->seq);
+		}
+	}
+
+	b = &g_shm->ifaces[ifc - g_ifaces];
+	shm_write_begin(&b->seq);
+	b->channel = ifc->channel;
+	memcpy(b->frames, ifc->frames, sizeof(b->frames));
+	b->rx_frames = ifc->rx_frames;
+	b->rx_bad_fcs = ifc->rx_bad_fcs;
+	b->rx_dups = ifc->rx_dups;
+	b->rx_malformed = ifc->rx_malformed;
+	b->rx_ie_truncated = ifc->rx_ie_truncated;
+	b->kernel_drops = ifc->kernel_drops;
+	b->pipe_drops = pipe_drops;
+	b->tx_frames = ifc->tx.frames;
+	b->tx_errors = tx_errors;
+	b->tx_retransmits = ifc->tx_retransmits;
+	memcpy(b->tx_sent, ifc->tx_sent, sizeof(b->tx_sent));
+	shm_write_end(&b->seq);
+}
+
+
+/*
+ * one of our networks has a TBTT coming up (or just gone). the beacon goes
+ * out from send_beacons(), since waiting for the TBTT here would hold the
+ * state lock
+ */
+void beacon_timer(tw_timer_t *t, void *arg)
+{
+	iface_t *ifc = arg;
+
+	ifc->beacons_due |= 1U << (t - ifc->beacon_timers);
+}
+
+
+/*
+ * announce the networks whose beacon timers went off, each as close to its
+ * TBTT as we can, and set their timers for the next one. called without the
+ * state lock held
+ */
+void send_beacons(iface_t *ifc)
+{
+	u_int64_t interval = TU_TO_USEC(BEACON_INTERVAL), tbtt, tsf, missed;
+	u_int32_t i, j;
+
+	while (ifc->beacons_due) {
+		/* the earliest TBTT first */
+		j = __builtin_ctz(ifc->beacons_due);
+		for (i = j + 1; i < bss_count(); i++) {
+			if ((ifc->beacons_due & (1U << i)) && ifc->next_tbtt[i] < ifc->next_tbtt[j])
+				j = i;
+		}
+		ifc->beacons_due &= ~(1U << j);
+
+		tbtt = ifc->next_tbtt[j];
+		wait_until_us(tsf_to_clock(tbtt));
+		tsf = tsf_get(now_us());
+
+		/* if we slept through whole intervals, those beacons are gone */
+		missed = 0;
+		if (tsf - tbtt >= interval) {
+			missed = (tsf - tbtt) / interval;
+			tbtt += missed * interval;
+		}
+		tbtt_record(&ifc->beacon_stats, tsf - tbtt, missed);
+
+#ifdef DEBUG_BEACON_INTERVAL
+		printf("[*] beacon due at TSF %llu, sending at %llu\n",
+				(unsigned long long)tbtt, (unsigned long long)tsf);
+#endif
+		send_beacon(bss_get(j)); /* treat errors as warnings */
+
+		/* schedule from the TBTT rather than now so we don't drift */
+		ifc->next_tbtt[j] = tbtt + interval;
+		state_lock();
+		tw_add(ifc->wheel, &ifc->beacon_timers[j], tsf_to_clock(ifc->next_tbtt[j]) / 1000);
+		state_unlock();
+	}
+}
+
+
+/*
+ * time to move on to the next channel on an interface's schedule. the switch
+ * is a round-trip to the kernel, so it's left to hop_channel(), which runs
+ * once the state lock is released
+ */
+void hop_timer(tw_timer_t *t, void *arg)
+{
+	iface_t *ifc = arg;
+
+	ifc->hop_due = 1;
+}
+
+
+/*
+ * switch an interface to the next channel on its schedule, and set the timer
+ * for the one after. called without the state lock held
+ */
+void hop_channel(iface_t *ifc)
+{
+	tw_timer_t *t = &ifc->hop_timer;
+
+	ifc->hop_due = 0;
+	ifc->hop = (ifc->hop + 1) % ifc->sched.num;
+
+	/* if the card won't go there, just wait for the next one */
+	set_channel(ifc, ifc->sched.channels[ifc->hop]);
+
+	/* schedule from the deadline rather than now so we don't drift */
+	state_lock();
+	tw_add(ifc->wheel, t, t->expires + ifc->sched.dwell[ifc->hop]);
+	state_unlock();
+}
+
+
+/*
+ * periodically dump our counters, summed over every interface. the others
+ * belong to their workers, so we go by the summaries they publish
+ */
+void stats_timer(tw_timer_t *t, void *arg)
+{
+	u_int64_t rx = 0, bad_fcs = 0, dups = 0, tx = 0, retransmits = 0, errors = 0, flushes = 0;
+	u_int64_t bridge_dropped = 0, decoded = 0, decode_dropped = 0;
+	iface_summary_t sums[IFACE_MAX];
+	tbtt_stats_t beacons = { 0 };
+	u_int32_t i, max_batch = 0;
+
+	for (i = 0; i < g_num_ifaces; i++) {
+		iface_summary_t *s = &sums[i];
+
+		shm_read(&g_ifaces[i].summary, s, sizeof(*s));
+		rx += s->rx_frames;
+		bad_fcs += s->rx_bad_fcs;
+		dups += s->rx_dups;
+		tx += s->tx_frames;
+		retransmits += s->tx_retransmits;
+		errors += s->tx_errors;
+		flushes += s->tx_flushes;
+		if (s->tx_max_batch > max_batch)
+			max_batch = s->tx_max_batch;
+		beacons.beacons += s->beacons.beacons;
+		beacons.missed += s->beacons.missed;
+		beacons.late_sum += s->beacons.late_sum;
+		if (s->beacons.late_max > beacons.late_max)
+			beacons.late_max = s->beacons.late_max;
+		bridge_dropped += s->bridge_dropped;
+		decoded += s->decoded;
+		decode_dropped += s->decode_dropped;
+	}
+
+	printf("[*] Stats: rx:%llu (bad fcs:%llu dups:%llu) tx:%llu retransmits:%llu errors:%llu flushes:%llu (avg %.1f, max %u frames) stations:%u events dropped:%llu\n",
+			(unsigned long long)rx,
+			(unsigned long long)bad_fcs,
+			(unsigned long long)dups,
+			(unsigned long long)tx,
+			(unsigned long long)retransmits,
+			(unsigned long long)errors,
+			(unsigned long long)flushes,
+			flushes ? (double)tx / flushes : 0.0,
+			max_batch,
+			sta_count(),
+			(unsigned long long)evlog_dropped());
+	if (g_send_beacons)
+		printf("[*] Beacons: sent:%llu missed tbtts:%llu late avg:%.1f us max:%llu us\n",
+				(unsigned long long)beacons.beacons,
+				(unsigned long long)beacons.missed,
+				beacons.beacons ? (double)beacons.late_sum / beacons.beacons : 0.0,
+				(unsigned long long)beacons.late_max);
+	if (g_tap.fd != -1)
+		printf("[*] Bridge: to host:%llu (write errors:%llu) from host:%llu dropped:%llu\n",
+				(unsigned long long)g_tap.tx_frames,
+				(unsigned long long)g_tap.tx_errors,
+				(unsigned long long)g_tap.rx_frames,
+				(unsigned long long)bridge_dropped);
+	if (g_decode)
+		printf("[*] Decoder: frames:%llu dropped:%llu\n",
+				(unsigned long long)decoded, (unsigned long long)decode_dropped);
+	if (g_record_file)
+		printf("[*] Recorder: frames:%llu dropped:%llu files:%u\n",
+				(unsigned long long)rec_written(),
+				(unsigned long long)rec_dropped(), rec_files());
+
+	for (i = 0; i < g_num_ifaces; i++) {
+		iface_t *ifc = &g_ifaces[i];
+		iface_summary_t *s = &sums[i];
+
+		if (g_num_ifaces > 1)
+			printf("[*]   %s (channel %u): rx:%llu tx:%llu retransmits:%llu\n",
+					ifc->name, s->channel,
+					(unsigned long long)s->rx_frames,
+					(unsigned long long)s->tx_frames,
+					(unsigned long long)s->tx_retransmits);
+		if (ifc->sched.num > 1)
+			printf("[*]   %s hopping over %u channels: switches:%llu failed:%llu (avg %.1f us)\n",
+					ifc->name, ifc->sched.num,
+					(unsigned long long)s->switches,
+					(unsigned long long)s->switch_failures,
+					s->switches + s->switch_failures ?
+					s->switch_ns / 1000.0 / (s->switches + s->switch_failures) : 0.0);
+		if (g_use_pipeline)
+			printf("[*] Pipeline: captured:%llu dropped:%llu sent:%llu tx dropped:%llu tx errors:%llu\n",
+					(unsigned long long)s->pipe_rx_frames,
+					(unsigned long long)s->pipe_rx_drops,
+					(unsigned long long)s->pipe_tx_frames,
+					(unsigned long long)s->pipe_tx_drops,
+					(unsigned long long)s->pipe_tx_errors);
+	}
+	fflush(stdout);
+
+	tw_add(&g_wheel, t, t->expires + g_stats_interval * 1000);
+}
+
+
+/*
+ * re-send the last response to a station
+ */
+void retransmit_timer(tw_timer_t *t, void *arg)
+{
+	station_t *sta = arg;
+	dot11_frame_t *d11;
+	bss_t *bss;
+
+	if (!sta->pkt_len || !sta->retransmits_left)
+		return;
+
+	/* probe responses say when they went out */
+	d11 = (dot11_frame_t *)(sta->pkt + ((radiotap_t *)sta->pkt)->it_len);
+	if (d11->type == T_MGMT && d11->subtype == ST_PROBE_RESP && (bss = bss_by_addr(d11->bssid)))
+		stamp_tsf(sta->pkt, bss);
+
+#ifdef DEBUG_RETRANSMIT
+	printf("[*] (%s) Re-transmitting...\n", mac_string(sta->mac));
+#endif
+	g_cur->tx_retransmits++;
+	if (!tx_send(&g_cur->tx, sta->pkt, sta->pkt_len)) {
+		fprintf(stderr, "[!] Unable to re-send packet!\n");
+		/* just try again later */
+	}
+
+	if (--sta->retransmits_left)
+		tw_add(sta->retransmit_wheel, t, t->expires + RETRANSMIT_INTERVAL);
+}
+
+
+/*
+ * try to start capturing packets from the specified interface (a wireless card
+ * in monitor mode)
+ *
+ * on succes, we return 1, on failure, 0
+ */
+int start_pcap(iface_t *ifc)
+{
+	char errorstr[PCAP_ERRBUF_SIZE];
+	pcap_t **pcap = &ifc->pch;
+	int datalink;
+
+	printf("[*] Starting capture on \"%s\" ...\n", ifc->name);
+
+	*pcap = pcap_open_live(ifc->name, SNAPLEN, 8, 25, errorstr);
+	if (*pcap == (pcap_t *)NULL) {
+		fprintf(stderr, "[!] pcap_open_live() failed: %s\n", errorstr);
+		return 0;
+	}
+
+	/* the event loop tells us when there is something to read */
+	if (pcap_setnonblock(*pcap, 1, errorstr) == -1) {
+		fprintf(stderr, "[!] pcap_setnonblock() failed: %s\n", errorstr);
+		return 0;
+	}
+
+	datalink = pcap_datalink(*pcap);
+	switch (datalink) {
+		case DLT_IEEE802_11_RADIO:
+			break;
+
+		default:
+			fprintf(stderr, "[!] Unknown datalink for interface \"%s\": %d\n",
+					ifc->name, datalink);
+			fprintf(stderr, "    Only RADIOTAP is currently supported.\n");
+			return 0;
+	}
+
+	return 1;
+}
+
+
+/*
+ * open the replay input (and output) files
+ *
+ * on succes, we return 1, on failure, 0
+ */
+int start_replay(pcap_t **pcap)
+{
+	char errorstr[PCAP_ERRBUF_SIZE];
+	pcap_t *dead;
+
+	if (!memcmp(g_bssid, "\x00\x00\x00\x00\x00\x00", ETH_ALEN)) {
+		fprintf(stderr, "[!] There is no interface to get a mac address from, use -m\n");
+		return 0;
+	}
+
+	*pcap = pcap_open_offline(g_replay_in, errorstr);
+	if (*pcap == (pcap_t *)NULL) {
+		fprintf(stderr, "[!] pcap_open_offline() failed: %s\n", errorstr);
+		return 0;
+	}
+
+	if (pcap_datalink(*pcap) != DLT_IEEE802_11_RADIO) {
+		fprintf(stderr, "[!] Unknown datalink for \"%s\": %d\n",
+				g_replay_in, pcap_datalink(*pcap));
+		fprintf(stderr, "    Only RADIOTAP is currently supported.\n");
+		return 0;
+	}
+
+	if (g_replay_out) {
+		dead = pcap_open_dead(DLT_IEEE802_11_RADIO, SNAPLEN);
+		if (!dead || !(g_dumper = pcap_dump_open(dead, g_replay_out))) {
+			fprintf(stderr, "[!] Unable to open \"%s\" for writing: %s\n",
+					g_replay_out, dead ? pcap_geterr(dead) : "out of memory");
+			return 0;
+		}
+		pcap_close(dead);
+	}
+
+	/* there's no card, but hopping still changes what our beacons say */
+	bss_set_base(g_bssid);
+	cl_setup();
+	if (!chan_open(&g_ifaces[0].chan, &chan_mock, g_ifaces[0].name)
+			|| !set_channel(&g_ifaces[0], g_ifaces[0].sched.channels[0]))
+		return 0;
+
+	/* everything we "send" ends up in the output file */
+	return tx_setup_sink(&g_ifaces[0].tx, replay_sink, NULL);
+}
+
+
+/*
+ * open the TAP for the data-plane bridge
+ *
+ * on succes, we return 1, on failure, 0
+ */
+int start_bridge(void)
+{
+	u_int32_t i;
+
+	if (!tap_open(&g_tap, g_tap_name))
+		return 0;
+
+	/* the main thread reads the TAP, the other workers get their
+	 * stations' frames from it through a queue */
+	for (i = 1; i < g_num_ifaces; i++) {
+		if (!tap_queue_init(&g_ifaces[i].bridge_q))
+			return 0;
+	}
+	printf("[*] Bridging data frames to \"%s\"\n", g_tap.name);
+	return 1;
+}
+
+
+/*
+ * close the TAP, once the workers are gone
+ */
+void stop_bridge(void)
+{
+	u_int32_t i;
+
+	if (g_tap.fd == -1)
+		return;
+	for (i = 1; i < g_num_ifaces; i++)
+		tap_queue_free(&g_ifaces[i].bridge_q);
+	tap_close(&g_tap);
+}
+
+
+/*
+ * open the output for -d, and a decoder for each interface's worker
+ *
+ * on succes, we return 1, on failure, 0
+ */
+int start_decoders(void)
+{
+	struct stat st;
+	u_int32_t i;
+	int fd;
+
+	if (!g_decode)
+		return 1;
+
+	/* a FIFO's reader falling behind costs decoded frames, not captured
+	 * ones. opening it still waits for the reader to show up */
+	if (g_decode_file) {
+		if ((g_decode_fd = open(g_decode_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1
+				|| fcntl(g_decode_fd, F_SETFL, O_NONBLOCK) == -1) {
+			fprintf(stderr, "[!] Unable to open \"%s\" for writing: %s\n",
+					g_decode_file, strerror(errno));
+			return 0;
+		}
+	}
+
+	/* the same goes for stdout into a pipe or a terminal. it's shared with
+	 * everything else we print, so rather than make it non-blocking for
+	 * all of them, open it again for the decoders alone. a file or socket
+	 * can still hold us up, and so can anything while replaying, where
+	 * there's nothing to capture and every frame should be shown */
+	else if (!g_replay_in && fstat(STDOUT_FILENO, &st) == 0
+			&& (S_ISFIFO(st.st_mode) || S_ISCHR(st.st_mode))) {
+		if ((fd = open("/proc/self/fd/1", O_WRONLY | O_NONBLOCK | O_CLOEXEC)) == -1)
+			perror("[-] Unable to reopen stdout, decoding may hold up capture");
+		else
+			g_decode_fd = fd;
+	}
+
+	dc_out_init(&g_decode_out, g_decode_fd);
+	for (i = 0; i < g_num_ifaces; i++) {
+		if (!dc_open(&g_ifaces[i].dec, &g_decode_out, g_decode))
+			return 0;
+	}
+	return 1;
+}
+
+
+/*
+ * write out whatever is left to decode and close up
+ */
+void stop_decoders(void)
+{
+	u_int32_t i;
+
+	if (!g_decode)
+		return;
+
+	for (i = 0; i < g_num_ifaces; i++)
+		dc_close(&g_ifaces[i].dec);
+	if (g_decode_fd != STDOUT_FILENO && g_decode_fd != -1)
+		close(g_decode_fd);
+	g_decode_fd = -1;
+}
+
+
+/*
+ * start recording to the -W file(s), and have every interface's transmit ring
+ * show us what it sends
+ *
+ * on succes, we return 1, on failure, 0
+ */
+int start_recorder(void)
+{
+	const char *names[IFACE_MAX];
+	u_int32_t i;
+
+	if (!g_record_file)
+		return 1;
+
+	for (i = 0; i < g_num_ifaces; i++)
+		names[i] = g_ifaces[i].name;
+	if (!rec_start(g_record_file, g_record_bytes, g_record_secs, names, g_num_ifaces))
+		return 0;
+
+	/* with -t that's the ring feeding the transmit thread, so each frame
+	 * is only seen once */
+	for (i = 0; i < g_num_ifaces; i++) {
+		g_ifaces[i].tx.record = record_tx;
+		g_ifaces[i].tx.record_arg = &g_ifaces[i];
+	}
+	printf("[*] Recording frames to \"%s\"\n", g_record_file);
+	return 1;
+}
+
+
+/*
+ * write out what's left to record and say how it went
+ */
+void stop_recorder(void)
+{
+	if (!g_record_file)
+		return;
 
-	return 1;
+	rec_stop();
+	printf("[*] Recorded %llu frames to %u file(s), dropped %llu\n",
+			(unsigned long long)rec_written(), rec_files(),
+			(unsigned long long)rec_dropped());
 }
 
 
 /*
- * try to start capturing packets from the specified interface (a wireless card
- * in monitor mode)
- *
- * on succes, we return 1, on failure, 0
+ * when a frame we're recording was captured (ns) - the replay clock if we're
+ * replaying, or now if the capture didn't say
  */
-int start_pcap(pcap_t **pcap)
+u_int64_t record_time(u_int64_t ts)
 {
-	char errorstr[PCAP_ERRBUF_SIZE];
-	int datalink;
-
-	printf("[*] Starting capture on \"%s\" ...\n", g_iface);
-
-	*pcap = pcap_open_live(g_iface, SNAPLEN, 8, 25, errorstr);
-	if (*pcap == (pcap_t *)NULL) {
-		fprintf(stderr, "[!] pcap_open_live() failed: %s\n", errorstr);
-		return 0;
-	}
+	if (g_replay_in)
+		return g_replay_us * 1000;
+	return ts ? ts : lat_clock();
+}
 
-	datalink = pcap_datalink(*pcap);
-	switch (datalink) {
-		case DLT_IEEE802_11_RADIO:
-			break;
 
-		default:
-			fprintf(stderr, "[!] Unknown datalink for interface \"%s\": %d\n",
-					g_iface, datalink);
-			fprintf(stderr, "    Only RADIOTAP is currently supported.\n");
-			return 0;
-	}
+/*
+ * a transmit ring's record hook, called once a batch has been sent
+ */
+void record_tx(const u_int8_t *frame, u_int32_t len, void *arg)
+{
+	iface_t *ifc = arg;
 
-	return 1;
+	rec_frame(ifc - g_ifaces, REC_TX, record_time(0), frame, len);
 }
 
 
 /*
  * open a raw socket that we can use to send raw 802.11 frames
+ *
+ * proto (network byte order) selects what it receives - 0 means nothing
  */
-int open_raw_socket(void)
+int open_raw_socket(iface_t *ifc, u_int16_t proto)
 {
 	int sock;
 	struct sockaddr_ll la;
 	struct ifreq ifr;
 
-	sock = socket(PF_PACKET, SOCK_RAW, ETH_P_ALL);
+	sock = socket(PF_PACKET, SOCK_RAW, proto);
 	if (sock == -1) {
 		perror("[!] Unable to open raw socket");
 		return -1;
@@ -523,11 +2484,12 @@ int open_raw_socket(void)
 	/* build the link-level address struct for binding */
 	memset(&la, 0, sizeof(la));
 	la.sll_family = AF_PACKET;
+	la.sll_protocol = proto;
 	la.sll_halen = ETH_ALEN;
 
 	/* get the interface index */
 	memset(&ifr, 0, sizeof(ifr));
-	strncpy(ifr.ifr_name, g_iface, IFNAMSIZ);
+	strncpy(ifr.ifr_name, ifc->name, IFNAMSIZ);
 	if (ioctl(sock, SIOCGIFINDEX, &ifr) < 0) {
 		perror("[!] Unable to get interface index");
 		close(sock);
@@ -568,15 +2530,18 @@ int open_raw_socket(void)
 
 
 /*
- * set the channel of the wireless card
+ * tune an interface's card to a channel
+ *
+ * on success, we return 1, on failure, 0
  */
-int set_channel(void)
+int set_channel(iface_t *ifc, u_int8_t channel)
 {
-	char cmd[256] = { 0 };
-
-	snprintf(cmd, sizeof(cmd) - 1, "iwconfig %s channel %d", g_iface, g_channel);
-	if (system(cmd))
+	if (!chan_set(&ifc->chan, channel))
 		return 0;
+
+	/* the channel is in our beacons */
+	ifc->channel = channel;
+	build_templates(ifc);
 	return 1;
 }
 
@@ -584,39 +2549,32 @@ int set_channel(void)
 /*
  * process the radiotap header
  */
-int process_radiotap(const u_char **ppkt, u_int32_t *pleft)
+int process_radiotap(const u_char **ppkt, u_int32_t *pleft, rt_meta_t *meta)
 {
-	const u_char *p = *ppkt;
-	radiotap_t *prt = (radiotap_t *)p;
-#ifdef DEBUG_RADIOTAP_PRESENT
-	int idx = 0;
-	u_int32_t *pu = &prt->it_present;
-#endif
-
-	if (*pleft < sizeof(radiotap_t)) {
-		fprintf(stderr, "[!] Packet doesn't have enough data for a radiotap header?!\n");
+	if (!radiotap_parse(*ppkt, *pleft, meta)) {
+		fprintf(stderr, "[!] Malformed radiotap header!\n");
 		return 0;
 	}
 
 #ifdef DEBUG_RADIOTAP
-	printf("[*] got RADIOTAP packet - ver:%u pad:%u len:%u\n",
-			prt->it_version, prt->it_pad, prt->it_len);
+	printf("[*] got RADIOTAP packet - len:%u flags:0x%x rate:%u freq:%u signal:%d noise:%d\n",
+			meta->len, meta->flags, meta->rate, meta->freq, meta->signal, meta->noise);
 #endif
-	if (*pleft <= prt->it_len) {
+	if (*pleft <= meta->len) {
 		fprintf(stderr, "[!] Packet is too small to contain the radiotap header and data\n");
 		return 0;
 	}
 
-#ifdef DEBUG_RADIOTAP_PRESENT
-	printf("    present[%u]: 0x%lx\n", idx, (ulong)prt->it_present);
-	while (prt->it_present & 0x1) {
-		++idx;
-		printf("    present[%u]: 0x%lx\n", idx, (ulong)pu[idx]);
-	}
-#endif
+	*ppkt += meta->len;
+	*pleft -= meta->len;
 
-	*ppkt = p + prt->it_len;
-	*pleft -= prt->it_len;
+	/* we don't want the FCS looking like part of the frame body. when the
+	 * kernel filter cut a data frame short, it left room for it */
+	if (RT_HAVE(meta, FLAGS) && (meta->flags & IEEE80211_RADIOTAP_F_FCS)) {
+		if (*pleft < RT_FCS_LEN)
+			return 0;
+		*pleft -= RT_FCS_LEN;
+	}
 
 	return 1;
 }
@@ -628,8 +2586,10 @@ int process_radiotap(const u_char **ppkt, u_int32_t *pleft)
 dot11_frame_t *get_dot11_frame(const u_char **ppkt, u_int32_t *pleft)
 {
 	const u_char *p = *ppkt;
+	u_int32_t len;
 
-	if (*pleft < sizeof(dot11_frame_t)) {
+	if (*pleft < sizeof(dot11_frame_t)
+			|| *pleft < (len = dot11_hdr_len((dot11_frame_t *)p))) {
 #ifdef DEBUG_DOT11_SHORT_PKTS
 		fprintf(stderr, "[-] Not enough data for 802.11 frame header (bytes left: %u)!\n", *pleft);
 		hexdump(p, *pleft);
@@ -637,8 +2597,8 @@ dot11_frame_t *get_dot11_frame(const u_char **ppkt, u_int32_t *pleft)
 		return NULL;
 	}
 
-	*ppkt = p + sizeof(dot11_frame_t);
-	*pleft -= sizeof(dot11_frame_t);
+	*ppkt = p + len;
+	*pleft -= len;
 
 	return (dot11_frame_t *)p;
 }
@@ -647,34 +2607,36 @@ dot11_frame_t *get_dot11_frame(const u_char **ppkt, u_int32_t *pleft)
 /*
  * process an 802.11 probe request
  */
-int process_probe_request(dot11_frame_t *d11, const u_char *data, u_int32_t left)
+int process_probe_request(dot11_frame_t *d11, ie_index_t *ies, u_int64_t now)
 {
 	ie_t *ie;
-	char ssid_req[32] = { 0 };
+	station_t *sta;
+	bss_t *bss;
+	u_int32_t i;
 
-	if (!(ie = get_ssid_ie(data, left))) {
-		fprintf(stderr, "[-] Probe request with no SSID encountered!\n");
+	if (!(ie = ie_get(ies, IEID_SSID))) {
+		ev_log(EV_PROBE_NO_SSID, now, d11->src_mac, 0, 0, 0);
 		return 1; /* just a warning */
 	}
 
-	/* the ssid might be empty, or might be too long */
-	if (ie->len > 0)
-		strcpy(ssid_req, ssid_string(ie));
-
 	/* there are broadcast and unicast probe requests... */
-	if (!memcmp(d11->dst_mac, g_bssid, ETH_ALEN)) {
+	if ((bss = bss_by_addr(d11->dst_mac))) {
 		/* for us!? */
 #ifndef DONT_CHECK_SSID_ON_UNICAST
-		if (!strcmp(ssid_req, (char *)g_ssid)) {
-			printf("[*] (%s) Probe request for our BSSID and SSID, replying...\n", mac_string(d11->src_mac));
-			g_state = S_SENT_PROBE_RESP;
-			if (!send_probe_response(d11->src_mac))
+		if (bss_ssid_is(bss, ie->data, ie->len)) {
+			ev_log(EV_PROBE_DIRECTED, now, d11->src_mac, 1, 0, 0);
+			if (!(sta = sta_get(d11->src_mac, now)))
+				return 1;
+			sta->state = S_SENT_PROBE_RESP;
+			if (!send_probe_response(sta, bss))
 				return 1; /* treat send errors as a warning */
 		}
 #else
-		printf("[*] (%s) Probe request for our BSSID, replying...\n", mac_string(d11->src_mac));
-		g_state = S_SENT_PROBE_RESP;
-		if (!send_probe_response(d11->src_mac))
+		ev_log(EV_PROBE_DIRECTED, now, d11->src_mac, 0, 0, 0);
+		if (!(sta = sta_get(d11->src_mac, now)))
+			return 1;
+		sta->state = S_SENT_PROBE_RESP;
+		if (!send_probe_response(sta, bss))
 			return 1; /* treat send errors as a warning */
 #endif
 	} else if (!memcmp(d11->dst_mac, IEEE80211_BROADCAST_ADDR, ETH_ALEN)) {
@@ -682,25 +2644,28 @@ int process_probe_request(dot11_frame_t *d11, const u_char *data, u_int32_t left
 		/* NOTE: this is the active-scan equivalent of a beacon -- no state change here */
 		if (ie && ie->len > 0) {
 			/* we must check the SSID on broadcast probes */
-			if (!strcmp(ssid_req, (char *)g_ssid)) {
-				printf("[*] (%s) Broadcast probe request for our SSID \"%s\" received, replying...\n", mac_string(d11->src_mac), ssid_req);
-				if (!send_probe_response(d11->src_mac))
+			if ((bss = bss_by_ssid(ie->data, ie->len))) {
+				ev_log_ssid(EV_PROBE_OURS, now, d11->src_mac, ie->data, ie->len, 0, 0);
+				if (!(sta = sta_get(d11->src_mac, now)))
+					return 1;
+				if (!send_probe_response(sta, bss))
 					return 1; /* treat send errors as a warning */
 			} else {
-				printf("[*] (%s) Broadcast probe request for \"%s\" received, NOT replying...\n", mac_string(d11->src_mac), ssid_req);
+				ev_log_ssid(EV_PROBE_OTHER, now, d11->src_mac, ie->data, ie->len, 0, 0);
 			}
 		} else {
-			printf("[*] (%s) Broadcast probe request received, replying...\n", mac_string(d11->src_mac));
-			if (!send_probe_response(d11->src_mac))
-				return 1; /* treat send errors as a warning */
+			/* every network answers a wildcard probe */
+			ev_log(EV_PROBE_WILDCARD, now, d11->src_mac, 0, 0, 0);
+			if (!(sta = sta_get(d11->src_mac, now)))
+				return 1;
+			for (i = 0; i < bss_count(); i++) {
+				if (!send_probe_response(sta, bss_get(i)))
+					return 1; /* treat send errors as a warning */
+			}
 		}
 	} /* mac check */
 	else {
-		if (ie->len > 0) {
-			printf("[*] (%s) Unhandled probe request for SSID (%u bytes): \"%s\"\n", mac_string(d11->src_mac), ie->len, ssid_req);
-		} else {
-			printf("[*] (%s) Unhandled probe request for empty SSID\n", mac_string(d11->src_mac));
-		}
+		ev_log_ssid(EV_PROBE_UNHANDLED, now, d11->src_mac, ie->data, ie->len, ie->len, 0);
 	}
 	return 1;
 }
@@ -709,26 +2674,29 @@ int process_probe_request(dot11_frame_t *d11, const u_char *data, u_int32_t left
 /*
  * process an 802.11 authentication request
  */
-int process_auth_request(dot11_frame_t *d11, const u_char *data, u_int32_t left)
+int process_auth_request(dot11_frame_t *d11, bss_t *bss, const u_char *data, u_int32_t left, u_int64_t now)
 {
 	auth_t *auth;
+	station_t *sta;
 
 	if (left < sizeof(auth_t)) {
-		fprintf(stderr, "[-] (%s) Auth request without parameters!\n", mac_string(d11->src_mac));
+		ev_log(EV_AUTH_SHORT, now, d11->src_mac, 0, 0, 0);
 		return 1;
 	}
 
 	auth = (auth_t *)data;
 	if (auth->seq != 1) {
-		fprintf(stderr, "[-] Authentication sequence is not 0x0001 !!\n");
+		ev_log(EV_AUTH_BAD_SEQ, now, d11->src_mac, 0, auth->seq, 0);
 	}
 
-	printf("[*] (%s) Auth request received (alg:0x%x, seq:%u, status:%u), replying...\n",
-			mac_string(d11->src_mac),
-			auth->algorithm, auth->seq, auth->status);
+	ev_log(EV_AUTH, now, d11->src_mac, auth->algorithm, auth->seq, auth->status);
 
-	g_state = S_SENT_AUTH;
-	if (!send_auth_response(d11->src_mac))
+	if (!(sta = sta_get(d11->src_mac, now)))
+		return 1;
+	sta->state = S_SENT_AUTH;
+	sta->bss = bss->index;
+	sta->iface = g_cur - g_ifaces;
+	if (!send_auth_response(sta, bss))
 		return 1; /* treat send errors as a warning */
 
 	return 1;
@@ -738,33 +2706,29 @@ int process_auth_request(dot11_frame_t *d11, const u_char *data, u_int32_t left)
 /*
  * process an 802.11 association request destined for us
  */
-int process_assoc_request(dot11_frame_t *d11, const u_char *data, u_int32_t left)
+int process_assoc_request(dot11_frame_t *d11, bss_t *bss, const u_char *data, u_int32_t left, ie_index_t *ies, u_int64_t now)
 {
 	assoc_req_t *assoc;
+	station_t *sta;
 	ie_t *ie;
 
 	if (left < sizeof(assoc_req_t)) {
-		fprintf(stderr, "[-] (%s) Association request without parameters!\n", mac_string(d11->src_mac));
+		ev_log(EV_ASSOC_SHORT, now, d11->src_mac, 0, 0, 0);
 		return 1;
 	}
 	assoc = (assoc_req_t *)data;
 
-	data += sizeof(assoc_req_t);
-	left -= sizeof(assoc_req_t);
-
-	if (!(ie = get_ssid_ie(data, left))) {
-		printf("[*] (%s) Association request without SSID received (caps:0x%x, interval: %u), replying...\n",
-				mac_string(d11->src_mac),
-				assoc->caps, assoc->interval);
-	} else {
-		printf("[*] (%s) Association request for \"%s\" received (caps:0x%x, interval: %u), replying...\n",
-				mac_string(d11->src_mac),
-				ssid_string(ie),
-				assoc->caps, assoc->interval);
-	}
+	if (!(ie = ie_get(ies, IEID_SSID)))
+		ev_log(EV_ASSOC_NO_SSID, now, d11->src_mac, assoc->caps, assoc->interval, 0);
+	else
+		ev_log_ssid(EV_ASSOC, now, d11->src_mac, ie->data, ie->len, assoc->caps, assoc->interval);
 
-	g_state = S_SENT_ASSOC_RESP;
-	if (!send_assoc_response(d11->src_mac))
+	if (!(sta = sta_get(d11->src_mac, now)))
+		return 1;
+	sta->state = S_SENT_ASSOC_RESP;
+	sta->bss = bss->index;
+	sta->iface = g_cur - g_ifaces;
+	if (!send_assoc_response(sta, bss))
 		return 1; /* treat send errors as a warning */
 	return 1;
 }
@@ -772,17 +2736,33 @@ int process_assoc_request(dot11_frame_t *d11, const u_char *data, u_int32_t left
 
 /*
  * send an 802.11 packet with a bunch of re-transmissions for the fuck of it
+ *
+ * the packet was built in a transmit slot. a copy is kept with the station so
+ * we can re-send it if they retry
  */
-int send_packet(dot11_frame_t *d11)
+int send_packet(station_t *sta, u_int8_t *pkt, u_int32_t len)
 {
-	if (send(g_sock, g_pkt, g_pkt_len, 0) == -1) {
-		perror("[!] Unable to send packet!");
-		return 0;
+	dot11_frame_t *d11;
+
+	tx_commit(&g_cur->tx, pkt, len);
+	trace_response(pkt);
+
+	if (len > sizeof(sta->pkt)) {
+		sta->pkt_len = 0;
+		return 1;
 	}
+	memcpy(sta->pkt, pkt, len);
+	sta->pkt_len = len;
 
 	/* set the retransmit flag on the 802.11 header */
+	d11 = (dot11_frame_t *)(sta->pkt + ((radiotap_t *)sta->pkt)->it_len);
 	d11->ctrlflags |= CF_RETRY;
 
+	/* this replaces anything we were still re-sending, even from another
+	 * interface. retries go out wherever we last answered */
+	sta->retransmits_left = RETRANSMIT_COUNT;
+	sta_retransmit_at(sta, g_cur->wheel, g_cur->wheel->now + RETRANSMIT_INTERVAL);
+
 	return 1;
 }
 
@@ -797,6 +2777,7 @@ void fill_radiotap(u_int8_t **ppkt)
 
 	/* fill out the radio tap header */
 	prt->it_version = 0;
+	prt->it_pad = 0;
 	prt->it_len = sizeof(*prt) + 1;
 	prt->it_present = (1 << IEEE80211_RADIOTAP_RATE);
 
@@ -812,7 +2793,7 @@ void fill_radiotap(u_int8_t **ppkt)
 /*
  * fill the 802.11 frame header
  */
-void fill_dot11(u_int8_t **ppkt, u_int8_t type, u_int8_t subtype, u_int8_t *dst_mac)
+void fill_dot11(u_int8_t **ppkt, u_int8_t type, u_int8_t subtype, u_int8_t *dst_mac, u_int8_t *bssid)
 {
 	dot11_frame_t *d11 = (dot11_frame_t *)(*ppkt);
 
@@ -823,9 +2804,9 @@ void fill_dot11(u_int8_t **ppkt, u_int8_t type, u_int8_t subtype, u_int8_t *dst_
 	d11->ctrlflags = 0;
 	d11->duration = 0;
 	memcpy(d11->dst_mac, dst_mac, ETH_ALEN);
-	memcpy(d11->src_mac, g_bssid, ETH_ALEN);
-	memcpy(d11->bssid, g_bssid, ETH_ALEN);
-	d11->seq = get_sequence();
+	memcpy(d11->src_mac, bssid, ETH_ALEN);
+	memcpy(d11->bssid, bssid, ETH_ALEN);
+	d11->seq = 0; /* filled in when sent */
 	d11->frag = 0;
 
 	*ppkt += sizeof(dot11_frame_t);
@@ -853,33 +2834,152 @@ void fill_ie(u_int8_t **ppkt, u_int8_t id, u_int8_t *data, u_int8_t len)
 
 
 /*
- * send a beacon frame to announce our network
+ * build a template that starts with the radiotap and 802.11 headers
  */
-int send_beacon()
+u_int8_t *start_template(template_t *tmpl, u_int8_t subtype, u_int8_t *dst_mac, bss_t *bss)
 {
-	u_int8_t pkt[4096] = { 0 }, *p = pkt;
-	beacon_t *bc;
+	u_int8_t *p = tmpl->buf;
 
+	memset(tmpl->buf, 0, sizeof(tmpl->buf));
 	fill_radiotap(&p);
-	fill_dot11(&p, T_MGMT, ST_BEACON, IEEE80211_BROADCAST_ADDR);
+	tmpl->dot11_off = p - tmpl->buf;
+	fill_dot11(&p, T_MGMT, subtype, dst_mac, bss->bssid);
+	return p;
+}
+
 
-	/* add the beacon info */
+/*
+ * build the frames we send ahead of time. only the destination and sequence
+ * number are filled in when they go out
+ *
+ * each interface has a set for every network. this needs to be called again
+ * whenever our BSSIDs, SSIDs or its channel change
+ */
+void build_templates(iface_t *ifc)
+{
+	u_int32_t i;
+
+	for (i = 0; i < bss_count(); i++)
+		build_bss_templates(ifc->templates[i], bss_get(i), &ifc->channel);
+}
+
+
+/*
+ * build one network's templates
+ */
+void build_bss_templates(template_t *templates, bss_t *bss, u_int8_t *channel)
+{
+	template_t *tmpl;
+	u_int8_t *p;
+	beacon_t *bc;
+	auth_t *auth;
+	assoc_resp_t *assoc;
+
+	/* beacons and probe responses carry the same thing */
+	tmpl = &templates[TMPL_BEACON];
+	p = start_template(tmpl, ST_BEACON, IEEE80211_BROADCAST_ADDR, bss);
 	bc = (beacon_t *)p;
-	bc->timestamp = 0;
+	bc->timestamp = 0; /* stamped as it goes out */
 	bc->interval = BEACON_INTERVAL;
 	bc->caps = 1; // we are an AP ;-)
 	p = (u_int8_t *)(bc + 1);
 
-	fill_ie(&p, IEID_SSID, g_ssid, g_ssid_len);
+	fill_ie(&p, IEID_SSID, bss->ssid, bss->ssid_len);
 	fill_ie(&p, IEID_RATES, (u_int8_t *)"\x0c\x12\x18\x24\x30\x48\x60\x6c", 8);
-	fill_ie(&p, IEID_DSPARAMS, &g_channel, 1);
+	fill_ie(&p, IEID_DSPARAMS, channel, 1);
+	tmpl->len = p - tmpl->buf;
 
-	/* don't retransmit beacons */
-	if (send(g_sock, pkt, p - pkt, 0) == -1) {
-		perror("[!] Unable to send beacon!");
-		return 0;
+	templates[TMPL_PROBE_RESP] = *tmpl;
+	((dot11_frame_t *)(templates[TMPL_PROBE_RESP].buf + tmpl->dot11_off))->subtype = ST_PROBE_RESP;
+
+	/* add the auth info */
+	tmpl = &templates[TMPL_AUTH_RESP];
+	p = start_template(tmpl, ST_AUTH, IEEE80211_BROADCAST_ADDR, bss);
+	auth = (auth_t *)p;
+	auth->algorithm = 0; // AUTH_OPEN;
+	auth->seq = 2; // should be responding to auth seq 1
+	auth->status = 0; // successful
+	p = (u_int8_t *)(auth + 1);
+	tmpl->len = p - tmpl->buf;
+
+	/* add the assoc info */
+	tmpl = &templates[TMPL_ASSOC_RESP];
+	p = start_template(tmpl, ST_ASSOC_RESP, IEEE80211_BROADCAST_ADDR, bss);
+	assoc = (assoc_resp_t *)p;
+	assoc->caps = 1;
+	assoc->status = 0; // successful
+	assoc->id = 1;
+	p = (u_int8_t *)(assoc + 1);
+
+	fill_ie(&p, IEID_RATES, (u_int8_t *)"\x0c\x12\x18\x24\x30\x48\x60\x6c", 8);
+	tmpl->len = p - tmpl->buf;
+}
+
+
+/*
+ * copy a template into a transmit slot and fill in what changes per frame
+ *
+ * returns the frame, or NULL if there are no free slots
+ */
+u_int8_t *frame_from_template(int which, bss_t *bss, u_int8_t *dst_mac)
+{
+	template_t *tmpl = &g_cur->templates[bss->index][which];
+	dot11_frame_t *d11;
+	u_int8_t *pkt;
+
+	if (!(pkt = tx_alloc(&g_cur->tx))) {
+		fprintf(stderr, "[!] Unable to send packet!\n");
+		return NULL;
 	}
 
+	memcpy(pkt, tmpl->buf, tmpl->len);
+	d11 = (dot11_frame_t *)(pkt + tmpl->dot11_off);
+	if (dst_mac)
+		memcpy(d11->dst_mac, dst_mac, ETH_ALEN);
+	d11->seq = get_sequence();
+	return pkt;
+}
+
+
+/*
+ * how far ahead of ours a network's TSF runs. the networks' TBTTs are spread
+ * out over the beacon interval, and each one's TSF is shifted so that its own
+ * TBTTs still fall on multiples of the interval
+ */
+u_int64_t bss_tsf_adjust(bss_t *bss)
+{
+	u_int64_t interval = TU_TO_USEC(BEACON_INTERVAL);
+
+	return (interval - interval * bss->index / bss_count()) % interval;
+}
+
+
+/*
+ * fill in the timestamp of a beacon or probe response that's about to go out
+ */
+void stamp_tsf(u_int8_t *pkt, bss_t *bss)
+{
+	beacon_t *bc = (beacon_t *)(pkt + ((radiotap_t *)pkt)->it_len + sizeof(dot11_frame_t));
+
+	bc->timestamp = tsf_get(now_us()) + bss_tsf_adjust(bss);
+}
+
+
+/*
+ * send a beacon frame to announce one of our networks
+ */
+int send_beacon(bss_t *bss)
+{
+	u_int8_t *pkt;
+
+	if (!(pkt = frame_from_template(TMPL_BEACON, bss, NULL)))
+		return 0;
+	stamp_tsf(pkt, bss);
+
+	/* don't retransmit beacons */
+	tx_commit(&g_cur->tx, pkt, g_cur->templates[bss->index][TMPL_BEACON].len);
+	g_cur->tx_sent[SHM_TX_BEACON]++;
+
 	//printf("[*] Sent beacon!\n");
 	return 1;
 }
@@ -888,32 +2988,19 @@ int send_beacon()
 /*
  * send a probe response to the specified sender
  */
-int send_probe_response(u_int8_t *dst_mac)
+int send_probe_response(station_t *sta, bss_t *bss)
 {
-	u_int8_t *p = g_pkt;
-	dot11_frame_t *d11;
-	beacon_t *bc;
-
-	fill_radiotap(&p);
-	d11 = (dot11_frame_t *)p;
-	fill_dot11(&p, T_MGMT, ST_PROBE_RESP, dst_mac);
-
-	/* add the beacon info */
-	bc = (beacon_t *)p;
-	bc->timestamp = 0;
-	bc->interval = BEACON_INTERVAL;
-	bc->caps = 1; // we are an AP ;-)
-	p = (u_int8_t *)(bc + 1);
+	u_int8_t *pkt;
 
-	fill_ie(&p, IEID_SSID, g_ssid, g_ssid_len);
-	fill_ie(&p, IEID_RATES, (u_int8_t *)"\x0c\x12\x18\x24\x30\x48\x60\x6c", 8);
-	fill_ie(&p, IEID_DSPARAMS, &g_channel, 1);
+	if (!(pkt = frame_from_template(TMPL_PROBE_RESP, bss, sta->mac)))
+		return 0;
+	stamp_tsf(pkt, bss);
 
-	g_pkt_len = p - g_pkt;
-	if (!send_packet(d11))
+	if (!send_packet(sta, pkt, g_cur->templates[bss->index][TMPL_PROBE_RESP].len))
 		return 0;
+	g_cur->tx_sent[SHM_TX_PROBE_RESP]++;
 
-	//printf("[*] Sent probe response to %s!\n", mac_string(dst_mac));
+	//printf("[*] Sent probe response to %s!\n", mac_string(sta->mac));
 	return 1;
 }
 
@@ -921,28 +3008,18 @@ int send_probe_response(u_int8_t *dst_mac)
 /*
  * send an authentication response
  */
-int send_auth_response(u_int8_t *dst_mac)
+int send_auth_response(station_t *sta, bss_t *bss)
 {
-	u_int8_t *p = g_pkt;
-	dot11_frame_t *d11;
-	auth_t *auth;
-
-	fill_radiotap(&p);
-	d11 = (dot11_frame_t *)p;
-	fill_dot11(&p, T_MGMT, ST_AUTH, dst_mac);
+	u_int8_t *pkt;
 
-	/* add the auth info */
-	auth = (auth_t *)p;
-	auth->algorithm = 0; // AUTH_OPEN;
-	auth->seq = 2; // should be responding to auth seq 1
-	auth->status = 0; // successful
-	p = (u_int8_t *)(auth + 1);
+	if (!(pkt = frame_from_template(TMPL_AUTH_RESP, bss, sta->mac)))
+		return 0;
 
-	g_pkt_len = p - g_pkt;
-	if (!send_packet(d11))
+	if (!send_packet(sta, pkt, g_cur->templates[bss->index][TMPL_AUTH_RESP].len))
 		return 0;
+	g_cur->tx_sent[SHM_TX_AUTH_RESP]++;
 
-	//printf("[*] Sent auth response to %s!\n", mac_string(dst_mac));
+	//printf("[*] Sent auth response to %s!\n", mac_string(sta->mac));
 	return 1;
 }
 
@@ -950,81 +3027,205 @@ int send_auth_response(u_int8_t *dst_mac)
 /*
  * send an association response
  */
-int send_assoc_response(u_int8_t *dst_mac)
+int send_assoc_response(station_t *sta, bss_t *bss)
 {
-	u_int8_t *p = g_pkt;
-	dot11_frame_t *d11;
-	assoc_resp_t *assoc;
-
-	fill_radiotap(&p);
-	d11 = (dot11_frame_t *)p;
-	fill_dot11(&p, T_MGMT, ST_ASSOC_RESP, dst_mac);
-
-	/* add the assoc info */
-	assoc = (assoc_resp_t *)p;
-	assoc->caps = 1;
-	assoc->status = 0; // successful
-	assoc->id = 1;
-	p = (u_int8_t *)(assoc + 1);
+	u_int8_t *pkt;
 
-	fill_ie(&p, IEID_RATES, (u_int8_t *)"\x0c\x12\x18\x24\x30\x48\x60\x6c", 8);
+	if (!(pkt = frame_from_template(TMPL_ASSOC_RESP, bss, sta->mac)))
+		return 0;
 
-	g_pkt_len = p - g_pkt;
-	if (!send_packet(d11))
+	if (!send_packet(sta, pkt, g_cur->templates[bss->index][TMPL_ASSOC_RESP].len))
 		return 0;
+	g_cur->tx_sent[SHM_TX_ASSOC_RESP]++;
 
-	//printf("[*] Sent association response to %s!\n", mac_string(dst_mac));
+	//printf("[*] Sent association response to %s!\n", mac_string(sta->mac));
 	return 1;
 }
 
 
 /*
- * process the information elements looking for an SSID
+ * pass a data frame from an associated station on to the host. an A-MSDU
+ * carries several MSDUs with their own addresses, and each one becomes an
+ * Ethernet frame of its own
  */
-ie_t *get_ssid_ie(const u_int8_t *data, u_int32_t left)
+void bridge_to_host(dot11_frame_t *d11, const u_char *data, u_int32_t left)
 {
-	ie_t *ie;
-	const u_int8_t *p = data;
-	u_int32_t rem = left;
+	u_int8_t addrs[2 * ETH_ALEN];
+	u_int32_t len;
+
+	/* nothing to pass on */
+	if (d11->subtype & ST_NULL)
+		return;
+
+	/* only whole, unencrypted frames headed for the DS */
+	if (!(d11->ctrlflags & CF_TO_DS) || (d11->ctrlflags & (CF_MORE_FRAGS | CF_PROTECTED))
+			|| d11->frag || (d11->subtype & ~ST_QOS) != ST_DATA) {
+		g_cur->bridge_dropped++;
+		return;
+	}
 
-#ifdef DEBUG_GET_SSID_IE
-	printf("[*] processing information element data:\n");
-	hexdump(data, left);
-#endif
+	/* addr3 is where it's going. it's from whoever sent it, unless there's
+	 * a fourth address */
+	if (!(dot11_qos_ctrl(d11) & QOS_AMSDU)) {
+		memcpy(addrs, d11->bssid, ETH_ALEN);
+		memcpy(addrs + ETH_ALEN, (d11->ctrlflags & CF_FROM_DS) ? dot11_addr4(d11) : d11->src_mac, ETH_ALEN);
+		bridge_msdu(addrs, data, left);
+		return;
+	}
 
-	while (rem > 0) {
-		/* see if we have enough for the IE header */
-		if (rem < sizeof(*ie)) {
-			fprintf(stderr, "[-] Not enough data for an IE!\n");
-			return NULL;
+	while (left >= AMSDU_HDR_LEN) {
+		len = (data[2 * ETH_ALEN] << 8) | data[2 * ETH_ALEN + 1];
+		if (len > left - AMSDU_HDR_LEN) {
+			g_cur->bridge_dropped++;
+			return;
 		}
+		bridge_msdu(data, data + AMSDU_HDR_LEN, len);
+
+		len = (AMSDU_HDR_LEN + len + 3) & ~3;
+		if (len >= left)
+			break;
+		data += len;
+		left -= len;
+	}
+}
 
-		ie = (ie_t *)p;
 
-		/* advance... */
-		p += sizeof(*ie);
-		rem -= sizeof(*ie);
+/*
+ * hand one MSDU to the host as an Ethernet frame with the specified addresses
+ * and the ethertype from its LLC/SNAP header. it's written straight from the
+ * captured frame
+ */
+void bridge_msdu(const u_int8_t *addrs, const u_int8_t *msdu, u_int32_t len)
+{
+	if (len < LLC_SNAP_LEN || (memcmp(msdu, rfc1042_hdr, 6) && memcmp(msdu, bridge_tunnel_hdr, 6))) {
+		g_cur->bridge_dropped++;
+		return;
+	}
 
-		/* now, is it an SSID ? */
-		if (ie->id == IEID_SSID) {
-			return ie;
-		}
+	/* the ethertype is already right after the addresses */
+	tap_write(&g_tap, addrs, msdu + LLC_SNAP_LEN - 2, len - LLC_SNAP_LEN + 2);
+}
 
-		/* check if we have all the data */
-		if (rem < ie->len) {
-			fprintf(stderr, "[-] Not enough data for the IE's data!\n");
-			return NULL;
-		}
 
-		/* advance past the ie->data */
-		p += ie->len;
-		rem -= ie->len;
+/*
+ * an Ethernet frame from the host, send it on to the station it's for, from
+ * the interface it's on. group addressed frames go out once from every
+ * network on every interface
+ */
+int bridge_from_host(const u_int8_t *frame, u_int32_t len, void *arg)
+{
+	const struct ether_header *eh = (const struct ether_header *)frame;
+	iface_t *ifc = arg;
+	station_t *sta;
+	u_int32_t i;
+
+	/* 802.3 frames with a length instead of a type don't fit in SNAP */
+	if (len < ETH_HLEN || ntohs(eh->ether_type) < ETH_P_802_3_MIN) {
+		ifc->bridge_dropped++;
+		return 1;
 	}
 
-#ifdef DEBUG_GET_SSID_IE
-	fprintf(stderr, "[-] SSID IE not found!\n");
-#endif
-	return NULL;
+	if (eh->ether_dhost[0] & 1) {
+		for (i = 0; i < g_num_ifaces; i++)
+			bridge_queue(ifc, &g_ifaces[i], frame, len, -1);
+		return 1;
+	}
+
+	if (!(sta = sta_lookup(eh->ether_dhost)) || sta->state != S_ESTABLISHED) {
+		ifc->bridge_dropped++;
+		return 1;
+	}
+	bridge_queue(ifc, &g_ifaces[sta->iface], frame, len, sta->bss);
+	return 1;
+}
+
+
+/*
+ * pass a frame the worker for from read from the host on to the interface to
+ * send it from. only to's own worker may use its transmit ring, so unless
+ * that's us, the frame waits in to's queue. bss is the network to send it
+ * from, -1 for all of them
+ */
+void bridge_queue(iface_t *from, iface_t *to, const u_int8_t *frame, u_int32_t len, int bss)
+{
+	if (to == from) {
+		send_bridged(frame, len, bss);
+		return;
+	}
+	if (!tap_queue_push(&to->bridge_q, frame, len, bss))
+		from->bridge_dropped++;
+}
+
+
+/*
+ * a tap_queue_handler_t - send a frame from the host from one of our
+ * networks (bss), or all of them (-1)
+ */
+void send_bridged(const u_int8_t *frame, u_int32_t len, int bss)
+{
+	u_int32_t i;
+
+	if (bss >= 0) {
+		send_data_frame(bss_get(bss), frame, len);
+		return;
+	}
+	for (i = 0; i < bss_count(); i++)
+		send_data_frame(bss_get(i), frame, len);
+}
+
+
+/*
+ * send an Ethernet frame from the host over the air, from one of our networks
+ */
+void send_data_frame(bss_t *bss, const u_int8_t *frame, u_int32_t len)
+{
+	const struct ether_header *eh = (const struct ether_header *)frame;
+	u_int16_t type = ntohs(eh->ether_type);
+	dot11_frame_t *d11;
+	u_int8_t *pkt, *p;
+
+	if (len - ETH_HLEN + BRIDGE_HDR_ROOM > TX_FRAME_MAX || !(p = pkt = tx_alloc(&g_cur->tx))) {
+		g_cur->bridge_dropped++;
+		return;
+	}
+
+	/* from the DS, so addr3 is who it's from */
+	fill_radiotap(&p);
+	d11 = (dot11_frame_t *)p;
+	fill_dot11(&p, T_DATA, ST_DATA, (u_int8_t *)eh->ether_dhost, bss->bssid);
+	d11->ctrlflags = CF_FROM_DS;
+	memcpy(d11->bssid, eh->ether_shost, ETH_ALEN);
+	d11->seq = get_sequence();
+
+	memcpy(p, type == ETH_P_AARP || type == ETH_P_IPX ? bridge_tunnel_hdr : rfc1042_hdr, 6);
+	memcpy(p + 6, frame + 2 * ETH_ALEN, len - 2 * ETH_ALEN);
+	p += 6 + len - 2 * ETH_ALEN;
+
+	tx_commit(&g_cur->tx, pkt, p - pkt);
+}
+
+
+/*
+ * index the information elements in a management frame body
+ *
+ * on success, we return 1, on failure (malformed elements), 0. anything
+ * before the problem is still in the index
+ */
+int index_ies(dot11_frame_t *d11, const u_char *data, u_int32_t left, ie_index_t *ies)
+{
+	u_int32_t fixed = mgmt_fixed_len[d11->subtype];
+
+	if (left < fixed) {
+		ie_index(ies, data, 0);
+		g_cur->rx_ie_truncated++;
+		return 0;
+	}
+	if (!ie_index(ies, data + fixed, left - fixed)) {
+		g_cur->rx_ie_truncated++;
+		ev_log(EV_IE_TRUNCATED, now_ms(), d11->src_mac, 0, 0, 0);
+		return 0;
+	}
+	return 1;
 }
 
 
@@ -1059,45 +3260,14 @@ char *mac_string(u_int8_t *mac)
 
 
 /*
- * return the ssid string, ensuring truncation and nul termination
- */
-char *ssid_string(ie_t *ie)
-{
-	static char ssid_str[32];
-
-	memset(ssid_str, 0, sizeof(ssid_str));
-	if (ie->len > sizeof(ssid_str) - 1)
-		strncpy(ssid_str, (char *)ie->data, sizeof(ssid_str) - 1);
-	else
-		strncpy(ssid_str, (char *)ie->data, ie->len);
-	return ssid_str;
-}
-
-
-/*
- * handle sequence number generation
+ * handle sequence number generation. beacons are built without the state
+ * lock, so this can be called from any worker at any time
  */
 u_int16_t get_sequence(void)
 {
-	static u_int16_t sequence = 1337;
-	uint16_t ret = sequence;
+	static u_int32_t sequence = 1337;
 
-	sequence++;
-	if (sequence > 4095)
-		sequence = 0;
-	return ret;
+	/* 2^32 is a multiple of 4096, so it wraps around cleanly */
+	return __atomic_fetch_add(&sequence, 1, __ATOMIC_RELAXED) % 4096;
 }
 
-
-/*
- * diff two timespec values
- */
-void timespec_diff(struct timespec *newer, struct timespec *older, struct timespec *diff)
-{
-	diff->tv_sec = newer->tv_sec - older->tv_sec;
-	diff->tv_nsec = newer->tv_nsec - older->tv_nsec;
-	if (diff->tv_nsec < 0) {
-		--diff->tv_sec;
-		diff->tv_nsec += 1000000000;
-	}
-}
@@ -0,0 +1,202 @@
+/*
+ * top-style viewer for jfap's statistics page (see shmstats.h)
+ *
+ * maps the page read-only and redraws every so often, with rates worked out
+ * from the last snapshot. jfap doesn't know we're here.
+ *
+ * build with:
+ *   gcc -o jftop jftop.c shmstats.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "shmstats.h"
+
+
+/* how many of the busiest frame types to show per interface */
+#define TOP_FRAME_TYPES 8
+
+typedef struct snapshot {
+	shm_global_stats_t global;
+	shm_iface_stats_t ifaces[SHM_STATS_IFACES];
+} snapshot_t;
+
+
+void usage(char *argv0)
+{
+	fprintf(stderr, "usage: %s [options] [<stats file>]\n", argv0);
+	fprintf(stderr, "\nsupported options:\n\n"
+			"-b             batch mode, don't clear the screen\n"
+			"-d <seconds>   delay between updates (default: 1)\n"
+			"-n <count>     exit after this many updates (default: never)\n"
+			"\nthe stats file is what jfap was given with -S (default: %s)\n"
+			, SHM_STATS_DEFAULT);
+}
+
+
+u_int64_t clock_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u_int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+/*
+ * take a consistent copy of every block
+ */
+void take_snapshot(shm_stats_t *s, snapshot_t *snap)
+{
+	u_int32_t i;
+
+	shm_read(&s->global, &snap->global, sizeof(snap->global));
+	for (i = 0; i < snap->global.num_ifaces && i < SHM_STATS_IFACES; i++)
+		shm_read(&s->ifaces[i], &snap->ifaces[i], sizeof(snap->ifaces[i]));
+}
+
+
+/*
+ * a counter, with its rate since the last update if we have one
+ */
+void show(const char *label, u_int64_t cur, u_int64_t prev, double secs)
+{
+	if (secs > 0)
+		printf("  %s %llu (%.0f/s)", label, (unsigned long long)cur, (cur - prev) / secs);
+	else
+		printf("  %s %llu", label, (unsigned long long)cur);
+}
+
+
+/*
+ * show one interface, with its busiest frame types
+ */
+void show_iface(shm_stats_t *s, shm_iface_stats_t *cur, shm_iface_stats_t *prev, double secs)
+{
+	u_int32_t shown[TOP_FRAME_TYPES];
+	u_int32_t n, i, best;
+
+	printf("\n%s (channel %u)\n", cur->name, cur->channel);
+
+	printf("  rx");
+	show("frames", cur->rx_frames, prev->rx_frames, secs);
+	printf("  bad fcs %llu  malformed %llu  truncated ies %llu\n",
+			(unsigned long long)cur->rx_bad_fcs,
+			(unsigned long long)cur->rx_malformed,
+			(unsigned long long)cur->rx_ie_truncated);
+	printf("      duplicates %llu  kernel drops %llu  queue drops %llu\n",
+			(unsigned long long)cur->rx_dups,
+			(unsigned long long)cur->kernel_drops,
+			(unsigned long long)cur->pipe_drops);
+
+	printf("  tx");
+	show("frames", cur->tx_frames, prev->tx_frames, secs);
+	printf("  errors %llu  retransmits %llu\n",
+			(unsigned long long)cur->tx_errors,
+			(unsigned long long)cur->tx_retransmits);
+	printf("      beacons %llu  probe resps %llu  auth resps %llu  assoc resps %llu\n",
+			(unsigned long long)cur->tx_sent[SHM_TX_BEACON],
+			(unsigned long long)cur->tx_sent[SHM_TX_PROBE_RESP],
+			(unsigned long long)cur->tx_sent[SHM_TX_AUTH_RESP],
+			(unsigned long long)cur->tx_sent[SHM_TX_ASSOC_RESP]);
+
+	/* pick the busiest, 64 entries is too few to bother sorting */
+	for (n = 0; n < TOP_FRAME_TYPES; n++) {
+		best = 64;
+		for (i = 0; i < 64; i++) {
+			u_int32_t j;
+
+			if (!cur->frames[i / 16][i % 16])
+				continue;
+			for (j = 0; j < n && shown[j] != i; j++)
+				;
+			if (j < n)
+				continue;
+			if (best == 64 || cur->frames[i / 16][i % 16] > cur->frames[best / 16][best % 16])
+				best = i;
+		}
+		if (best == 64)
+			break;
+		shown[n] = best;
+
+		printf("    %4s/%-14s %12llu", s->type_names[best / 16], s->subtype_names[best / 16][best % 16],
+				(unsigned long long)cur->frames[best / 16][best % 16]);
+		if (secs > 0)
+			printf("  %8.0f/s", (cur->frames[best / 16][best % 16] - prev->frames[best / 16][best % 16]) / secs);
+		printf("\n");
+	}
+}
+
+
+int main(int argc, char *argv[])
+{
+	char *argv0 = argc > 0 ? argv[0] : "jftop";
+	const char *path = SHM_STATS_DEFAULT;
+	shm_stats_t *s;
+	snapshot_t cur, prev;
+	u_int64_t now, last = 0;
+	int batch = 0, delay = 1, count = -1, c;
+	u_int32_t i;
+
+	while ((c = getopt(argc, argv, "bd:hn:")) != -1) {
+		switch (c) {
+			case 'b':
+				batch = 1;
+				break;
+
+			case 'd':
+				delay = atoi(optarg);
+				break;
+
+			case 'n':
+				count = atoi(optarg);
+				break;
+
+			default:
+				usage(argv0);
+				return 1;
+		}
+	}
+	if (optind < argc)
+		path = argv[optind];
+
+	if (!(s = shmstats_attach(path)))
+		return 1;
+
+	memset(&prev, 0, sizeof(prev));
+	while (count) {
+		double secs;
+
+		take_snapshot(s, &cur);
+		now = clock_ms();
+		secs = last ? (now - last) / 1000.0 : 0;
+
+		if (!batch)
+			printf("\033[H\033[2J");
+		printf("jfap pid %u, %u interface%s, updated %llu ms ago\n", s->pid,
+				cur.global.num_ifaces, cur.global.num_ifaces == 1 ? "" : "s",
+				(unsigned long long)(now > cur.global.updated ? now - cur.global.updated : 0));
+		printf("stations %u:", cur.global.stations);
+		for (i = 0; i < SHM_STATS_STATES; i++)
+			printf("  %s %u", s->state_names[i], cur.global.states[i]);
+		printf("\nevents dropped %llu\n", (unsigned long long)cur.global.events_dropped);
+
+		for (i = 0; i < cur.global.num_ifaces && i < SHM_STATS_IFACES; i++)
+			show_iface(s, &cur.ifaces[i], &prev.ifaces[i], secs);
+		fflush(stdout);
+
+		prev = cur;
+		last = now;
+		if (count > 0)
+			count--;
+		if (count)
+			sleep(delay > 0 ? delay : 1);
+	}
+
+	shmstats_close(s, NULL);
+	return 0;
+}
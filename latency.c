@@ -0,0 +1,121 @@
+/*
+ * response latency histograms for jfap
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "latency.h"
+
+
+/*
+ * get the time (ns) on the clock capture timestamps use
+ */
+u_int64_t lat_clock(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_REALTIME, &ts))
+		return 0;
+	return (u_int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/*
+ * which bucket a value goes in
+ */
+static inline u_int32_t lat_bucket(u_int64_t v)
+{
+	u_int32_t shift;
+
+	if (v < LAT_SUB_BUCKETS)
+		return v;
+	if (v >> LAT_MAX_BITS)
+		return LAT_BUCKETS - 1;
+
+	/* the top LAT_SUB_BITS + 1 bits pick the bucket */
+	shift = 63 - __builtin_clzll(v) - LAT_SUB_BITS;
+	return (shift << LAT_SUB_BITS) + (v >> shift);
+}
+
+
+/*
+ * the highest value that goes in a bucket
+ */
+static inline u_int64_t lat_bucket_max(u_int32_t i)
+{
+	u_int32_t shift;
+
+	if (i < 2 * LAT_SUB_BUCKETS)
+		return i;
+	shift = (i >> LAT_SUB_BITS) - 1;
+	return (((u_int64_t)(i & (LAT_SUB_BUCKETS - 1)) + LAT_SUB_BUCKETS + 1) << shift) - 1;
+}
+
+
+void lat_record(lat_hist_t *h, u_int64_t ns)
+{
+	if (!h->count || ns < h->min)
+		h->min = ns;
+	if (ns > h->max)
+		h->max = ns;
+	h->count++;
+	h->sum += ns;
+	h->buckets[lat_bucket(ns)]++;
+}
+
+
+void lat_merge(lat_hist_t *dst, const lat_hist_t *src)
+{
+	u_int32_t i;
+
+	if (!src->count)
+		return;
+	if (!dst->count || src->min < dst->min)
+		dst->min = src->min;
+	if (src->max > dst->max)
+		dst->max = src->max;
+	dst->count += src->count;
+	dst->sum += src->sum;
+	for (i = 0; i < LAT_BUCKETS; i++)
+		dst->buckets[i] += src->buckets[i];
+}
+
+
+/*
+ * get the value (ns) that pct percent of what we recorded is at or under
+ */
+u_int64_t lat_percentile(const lat_hist_t *h, double pct)
+{
+	u_int64_t want, seen = 0;
+	u_int32_t i;
+
+	if (!h->count)
+		return 0;
+	want = (u_int64_t)(h->count * pct / 100.0 + 0.5);
+	if (!want)
+		want = 1;
+	for (i = 0; i < LAT_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen >= want)
+			return lat_bucket_max(i) < h->max ? lat_bucket_max(i) : h->max;
+	}
+	return h->max;
+}
+
+
+/*
+ * print a one-line summary, in us
+ */
+void lat_print(FILE *out, const char *label, const lat_hist_t *h)
+{
+	fprintf(out, "%-32s %10llu %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n", label,
+			(unsigned long long)h->count,
+			h->min / 1000.0,
+			h->count ? (double)h->sum / h->count / 1000.0 : 0.0,
+			lat_percentile(h, 50) / 1000.0,
+			lat_percentile(h, 90) / 1000.0,
+			lat_percentile(h, 99) / 1000.0,
+			lat_percentile(h, 99.9) / 1000.0,
+			h->max / 1000.0);
+}
@@ -0,0 +1,51 @@
+/*
+ * response latency histograms for jfap
+ *
+ * frames carry the time they were captured (from the kernel or libpcap, on
+ * CLOCK_REALTIME), and we take the time again when the handler gets them,
+ * when a response is queued and when the queue has been flushed. the
+ * differences go into log-linear histograms in the style of HdrHistogram:
+ * below LAT_SUB_BUCKETS ns every value has its own bucket, and above that
+ * each power of 2 is split into LAT_SUB_BUCKETS, so a bucket is never more
+ * than ~3% wide. recording is a couple of shifts and an increment.
+ */
+
+#ifndef JFAP_LATENCY_H
+#define JFAP_LATENCY_H
+
+#include <stdio.h>
+#include <sys/types.h>
+
+
+#define LAT_SUB_BITS 5
+#define LAT_SUB_BUCKETS (1 << LAT_SUB_BITS)
+
+/* values (ns) of 2^LAT_MAX_BITS (~68 s) or more are counted as the max */
+#define LAT_MAX_BITS 36
+#define LAT_BUCKETS ((LAT_MAX_BITS - LAT_SUB_BITS + 1) * LAT_SUB_BUCKETS)
+
+typedef struct lat_hist {
+	u_int64_t count;
+	u_int64_t sum;
+	u_int64_t min;
+	u_int64_t max;
+	u_int32_t buckets[LAT_BUCKETS];
+} lat_hist_t;
+
+
+u_int64_t lat_clock(void);
+void lat_record(lat_hist_t *h, u_int64_t ns);
+void lat_merge(lat_hist_t *dst, const lat_hist_t *src);
+u_int64_t lat_percentile(const lat_hist_t *h, double pct);
+void lat_print(FILE *out, const char *label, const lat_hist_t *h);
+
+
+/*
+ * how long since start, or 0 if the clock went backwards
+ */
+static inline u_int64_t lat_since(u_int64_t start, u_int64_t now)
+{
+	return now > start ? now - start : 0;
+}
+
+#endif
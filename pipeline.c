@@ -0,0 +1,321 @@
+/*
+ * capture / process / transmit pipeline for jfap
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+
+#include "pipeline.h"
+
+
+#define RX_STRIDE (sizeof(pipe_buf_t) + PIPE_RX_BUF_SIZE)
+#define TX_STRIDE (sizeof(pipe_buf_t) + PIPE_TX_BUF_SIZE)
+
+/* how often (ms) the capture thread checks if it should stop */
+#define PIPE_POLL_TIMEOUT 100
+
+/* ring handlers don't get a context argument. each capture thread has its
+ * own, so there can be more than one pipeline */
+static __thread pipeline_t *cap_pipe;
+
+
+/*
+ * wake up whoever is waiting on an eventfd
+ */
+static void pipe_kick(int efd)
+{
+	u_int64_t one = 1;
+
+	if (write(efd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+		perror("[-] Unable to wake a pipeline thread");
+}
+
+
+/*
+ * copy a captured frame into a free buffer and queue it for the worker
+ */
+static int capture_frame(const u_char *data, u_int32_t len, u_int64_t ts)
+{
+	pipeline_t *p = cap_pipe;
+	pipe_buf_t *b;
+
+	__atomic_store_n(&p->rx_frames, p->rx_frames + 1, __ATOMIC_RELAXED);
+
+	/* the worker has every buffer - drop this one rather than wait */
+	if (!(b = spsc_pop(&p->rx_free))) {
+		__atomic_store_n(&p->rx_drops, p->rx_drops + 1, __ATOMIC_RELAXED);
+		return 1;
+	}
+
+	if (len > PIPE_RX_BUF_SIZE)
+		len = PIPE_RX_BUF_SIZE;
+	memcpy(b->data, data, len);
+	b->len = len;
+	b->ts = ts;
+
+	/* can't fail, the ring has a slot for every buffer */
+	spsc_push(&p->rx, b);
+	return 1;
+}
+
+
+static void *capture_thread(void *arg)
+{
+	pipeline_t *p = arg;
+	struct pollfd pfd;
+	u_int64_t queued;
+
+	cap_pipe = p;
+	pfd.fd = p->cap_fd;
+	pfd.events = POLLIN;
+	while (!__atomic_load_n(&p->stop, __ATOMIC_ACQUIRE)) {
+		pfd.revents = 0;
+		if (poll(&pfd, 1, PIPE_POLL_TIMEOUT) == -1) {
+			if (errno == EINTR)
+				continue;
+			perror("[!] Unable to poll the capture socket");
+			break;
+		}
+		if (!pfd.revents)
+			continue;
+
+		queued = p->rx_frames - p->rx_drops;
+		if (!p->capture(p->capture_arg, capture_frame))
+			break;
+
+		/* one wakeup per batch, not per frame */
+		if (p->rx_frames - p->rx_drops != queued)
+			pipe_kick(p->rx_efd);
+	}
+
+	if (!__atomic_load_n(&p->stop, __ATOMIC_ACQUIRE)) {
+		__atomic_store_n(&p->failed, 1, __ATOMIC_RELEASE);
+		pipe_kick(p->rx_efd);
+	}
+	return NULL;
+}
+
+
+static void *tx_thread(void *arg)
+{
+	pipeline_t *p = arg;
+	pipe_buf_t *b;
+	u_int64_t cnt;
+
+	while (1) {
+		if (read(p->tx_efd, &cnt, sizeof(cnt)) == -1) {
+			if (errno == EINTR)
+				continue;
+			perror("[!] Unable to wait for frames to send");
+			break;
+		}
+
+		/* queue up everything that's waiting and send it in one go */
+		while ((b = spsc_pop(&p->tx))) {
+			tx_send(p->out, b->data, b->len);
+			spsc_push(&p->tx_free, b);
+			__atomic_store_n(&p->tx_frames, p->tx_frames + 1, __ATOMIC_RELAXED);
+		}
+		tx_flush(p->out);
+
+		if (__atomic_load_n(&p->stop, __ATOMIC_ACQUIRE))
+			break;
+	}
+	return NULL;
+}
+
+
+/*
+ * set up the rings and buffers, and start the capture and transmit threads.
+ * cpus says where to pin the capture, worker (calling) and transmit threads
+ *
+ * on success, we return 1, on failure, 0
+ */
+int pipeline_start(pipeline_t *p, int cap_fd, pipe_capture_t capture, void *arg, tx_ring_t *out, const int *cpus)
+{
+	pthread_attr_t attr[PIPE_CPU_MAX];
+	cpu_set_t set;
+	sigset_t all, old;
+	u_int32_t i;
+	int err = 0;
+
+	memset(p, 0, sizeof(*p));
+	p->rx_efd = p->tx_efd = -1;
+	p->cap_fd = cap_fd;
+	p->capture = capture;
+	p->capture_arg = arg;
+	p->out = out;
+	memcpy(p->cpus, cpus, sizeof(p->cpus));
+
+	if (!spsc_init(&p->rx, PIPE_RX_BUFS) || !spsc_init(&p->rx_free, PIPE_RX_BUFS)
+			|| !spsc_init(&p->tx, PIPE_TX_BUFS) || !spsc_init(&p->tx_free, PIPE_TX_BUFS)
+			|| !(p->rx_pool = malloc(PIPE_RX_BUFS * RX_STRIDE))
+			|| !(p->tx_pool = malloc(PIPE_TX_BUFS * TX_STRIDE))) {
+		fprintf(stderr, "[!] Unable to allocate the pipeline buffers\n");
+		goto fail;
+	}
+
+	/* every buffer starts out free */
+	for (i = 0; i < PIPE_RX_BUFS; i++)
+		spsc_push(&p->rx_free, p->rx_pool + i * RX_STRIDE);
+	for (i = 0; i < PIPE_TX_BUFS; i++)
+		spsc_push(&p->tx_free, p->tx_pool + i * TX_STRIDE);
+
+	if ((p->rx_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1
+			|| (p->tx_efd = eventfd(0, EFD_CLOEXEC)) == -1) {
+		perror("[!] Unable to create pipeline eventfds");
+		goto fail;
+	}
+
+	if (p->cpus[PIPE_CPU_WORKER] >= 0) {
+		CPU_ZERO(&set);
+		CPU_SET(p->cpus[PIPE_CPU_WORKER], &set);
+		if ((err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set))) {
+			fprintf(stderr, "[!] Unable to pin the worker to cpu %d: %s\n",
+					p->cpus[PIPE_CPU_WORKER], strerror(err));
+			goto fail;
+		}
+	}
+
+	for (i = 0; i < PIPE_CPU_MAX; i++) {
+		pthread_attr_init(&attr[i]);
+		if (p->cpus[i] >= 0) {
+			CPU_ZERO(&set);
+			CPU_SET(p->cpus[i], &set);
+			pthread_attr_setaffinity_np(&attr[i], sizeof(set), &set);
+		}
+	}
+
+	/* only the worker should ever see signals */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	if (!(err = pthread_create(&p->cap_thread, &attr[PIPE_CPU_CAPTURE], capture_thread, p))) {
+		p->cap_running = 1;
+		if (!(err = pthread_create(&p->tx_thread, &attr[PIPE_CPU_TX], tx_thread, p)))
+			p->tx_running = 1;
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	for (i = 0; i < PIPE_CPU_MAX; i++)
+		pthread_attr_destroy(&attr[i]);
+
+	if (err) {
+		fprintf(stderr, "[!] Unable to start the pipeline threads: %s\n", strerror(err));
+		goto fail;
+	}
+	return 1;
+
+fail:
+	pipeline_stop(p);
+	return 0;
+}
+
+
+/*
+ * worker side - process the frames the capture thread has queued
+ *
+ * on success, we return 1, on failure, 0
+ */
+int pipeline_rx(pipeline_t *p, ring_handler_t fn)
+{
+	pipe_buf_t *b;
+	u_int64_t cnt;
+	u_int32_t n;
+	int ok = 1;
+
+	if (read(p->rx_efd, &cnt, sizeof(cnt)) == -1 && errno != EAGAIN)
+		perror("[-] Unable to read the pipeline eventfd");
+
+	/* a ring's worth at most, so timers get a look in */
+	for (n = 0; n <= p->rx.mask && ok; n++) {
+		if (!(b = spsc_pop(&p->rx)))
+			break;
+		ok = fn(b->data, b->len, b->ts);
+		spsc_push(&p->rx_free, b);
+	}
+	if (n > p->rx.mask)
+		pipe_kick(p->rx_efd);
+
+	if (__atomic_load_n(&p->failed, __ATOMIC_ACQUIRE)) {
+		fprintf(stderr, "[!] The capture thread failed!\n");
+		return 0;
+	}
+	return ok;
+}
+
+
+/*
+ * worker side - a tx_sink_t that hands frames to the transmit thread
+ */
+void pipeline_tx_sink(const u_int8_t *frame, u_int32_t len, void *arg)
+{
+	pipeline_t *p = arg;
+	pipe_buf_t *b;
+
+	if (len > PIPE_TX_BUF_SIZE || !(b = spsc_pop(&p->tx_free))) {
+		p->tx_drops++;
+		return;
+	}
+
+	memcpy(b->data, frame, len);
+	b->len = len;
+	spsc_push(&p->tx, b);
+	p->tx_unkicked++;
+}
+
+
+/*
+ * worker side - a tx_done_t that wakes the transmit thread once a whole
+ * flush has been queued
+ */
+void pipeline_tx_done(void *arg)
+{
+	pipeline_t *p = arg;
+
+	if (!p->tx_unkicked)
+		return;
+	p->tx_unkicked = 0;
+	pipe_kick(p->tx_efd);
+}
+
+
+/*
+ * stop the threads (anything already queued for transmit still goes out) and
+ * free everything
+ */
+void pipeline_stop(pipeline_t *p)
+{
+	__atomic_store_n(&p->stop, 1, __ATOMIC_RELEASE);
+
+	if (p->cap_running) {
+		pthread_join(p->cap_thread, NULL);
+		p->cap_running = 0;
+	}
+	if (p->tx_running) {
+		pipe_kick(p->tx_efd);
+		pthread_join(p->tx_thread, NULL);
+		p->tx_running = 0;
+	}
+
+	if (p->rx_efd != -1)
+		close(p->rx_efd);
+	if (p->tx_efd != -1)
+		close(p->tx_efd);
+	p->rx_efd = p->tx_efd = -1;
+
+	spsc_free(&p->rx);
+	spsc_free(&p->rx_free);
+	spsc_free(&p->tx);
+	spsc_free(&p->tx_free);
+	free(p->rx_pool);
+	free(p->tx_pool);
+	p->rx_pool = p->tx_pool = NULL;
+}
@@ -0,0 +1,85 @@
+/*
+ * capture / process / transmit pipeline for jfap
+ *
+ * a capture thread copies every frame into a preallocated buffer and hands it
+ * to the protocol worker (the main thread) through a lock-free SPSC ring. the
+ * worker queues what it wants to send into a transmit sink, which passes
+ * buffers to a transmit thread the same way, waking it once per batch. used
+ * buffers go back to where they came from through a second ring, so nothing
+ * is allocated or locked per frame.
+ *
+ * if the worker falls behind, the capture thread runs out of buffers and
+ * drops (and counts) frames instead of leaving them in the kernel, so a slow
+ * terminal never stalls the capture socket.
+ */
+
+#ifndef JFAP_PIPELINE_H
+#define JFAP_PIPELINE_H
+
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "spsc.h"
+#include "ring.h"
+
+
+#define PIPE_RX_BUFS 4096
+#define PIPE_RX_BUF_SIZE 4096
+#define PIPE_TX_BUFS 512
+#define PIPE_TX_BUF_SIZE TX_FRAME_SIZE
+
+enum {
+	PIPE_CPU_CAPTURE = 0,
+	PIPE_CPU_WORKER,
+	PIPE_CPU_TX,
+	PIPE_CPU_MAX
+};
+
+typedef struct pipe_buf {
+	u_int64_t ts;             /* when it was captured, rx only */
+	u_int32_t len;
+	u_int8_t data[0];
+} pipe_buf_t;
+
+/* read whatever is ready on the capture fd, handing each frame to fn */
+typedef int (*pipe_capture_t)(void *arg, ring_handler_t fn);
+
+typedef struct pipeline {
+	spsc_t rx;                /* capture -> worker */
+	spsc_t rx_free;           /* worker -> capture */
+	spsc_t tx;                /* worker -> transmit */
+	spsc_t tx_free;           /* transmit -> worker */
+	u_int8_t *rx_pool;
+	u_int8_t *tx_pool;
+	int rx_efd;               /* poked when frames are queued for the worker */
+	int tx_efd;               /* poked when frames are queued for transmit */
+	u_int32_t tx_unkicked;    /* queued since it was last poked, worker only */
+	int stop;
+	int failed;               /* the capture thread hit a fatal error */
+
+	int cap_fd;
+	pipe_capture_t capture;
+	void *capture_arg;
+	tx_ring_t *out;
+	int cpus[PIPE_CPU_MAX];   /* -1 = don't pin */
+	pthread_t cap_thread;
+	pthread_t tx_thread;
+	int cap_running;
+	int tx_running;
+
+	/* counters, each written by one thread only. the worker reads the
+	 * others' atomically */
+	u_int64_t rx_frames;
+	u_int64_t rx_drops;
+	u_int64_t tx_frames;
+	u_int64_t tx_drops;
+} pipeline_t;
+
+
+int pipeline_start(pipeline_t *p, int cap_fd, pipe_capture_t capture, void *arg, tx_ring_t *out, const int *cpus);
+int pipeline_rx(pipeline_t *p, ring_handler_t fn);
+void pipeline_tx_sink(const u_int8_t *frame, u_int32_t len, void *arg);
+void pipeline_tx_done(void *arg);
+void pipeline_stop(pipeline_t *p);
+
+#endif
@@ -0,0 +1,186 @@
+/*
+ * radiotap header parsing for jfap
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <endian.h>
+
+#include "radiotap.h"
+
+
+/* how every field in the radiotap namespace is laid out. a size of 0 means
+ * we don't know, and can't go any further */
+static const struct {
+	u_int8_t align;
+	u_int8_t size;
+} rt_fields[] = {
+	[0] = { 8, 8 },           /* TSFT */
+	[1] = { 1, 1 },           /* flags */
+	[2] = { 1, 1 },           /* rate */
+	[3] = { 2, 4 },           /* channel */
+	[4] = { 1, 2 },           /* FHSS */
+	[5] = { 1, 1 },           /* dBm antenna signal */
+	[6] = { 1, 1 },           /* dBm antenna noise */
+	[7] = { 2, 2 },           /* lock quality */
+	[8] = { 2, 2 },           /* TX attenuation */
+	[9] = { 2, 2 },           /* dB TX attenuation */
+	[10] = { 1, 1 },          /* dBm TX power */
+	[11] = { 1, 1 },          /* antenna */
+	[12] = { 1, 1 },          /* dB antenna signal */
+	[13] = { 1, 1 },          /* dB antenna noise */
+	[14] = { 2, 2 },          /* RX flags */
+	[15] = { 2, 2 },          /* TX flags */
+	[16] = { 1, 1 },          /* RTS retries */
+	[17] = { 1, 1 },          /* data retries */
+	[18] = { 4, 8 },          /* XChannel */
+	[19] = { 1, 3 },          /* MCS */
+	[20] = { 4, 8 },          /* A-MPDU status */
+	[21] = { 2, 12 },         /* VHT */
+	[22] = { 8, 12 },         /* timestamp */
+	[23] = { 2, 12 },         /* HE */
+	[24] = { 2, 12 },         /* HE-MU */
+	[26] = { 1, 1 },          /* 0-length PSDU */
+	[27] = { 2, 4 },          /* L-SIG */
+};
+
+#define RT_NUM_FIELDS (sizeof(rt_fields) / sizeof(rt_fields[0]))
+
+
+static inline u_int16_t get_le16(const u_int8_t *p)
+{
+	u_int16_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return le16toh(v);
+}
+
+static inline u_int32_t get_le32(const u_int8_t *p)
+{
+	u_int32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return le32toh(v);
+}
+
+
+/*
+ * pull the fields we care about into the metadata. if a field shows up more
+ * than once (per-antenna namespaces), the first one wins
+ */
+static void rt_extract(rt_meta_t *meta, u_int32_t field, const u_int8_t *p)
+{
+	if (meta->have & (1U << field))
+		return;
+	meta->have |= 1U << field;
+
+	switch (field) {
+		case IEEE80211_RADIOTAP_FLAGS:
+			meta->flags = p[0];
+			break;
+
+		case IEEE80211_RADIOTAP_RATE:
+			meta->rate = p[0];
+			break;
+
+		case IEEE80211_RADIOTAP_CHANNEL:
+			meta->freq = get_le16(p);
+			meta->chan_flags = get_le16(p + 2);
+			break;
+
+		case IEEE80211_RADIOTAP_DBM_ANTSIGNAL:
+			meta->signal = (int8_t)p[0];
+			break;
+
+		case IEEE80211_RADIOTAP_DBM_ANTNOISE:
+			meta->noise = (int8_t)p[0];
+			break;
+
+		case IEEE80211_RADIOTAP_ANTENNA:
+			meta->antenna = p[0];
+			break;
+	}
+}
+
+
+/*
+ * parse the radiotap header at the start of a frame
+ *
+ * on success, we return 1, on failure (a malformed header), 0
+ */
+int radiotap_parse(const u_int8_t *pkt, u_int32_t len, rt_meta_t *meta)
+{
+	const radiotap_t *rt = (const radiotap_t *)pkt;
+	u_int32_t hdr_len, present, bits, off, bm, base = 0;
+	int vendor = 0;
+
+	memset(meta, 0, sizeof(*meta));
+
+	if (len < sizeof(radiotap_t))
+		return 0;
+
+	hdr_len = get_le16(pkt + 2);
+	if (rt->it_version != 0 || hdr_len < sizeof(radiotap_t) || hdr_len > len)
+		return 0;
+	meta->len = hdr_len;
+
+	/* the fields start after the last present bitmap */
+	off = 4;
+	do {
+		if (off + 4 > hdr_len)
+			return 0;
+		present = get_le32(pkt + off);
+#ifdef DEBUG_RADIOTAP_PRESENT
+		printf("    present[%u]: 0x%lx\n", (off - 4) / 4, (ulong)present);
+#endif
+		off += 4;
+	} while (present & (1U << IEEE80211_RADIOTAP_EXT));
+
+	for (bm = 4; ; bm += 4) {
+		present = get_le32(pkt + bm);
+
+		/* we don't know the layout of anything in a vendor namespace,
+		 * but we skipped its data when we entered it */
+		bits = vendor ? 0 : present & ((1U << IEEE80211_RADIOTAP_RADIOTAP_NAMESPACE) - 1);
+		while (bits) {
+			u_int32_t field = base + __builtin_ctz(bits);
+			u_int32_t align;
+
+			bits &= bits - 1;
+
+			/* nothing after an unknown field can be found */
+			if (field >= RT_NUM_FIELDS || !rt_fields[field].size)
+				return 1;
+
+			/* alignment is relative to the start of the header */
+			align = rt_fields[field].align;
+			off = (off + align - 1) & ~(align - 1);
+			if (off + rt_fields[field].size > hdr_len)
+				return 0;
+
+			rt_extract(meta, field, pkt + off);
+			off += rt_fields[field].size;
+		}
+
+		if (!(present & (1U << IEEE80211_RADIOTAP_EXT)))
+			break;
+
+		if (present & (1U << IEEE80211_RADIOTAP_RADIOTAP_NAMESPACE)) {
+			/* start over with another set of radiotap fields */
+			vendor = 0;
+			base = 0;
+		} else if (present & (1U << IEEE80211_RADIOTAP_VENDOR_NAMESPACE)) {
+			/* OUI, sub-namespace, and how much vendor data follows */
+			off = (off + 1) & ~1;
+			if (off + 6 > hdr_len)
+				return 0;
+			off += 6 + get_le16(pkt + off + 4);
+			if (off > hdr_len)
+				return 0;
+			vendor = 1;
+		} else {
+			base += 32;
+		}
+	}
+	return 1;
+}
@@ -0,0 +1,62 @@
+/*
+ * radiotap header parsing for jfap
+ *
+ * the parser walks every present bitmap (including extended and vendor
+ * namespace ones) in place, using a table of field alignments and sizes, and
+ * boils what we care about down to a small per-frame metadata struct. it
+ * stops quietly at the first field it doesn't know the layout of, since
+ * nothing after it can be located.
+ */
+
+#ifndef JFAP_RADIOTAP_H
+#define JFAP_RADIOTAP_H
+
+#include <sys/types.h>
+
+
+struct ieee80211_radiotap_header {
+	u_int8_t it_version;      /* set to 0 */
+	u_int8_t it_pad;
+	u_int16_t it_len;         /* entire length */
+	u_int32_t it_present;     /* fields present */
+} __attribute__((__packed__));
+typedef struct ieee80211_radiotap_header radiotap_t;
+
+/* present bits, which double as field numbers in the radiotap namespace */
+#define IEEE80211_RADIOTAP_TSFT 0
+#define IEEE80211_RADIOTAP_FLAGS 1
+#define IEEE80211_RADIOTAP_RATE 2
+#define IEEE80211_RADIOTAP_CHANNEL 3
+#define IEEE80211_RADIOTAP_DBM_ANTSIGNAL 5
+#define IEEE80211_RADIOTAP_DBM_ANTNOISE 6
+#define IEEE80211_RADIOTAP_ANTENNA 11
+#define IEEE80211_RADIOTAP_RADIOTAP_NAMESPACE 29
+#define IEEE80211_RADIOTAP_VENDOR_NAMESPACE 30
+#define IEEE80211_RADIOTAP_EXT 31
+
+/* bits in the flags field */
+#define IEEE80211_RADIOTAP_F_FCS 0x10     /* frame ends with the FCS */
+#define IEEE80211_RADIOTAP_F_BADFCS 0x40  /* ... and it didn't check out */
+
+#define RT_FCS_LEN 4
+
+/* what we pulled out of a radiotap header. "have" says which fields were
+ * actually there, using the present bits above */
+typedef struct rt_meta {
+	u_int32_t have;
+	u_int16_t len;            /* header length */
+	u_int8_t flags;
+	u_int8_t rate;            /* 500kbps units */
+	u_int16_t freq;           /* MHz */
+	u_int16_t chan_flags;
+	int8_t signal;            /* dBm */
+	int8_t noise;             /* dBm */
+	u_int8_t antenna;
+} rt_meta_t;
+
+#define RT_HAVE(m, field) ((m)->have & (1U << IEEE80211_RADIOTAP_##field))
+
+
+int radiotap_parse(const u_int8_t *pkt, u_int32_t len, rt_meta_t *meta);
+
+#endif
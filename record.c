@@ -0,0 +1,526 @@
+/*
+ * pcapng recorder for jfap
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "record.h"
+
+
+/* pcapng block types, and what we put in them */
+#define PCAPNG_SHB 0x0a0d0d0a
+#define PCAPNG_IDB 0x00000001
+#define PCAPNG_EPB 0x00000006
+#define PCAPNG_MAGIC 0x1a2b3c4d
+#define PCAPNG_OPT_END 0
+#define PCAPNG_OPT_SHB_USERAPPL 4
+#define PCAPNG_OPT_IF_NAME 2
+#define PCAPNG_OPT_IF_TSRESOL 9
+#define LINKTYPE_IEEE802_11_RADIOTAP 127
+
+/* an EPB without the frame and its padding */
+#define PCAPNG_EPB_LEN 32
+
+#define PAD4(len) (((len) + 3) & ~3U)
+
+/* what goes in a thread's ring ahead of each frame. records are aligned, so
+ * there's always room at the end of the ring for a header saying to skip the
+ * rest */
+typedef struct rec_hdr {
+	u_int64_t ts;             /* ns since the epoch */
+	u_int32_t len;            /* REC_WRAP: nothing more until the start */
+	u_int16_t ifid;
+	u_int16_t pad;
+} rec_hdr_t;
+
+#define REC_ALIGN 16
+#define REC_WRAP 0xffffffff
+#define REC_SIZE(len) ((sizeof(rec_hdr_t) + (len) + REC_ALIGN - 1) & ~(REC_ALIGN - 1))
+
+typedef struct rec_ring {
+	/* producer */
+	u_int32_t head __attribute__((aligned(64)));
+	u_int32_t tail_cache;
+	u_int64_t dropped;
+
+	/* consumer */
+	u_int32_t tail __attribute__((aligned(64)));
+
+	u_int8_t buf[REC_RING_SIZE] __attribute__((aligned(64)));
+} rec_ring_t;
+
+static rec_ring_t *rec_rings[REC_MAX_THREADS];
+static u_int32_t rec_nrings;
+static u_int64_t rec_unregistered;    /* from threads without a ring */
+static __thread rec_ring_t *rec_my_ring;
+static __thread int rec_no_ring;
+static int rec_warned;                /* about a thread without a ring */
+
+/* set up by rec_start(), only touched by the writer after that */
+static char rec_path[PATH_MAX];
+static u_int64_t rec_max_bytes;
+static u_int32_t rec_max_secs;
+static char rec_names[REC_MAX_IFACES][64];
+static u_int32_t rec_num;
+static int rec_fd = -1;
+static u_int32_t rec_seq;             /* which file this is */
+static u_int64_t rec_opened;          /* when (ms) */
+static u_int64_t rec_file_bytes;
+static u_int64_t rec_file_frames;
+static u_int8_t *rec_out;
+static u_int32_t rec_out_len;
+static u_int32_t rec_out_frames;
+
+/* read by anyone */
+static u_int64_t rec_nwritten;
+static u_int64_t rec_lost;            /* to write errors */
+static u_int32_t rec_nfiles;
+
+static pthread_t rec_thread;
+static int rec_running;
+static int rec_stop_flag;
+
+
+static u_int64_t rec_clock_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u_int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+/*
+ * give the calling thread a ring of its own
+ */
+static rec_ring_t *rec_register(void)
+{
+	rec_ring_t *r;
+	u_int32_t idx;
+
+	if (rec_no_ring)
+		return NULL;
+
+	idx = __atomic_fetch_add(&rec_nrings, 1, __ATOMIC_ACQ_REL);
+	if (idx >= REC_MAX_THREADS || !(r = aligned_alloc(64, sizeof(*r)))) {
+		rec_no_ring = 1;
+
+		/* its frames are counted as dropped, say why just once */
+		if (!__atomic_exchange_n(&rec_warned, 1, __ATOMIC_RELAXED))
+			fprintf(stderr, "[-] %s, some frames won't be recorded\n",
+					idx >= REC_MAX_THREADS ? "Too many threads recording"
+					: "Unable to allocate a recording ring");
+		return NULL;
+	}
+	r->head = r->tail_cache = r->tail = 0;
+	r->dropped = 0;
+
+	__atomic_store_n(&rec_rings[idx], r, __ATOMIC_RELEASE);
+	return rec_my_ring = r;
+}
+
+
+/*
+ * queue a copy of a frame (with its radiotap header) for the writer. iface is
+ * which of the names given to rec_start() it was seen on, and ts is when (ns
+ * since the epoch)
+ */
+void rec_frame(u_int32_t iface, int dir, u_int64_t ts, const u_int8_t *frame, u_int32_t len)
+{
+	rec_ring_t *r = rec_my_ring;
+	u_int32_t pos, skip, need;
+	rec_hdr_t *hdr;
+
+	if (iface >= rec_num)
+		return;
+	if (!r && !(r = rec_register())) {
+		__atomic_fetch_add(&rec_unregistered, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	if (len > REC_SNAPLEN)
+		len = REC_SNAPLEN;
+	need = REC_SIZE(len);
+
+	/* a record doesn't wrap around, it starts over at the beginning */
+	pos = r->head & (REC_RING_SIZE - 1);
+	skip = REC_RING_SIZE - pos < need ? REC_RING_SIZE - pos : 0;
+
+	if (r->head + skip + need - r->tail_cache > REC_RING_SIZE) {
+		r->tail_cache = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+		if (r->head + skip + need - r->tail_cache > REC_RING_SIZE) {
+			__atomic_store_n(&r->dropped, r->dropped + 1, __ATOMIC_RELAXED);
+			return;
+		}
+	}
+
+	if (skip) {
+		((rec_hdr_t *)(r->buf + pos))->len = REC_WRAP;
+		pos = 0;
+	}
+	hdr = (rec_hdr_t *)(r->buf + pos);
+	hdr->ts = ts;
+	hdr->len = len;
+	hdr->ifid = iface * REC_DIRS + dir;
+	memcpy(hdr + 1, frame, len);
+
+	__atomic_store_n(&r->head, r->head + skip + need, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * append to the output buffer. the caller makes sure it fits
+ */
+static void rec_put(const void *data, u_int32_t len)
+{
+	memcpy(rec_out + rec_out_len, data, len);
+	rec_out_len += len;
+}
+
+
+/*
+ * append an option with its padding
+ */
+static void rec_put_opt(u_int16_t code, const void *data, u_int16_t len)
+{
+	u_int16_t opt[2] = { code, len };
+	u_int32_t zero = 0;
+
+	rec_put(opt, sizeof(opt));
+	if (len) {
+		rec_put(data, len);
+		rec_put(&zero, PAD4(len) - len);
+	}
+}
+
+
+/*
+ * write out the output buffer. if that fails, what was in it is lost
+ *
+ * on success, we return 1, on failure, 0
+ */
+static int rec_flush(void)
+{
+	u_int32_t off = 0;
+	ssize_t n;
+
+	while (off < rec_out_len) {
+		if ((n = write(rec_fd, rec_out + off, rec_out_len - off)) == -1) {
+			if (errno == EINTR)
+				continue;
+			if (!__atomic_load_n(&rec_lost, __ATOMIC_RELAXED))
+				perror("[-] Unable to write the recording");
+			__atomic_fetch_add(&rec_lost, rec_out_frames, __ATOMIC_RELAXED);
+			rec_out_len = rec_out_frames = 0;
+			return 0;
+		}
+		off += n;
+	}
+
+	__atomic_fetch_add(&rec_nwritten, rec_out_frames, __ATOMIC_RELAXED);
+	rec_out_len = rec_out_frames = 0;
+	return 1;
+}
+
+
+/*
+ * start a new file, with a section header and the interface blocks
+ *
+ * on success, we return 1, on failure, 0
+ */
+static int rec_open(void)
+{
+	char name[PATH_MAX + 16];
+	u_int32_t i, blen, mark;
+	u_int8_t res = 9;         /* 10^-9, ns */
+
+	if (rec_max_bytes || rec_max_secs)
+		snprintf(name, sizeof(name), "%s.%u", rec_path, rec_seq);
+	else
+		snprintf(name, sizeof(name), "%s", rec_path);
+	rec_seq++;
+	rec_opened = rec_clock_ms();
+	rec_file_bytes = rec_file_frames = 0;
+
+	if ((rec_fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1) {
+		fprintf(stderr, "[!] Unable to open \"%s\" for writing: %s\n", name, strerror(errno));
+		return 0;
+	}
+	__atomic_fetch_add(&rec_nfiles, 1, __ATOMIC_RELAXED);
+
+	/* section header. the lengths go in once we know them */
+	mark = rec_out_len;
+	{
+		u_int32_t hdr[3] = { PCAPNG_SHB, 0, PCAPNG_MAGIC };
+		u_int16_t version[2] = { 1, 0 };
+		int64_t section_len = -1;
+
+		rec_put(hdr, sizeof(hdr));
+		rec_put(version, sizeof(version));
+		rec_put(&section_len, sizeof(section_len));
+		rec_put_opt(PCAPNG_OPT_SHB_USERAPPL, "jfap", 4);
+		rec_put_opt(PCAPNG_OPT_END, NULL, 0);
+		blen = rec_out_len - mark + 4;
+		memcpy(rec_out + mark + 4, &blen, 4);
+		rec_put(&blen, 4);
+	}
+
+	/* a receive and a transmit interface for each of ours */
+	for (i = 0; i < rec_num * REC_DIRS; i++) {
+		u_int32_t hdr[2] = { PCAPNG_IDB, 0 }, snaplen = REC_SNAPLEN;
+		u_int16_t link[2] = { LINKTYPE_IEEE802_11_RADIOTAP, 0 };
+		char ifname[80];
+
+		mark = rec_out_len;
+		snprintf(ifname, sizeof(ifname), "%s %s", rec_names[i / REC_DIRS],
+				i % REC_DIRS == REC_RX ? "rx" : "tx");
+		rec_put(hdr, sizeof(hdr));
+		rec_put(link, sizeof(link));
+		rec_put(&snaplen, sizeof(snaplen));
+		rec_put_opt(PCAPNG_OPT_IF_NAME, ifname, strlen(ifname));
+		rec_put_opt(PCAPNG_OPT_IF_TSRESOL, &res, 1);
+		rec_put_opt(PCAPNG_OPT_END, NULL, 0);
+		blen = rec_out_len - mark + 4;
+		memcpy(rec_out + mark + 4, &blen, 4);
+		rec_put(&blen, 4);
+	}
+
+	rec_file_bytes = rec_out_len;
+	return 1;
+}
+
+
+/*
+ * finish the current file and start the next one
+ */
+static void rec_rotate(void)
+{
+	if (rec_fd != -1) {
+		rec_flush();
+		close(rec_fd);
+		rec_fd = -1;
+	}
+	rec_open();
+}
+
+
+/*
+ * turn a queued frame into an enhanced packet block
+ */
+static void rec_write(const rec_hdr_t *hdr)
+{
+	u_int32_t blen = PCAPNG_EPB_LEN + PAD4(hdr->len), zero = 0;
+	u_int32_t epb[7] = {
+		PCAPNG_EPB, blen, hdr->ifid, hdr->ts >> 32, (u_int32_t)hdr->ts, hdr->len, hdr->len
+	};
+
+	if (rec_max_bytes && rec_file_frames && rec_file_bytes + blen > rec_max_bytes)
+		rec_rotate();
+	if (rec_fd == -1) {
+		__atomic_fetch_add(&rec_lost, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	if (rec_out_len + blen > REC_BUF_SIZE)
+		rec_flush();
+
+	rec_put(epb, sizeof(epb));
+	rec_put(hdr + 1, hdr->len);
+	rec_put(&zero, PAD4(hdr->len) - hdr->len);
+	rec_put(&blen, 4);
+	rec_file_bytes += blen;
+	rec_file_frames++;
+	rec_out_frames++;
+}
+
+
+/*
+ * turn everything queued into blocks, giving the space back as we go
+ *
+ * returns the number of frames handled
+ */
+static u_int32_t rec_drain(void)
+{
+	u_int32_t i, n, cnt = 0;
+
+	n = __atomic_load_n(&rec_nrings, __ATOMIC_ACQUIRE);
+	if (n > REC_MAX_THREADS)
+		n = REC_MAX_THREADS;
+
+	for (i = 0; i < n; i++) {
+		rec_ring_t *r = __atomic_load_n(&rec_rings[i], __ATOMIC_ACQUIRE);
+		u_int32_t head, tail;
+
+		if (!r)
+			continue;
+
+		head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		for (tail = r->tail; tail != head; ) {
+			rec_hdr_t *hdr = (rec_hdr_t *)(r->buf + (tail & (REC_RING_SIZE - 1)));
+
+			if (hdr->len == REC_WRAP) {
+				tail += REC_RING_SIZE - (tail & (REC_RING_SIZE - 1));
+				continue;
+			}
+			rec_write(hdr);
+			tail += REC_SIZE(hdr->len);
+			cnt++;
+
+			/* it's copied, so the space can be reused while we write */
+			__atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+		}
+		__atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+	}
+	return cnt;
+}
+
+
+static void *rec_thread_main(void *arg)
+{
+	struct timespec idle = { 0, REC_IDLE_MS * 1000000L };
+
+	while (!__atomic_load_n(&rec_stop_flag, __ATOMIC_ACQUIRE)) {
+		/* a file that's been open long enough ends once it has something
+		 * in it. a failed open is retried then too */
+		if (rec_max_secs && (rec_file_frames || rec_fd == -1)
+				&& rec_clock_ms() - rec_opened >= (u_int64_t)rec_max_secs * 1000)
+			rec_rotate();
+
+		if (!rec_drain()) {
+			if (rec_out_len && rec_fd != -1)
+				rec_flush();
+			nanosleep(&idle, NULL);
+		} else if (rec_out_len >= REC_FLUSH_AT)
+			rec_flush();
+	}
+
+	/* whatever was queued before we were told to stop */
+	rec_drain();
+	if (rec_fd != -1)
+		rec_flush();
+	return NULL;
+}
+
+
+/*
+ * open the first file and start the writer. names are the interfaces frames
+ * will be recorded for. max_bytes and max_secs say when to rotate (0 for
+ * never)
+ *
+ * on success, we return 1, on failure, 0
+ */
+int rec_start(const char *path, u_int64_t max_bytes, u_int32_t max_secs, const char **names, u_int32_t num)
+{
+	sigset_t all, old;
+	u_int32_t i;
+	int err;
+
+	if (num > REC_MAX_IFACES)
+		num = REC_MAX_IFACES;
+	snprintf(rec_path, sizeof(rec_path), "%s", path);
+	rec_max_bytes = max_bytes;
+	rec_max_secs = max_secs;
+	for (i = 0; i < num; i++)
+		snprintf(rec_names[i], sizeof(rec_names[i]), "%s", names[i]);
+	rec_num = num;
+	rec_stop_flag = 0;
+
+	if (!(rec_out = malloc(REC_BUF_SIZE))) {
+		perror("[!] Unable to allocate the recording buffer");
+		return 0;
+	}
+	if (!rec_open() || !rec_flush())
+		goto fail;
+
+	/* leave signals to the main thread */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	err = pthread_create(&rec_thread, NULL, rec_thread_main, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (err) {
+		fprintf(stderr, "[!] Unable to start the recorder thread: %s\n", strerror(err));
+		goto fail;
+	}
+	rec_running = 1;
+	return 1;
+
+fail:
+	if (rec_fd != -1)
+		close(rec_fd);
+	rec_fd = -1;
+	rec_num = 0;
+	free(rec_out);
+	rec_out = NULL;
+	return 0;
+}
+
+
+/*
+ * write out everything still queued and stop the writer
+ */
+void rec_stop(void)
+{
+	if (!rec_running)
+		return;
+
+	__atomic_store_n(&rec_stop_flag, 1, __ATOMIC_RELEASE);
+	pthread_join(rec_thread, NULL);
+	rec_running = 0;
+
+	if (rec_fd != -1)
+		close(rec_fd);
+	rec_fd = -1;
+	free(rec_out);
+	rec_out = NULL;
+}
+
+
+/*
+ * how many frames have made it to disk
+ */
+u_int64_t rec_written(void)
+{
+	return __atomic_load_n(&rec_nwritten, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * how many frames have been lost to full rings or write errors
+ */
+u_int64_t rec_dropped(void)
+{
+	u_int64_t total = __atomic_load_n(&rec_unregistered, __ATOMIC_RELAXED)
+		+ __atomic_load_n(&rec_lost, __ATOMIC_RELAXED);
+	u_int32_t i, n;
+
+	n = __atomic_load_n(&rec_nrings, __ATOMIC_ACQUIRE);
+	if (n > REC_MAX_THREADS)
+		n = REC_MAX_THREADS;
+
+	for (i = 0; i < n; i++) {
+		rec_ring_t *r = __atomic_load_n(&rec_rings[i], __ATOMIC_ACQUIRE);
+
+		if (r)
+			total += __atomic_load_n(&r->dropped, __ATOMIC_RELAXED);
+	}
+	return total;
+}
+
+
+/*
+ * how many files have been started
+ */
+u_int32_t rec_files(void)
+{
+	return __atomic_load_n(&rec_nfiles, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,59 @@
+/*
+ * pcapng recorder for jfap
+ *
+ * every frame we receive and send can be written to a pcapng file, with a
+ * receive and a transmit interface block per monitor interface and ns
+ * timestamps. the threads handling frames only copy each one into a byte ring
+ * of their own; a background thread turns them into blocks and does all the
+ * file I/O, so a stalled disk never holds up a handler. when a ring is full
+ * the frame is dropped and counted, as are frames lost to write errors.
+ *
+ * files can be rotated once they reach a size, and/or after a while. each
+ * one is a complete capture with its own section header, named <path>.<n>.
+ */
+
+#ifndef JFAP_RECORD_H
+#define JFAP_RECORD_H
+
+#include <sys/types.h>
+
+
+/* bytes of frames queued per thread, a power of 2 */
+#define REC_RING_SIZE (1 << 22)
+
+/* how long (ms) the writer naps when there's nothing to do */
+#define REC_IDLE_MS 5
+
+/* the writer's output buffer, and how full it gets before it's written */
+#define REC_BUF_SIZE (1 << 20)
+#define REC_FLUSH_AT (256 << 10)
+
+/* frames are cut short past this */
+#define REC_SNAPLEN 65535
+
+/* interface blocks - each of ours has one of each, in this order */
+enum {
+	REC_RX = 0,
+	REC_TX,
+	REC_DIRS
+};
+
+#define REC_MAX_IFACES 8
+
+/* threads that can record - each interface's worker, and with -t its
+ * capture and transmit threads too. rings are only allocated as threads
+ * start recording, so spare slots are cheap */
+#define REC_THREADS_PER_IFACE 3
+#define REC_MAX_THREADS (REC_MAX_IFACES * REC_THREADS_PER_IFACE)
+
+
+int rec_start(const char *path, u_int64_t max_bytes, u_int32_t max_secs, const char **names, u_int32_t num);
+void rec_stop(void);
+
+void rec_frame(u_int32_t iface, int dir, u_int64_t ts, const u_int8_t *frame, u_int32_t len);
+
+u_int64_t rec_written(void);
+u_int64_t rec_dropped(void);
+u_int32_t rec_files(void);
+
+#endif
@@ -0,0 +1,468 @@
+/*
+ * TPACKET_V3 mmap rings for jfap
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <linux/if_packet.h>
+
+#include "ring.h"
+
+
+/* where frame data starts in a TX ring slot */
+#define TX_DATA_OFFSET TPACKET_ALIGN(sizeof(struct tpacket3_hdr))
+
+
+/*
+ * switch a bound packet socket over to mapped rings - receive via r (if not
+ * NULL) and transmit via t
+ *
+ * on success, we return 1, on failure, 0
+ */
+int ring_setup(rx_ring_t *r, tx_ring_t *t, int fd)
+{
+	struct tpacket_req3 req;
+	int ver = TPACKET_V3;
+	size_t rx_len = 0, tx_len = 0;
+	u_int8_t *map;
+
+	memset(t, 0, sizeof(*t));
+	t->fd = fd;
+
+	if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &ver, sizeof(ver)) == -1) {
+		perror("[!] Unable to select TPACKET_V3");
+		return 0;
+	}
+
+	if (r) {
+		memset(r, 0, sizeof(*r));
+		r->fd = fd;
+		r->block_size = RING_BLOCK_SIZE;
+		r->block_nr = RING_BLOCK_NR;
+		r->warn_truncated = 1;
+
+#ifdef PACKET_IGNORE_OUTGOING
+		{
+			int one = 1;
+
+			/* we'd just throw away our own frames anyway */
+			if (setsockopt(fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one)) == -1)
+				perror("[-] Unable to ignore outgoing frames");
+		}
+#endif
+
+		memset(&req, 0, sizeof(req));
+		req.tp_block_size = r->block_size;
+		req.tp_block_nr = r->block_nr;
+		req.tp_frame_size = RING_FRAME_SIZE;
+		req.tp_frame_nr = (r->block_size * r->block_nr) / RING_FRAME_SIZE;
+		req.tp_retire_blk_tov = RING_BLOCK_TIMEOUT;
+		if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) == -1) {
+			perror("[!] Unable to set up the receive ring");
+			return 0;
+		}
+		rx_len = (size_t)r->block_size * r->block_nr;
+	}
+
+	/* TX rings need TPACKET_V3 support (linux 4.11+), fall back if not */
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = TX_BLOCK_SIZE;
+	req.tp_block_nr = TX_BLOCK_NR;
+	req.tp_frame_size = TX_FRAME_SIZE;
+	req.tp_frame_nr = TX_FRAME_NR;
+	if (setsockopt(fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) == -1) {
+		perror("[-] Unable to set up the transmit ring, using sendmmsg");
+	} else {
+		t->mapped = 1;
+		tx_len = (size_t)TX_BLOCK_SIZE * TX_BLOCK_NR;
+	}
+
+	/* the rings share one mapping, receive first */
+	if (rx_len + tx_len > 0) {
+		map = mmap(NULL, rx_len + tx_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, fd, 0);
+		if (map == MAP_FAILED) {
+			/* MAP_LOCKED can fail due to RLIMIT_MEMLOCK, try without it */
+			map = mmap(NULL, rx_len + tx_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if (map == MAP_FAILED) {
+				perror("[!] Unable to map the packet rings");
+				return 0;
+			}
+		}
+
+		if (r) {
+			r->map = map;
+			r->map_len = rx_len;
+		}
+		if (t->mapped)
+			t->slots = map + rx_len;
+	}
+
+	if (!t->mapped) {
+		if (!(t->slots = malloc((size_t)TX_FRAME_NR * TX_FRAME_SIZE))) {
+			perror("[!] Unable to allocate transmit slots");
+			return 0;
+		}
+	}
+	return 1;
+}
+
+
+/*
+ * hand every frame in every block the kernel has finished with to fn, or in
+ * batches to bfn if it's set
+ *
+ * returns -1 if a handler failed, otherwise the number of blocks processed
+ */
+static int ring_walk(rx_ring_t *r, ring_handler_t fn, ring_batch_handler_t bfn)
+{
+	rx_batch_t b;
+	int blocks = 0;
+
+	b.num = 0;
+
+	while (1) {
+		struct tpacket_block_desc *bd;
+		struct tpacket3_hdr *ppd;
+		u_int32_t i, num;
+		int ok = 1;
+
+		bd = (struct tpacket_block_desc *)(r->map + (size_t)r->cur * r->block_size);
+		if (!(__atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER))
+			break;
+
+		num = bd->hdr.bh1.num_pkts;
+		ppd = (struct tpacket3_hdr *)((u_int8_t *)bd + bd->hdr.bh1.offset_to_first_pkt);
+		for (i = 0; i < num && ok; i++) {
+			if (ppd->tp_len > ppd->tp_snaplen && r->warn_truncated)
+				fprintf(stderr, "[-] WARNING: truncated frame! (len: %lu > caplen: %lu)\n",
+						(ulong)ppd->tp_len, (ulong)ppd->tp_snaplen);
+
+			if (!bfn)
+				ok = fn((u_int8_t *)ppd + ppd->tp_mac, ppd->tp_snaplen,
+						(u_int64_t)ppd->tp_sec * 1000000000 + ppd->tp_nsec);
+			else {
+				b.data[b.num] = (u_int8_t *)ppd + ppd->tp_mac;
+				b.len[b.num] = ppd->tp_snaplen;
+				b.ts[b.num] = (u_int64_t)ppd->tp_sec * 1000000000 + ppd->tp_nsec;
+				if (++b.num == RING_BATCH) {
+					ok = bfn(&b);
+					b.num = 0;
+				}
+			}
+			ppd = (struct tpacket3_hdr *)((u_int8_t *)ppd + ppd->tp_next_offset);
+		}
+
+		/* the rest of the block, before it goes back */
+		if (ok && b.num)
+			ok = bfn(&b);
+		b.num = 0;
+
+		/* give the block back to the kernel */
+		__atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+		r->cur = (r->cur + 1) % r->block_nr;
+		blocks++;
+
+		if (!ok)
+			return -1;
+	}
+	return blocks;
+}
+
+
+/*
+ * set up transmit slots that are flushed to a function instead of a socket
+ *
+ * on success, we return 1, on failure, 0
+ */
+int tx_setup_sink(tx_ring_t *t, tx_sink_t sink, void *arg)
+{
+	memset(t, 0, sizeof(*t));
+	t->fd = -1;
+	t->sink = sink;
+	t->sink_arg = arg;
+
+	if (!(t->slots = malloc((size_t)TX_FRAME_NR * TX_FRAME_SIZE))) {
+		perror("[!] Unable to allocate transmit slots");
+		return 0;
+	}
+	return 1;
+}
+
+
+/*
+ * process whatever frames are ready without waiting
+ *
+ * on succes, we return 1, on failure, 0
+ */
+int ring_read(rx_ring_t *r, ring_handler_t fn)
+{
+	return ring_walk(r, fn, NULL) >= 0;
+}
+
+
+/*
+ * process whatever frames are ready without waiting, in batches
+ *
+ * on succes, we return 1, on failure, 0
+ */
+int ring_read_batch(rx_ring_t *r, ring_batch_handler_t fn)
+{
+	return ring_walk(r, NULL, fn) >= 0;
+}
+
+
+/*
+ * find out how many frames the kernel dropped for want of a free block since
+ * we last asked (reading them resets its counters), and add them to *drops
+ *
+ * on succes, we return 1, on failure, 0
+ */
+int ring_drops(rx_ring_t *r, u_int64_t *drops)
+{
+	struct tpacket_stats_v3 st;
+	socklen_t len = sizeof(st);
+
+	if (getsockopt(r->fd, SOL_PACKET, PACKET_STATISTICS, &st, &len) == -1)
+		return 0;
+	*drops += st.tp_drops;
+	return 1;
+}
+
+
+/*
+ * unmap the rings (the socket belongs to the caller)
+ */
+void ring_close(rx_ring_t *r, tx_ring_t *t)
+{
+	size_t len = 0;
+	u_int8_t *map = NULL;
+
+	tx_flush(t);
+
+	if (r && r->map) {
+		map = r->map;
+		len = r->map_len;
+		r->map = NULL;
+	}
+	if (t->mapped) {
+		if (!map)
+			map = t->slots;
+		len += (size_t)TX_BLOCK_SIZE * TX_BLOCK_NR;
+	} else {
+		free(t->slots);
+	}
+	t->slots = NULL;
+
+	if (map)
+		munmap(map, len);
+}
+
+
+/*
+ * show the n frames just flushed to the record function. they're still in
+ * their slots, which only tx_alloc() hands out again
+ */
+static void tx_record(tx_ring_t *t, u_int32_t n)
+{
+	struct tpacket3_hdr *hdr;
+	u_int32_t i, slot;
+
+	for (i = 0; i < n; i++) {
+		if (!t->mapped) {
+			t->record(t->slots + (size_t)i * TX_FRAME_SIZE, t->lens[i], t->record_arg);
+			continue;
+		}
+		slot = (t->head + TX_FRAME_NR - n + i) % TX_FRAME_NR;
+		hdr = (struct tpacket3_hdr *)(t->slots + (size_t)slot * TX_FRAME_SIZE);
+		t->record((u_int8_t *)hdr + TX_DATA_OFFSET, hdr->tp_len, t->record_arg);
+	}
+}
+
+
+/*
+ * have the kernel send whatever is waiting in the mapped ring. frames stay
+ * queued until a kick goes through, and only count as sent (and get
+ * recorded) then
+ *
+ * on success, we return 1, on failure, 0. a busy socket isn't a failure,
+ * the frames just wait for the next kick
+ */
+static int tx_kick(tx_ring_t *t)
+{
+	u_int32_t n = t->queued;
+
+	if (send(t->fd, NULL, 0, MSG_DONTWAIT) == -1) {
+		if (errno == EAGAIN || errno == EINTR)
+			return 1;
+		perror("[!] Unable to flush the transmit ring!");
+		__atomic_store_n(&t->errors, t->errors + 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+	if (!n)
+		return 1;
+
+	t->queued = 0;
+	t->frames += n;
+	t->flushes++;
+	if (n > t->max_batch)
+		t->max_batch = n;
+
+	/* after the syscall, so recording doesn't hold up the send */
+	if (t->record)
+		tx_record(t, n);
+	return 1;
+}
+
+
+/*
+ * get a free slot to build an outgoing frame in. the frame doesn't go anywhere
+ * until it is handed to tx_commit()
+ *
+ * returns NULL if everything is still in flight
+ */
+u_int8_t *tx_alloc(tx_ring_t *t)
+{
+	struct tpacket3_hdr *hdr;
+	u_int32_t status;
+
+	if (!t->mapped) {
+		if (t->queued == TX_FRAME_NR)
+			tx_flush(t);
+		if (t->queued == TX_FRAME_NR)
+			return NULL;
+		return t->slots + (size_t)t->queued * TX_FRAME_SIZE;
+	}
+
+	hdr = (struct tpacket3_hdr *)(t->slots + (size_t)t->head * TX_FRAME_SIZE);
+	status = __atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE);
+	if (t->queued == TX_FRAME_NR || (status & (TP_STATUS_SEND_REQUEST | TP_STATUS_SENDING))) {
+		/* wrapped around onto frames the kernel hasn't sent yet. they
+		 * may be from an earlier kick that didn't go through, so kick
+		 * again even if nothing new is queued */
+		tx_kick(t);
+		status = __atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE);
+		if (t->queued == TX_FRAME_NR || (status & (TP_STATUS_SEND_REQUEST | TP_STATUS_SENDING))) {
+			__atomic_store_n(&t->errors, t->errors + 1, __ATOMIC_RELAXED);
+			return NULL;
+		}
+	}
+	if (status & TP_STATUS_WRONG_FORMAT) {
+		fprintf(stderr, "[-] Kernel rejected a queued frame\n");
+		__atomic_store_n(&t->errors, t->errors + 1, __ATOMIC_RELAXED);
+	}
+
+	return (u_int8_t *)hdr + TX_DATA_OFFSET;
+}
+
+
+/*
+ * queue a frame built in the slot returned by tx_alloc()
+ */
+void tx_commit(tx_ring_t *t, u_int8_t *frame, u_int32_t len)
+{
+	struct tpacket3_hdr *hdr;
+
+	if (!t->mapped) {
+		t->lens[t->queued++] = len;
+		return;
+	}
+
+	hdr = (struct tpacket3_hdr *)(frame - TX_DATA_OFFSET);
+	hdr->tp_len = len;
+	hdr->tp_snaplen = len;
+	hdr->tp_next_offset = 0;
+	__atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+
+	t->head = (t->head + 1) % TX_FRAME_NR;
+	t->queued++;
+}
+
+
+/*
+ * queue a copy of an already built frame
+ *
+ * on success, we return 1, on failure, 0
+ */
+int tx_send(tx_ring_t *t, const u_int8_t *data, u_int32_t len)
+{
+	u_int8_t *frame;
+
+	if (len > TX_FRAME_MAX || !(frame = tx_alloc(t)))
+		return 0;
+
+	memcpy(frame, data, len);
+	tx_commit(t, frame, len);
+	return 1;
+}
+
+
+/*
+ * send everything that has been queued with one syscall
+ *
+ * on success, we return 1, on failure, 0
+ */
+int tx_flush(tx_ring_t *t)
+{
+	u_int32_t n = t->queued, sent = 0;
+	int ret = 1;
+
+	if (!n)
+		return 1;
+	if (t->mapped)
+		return tx_kick(t);
+
+	t->queued = 0;
+	t->flushes++;
+	if (n > t->max_batch)
+		t->max_batch = n;
+
+	if (t->sink) {
+		u_int32_t i;
+
+		for (i = 0; i < n; i++)
+			t->sink(t->slots + (size_t)i * TX_FRAME_SIZE, t->lens[i], t->sink_arg);
+		if (t->sink_done)
+			t->sink_done(t->sink_arg);
+		sent = n;
+	} else {
+		struct mmsghdr msgs[TX_FRAME_NR];
+		struct iovec iov[TX_FRAME_NR];
+		u_int32_t i;
+		int cnt;
+
+		memset(msgs, 0, sizeof(msgs[0]) * n);
+		for (i = 0; i < n; i++) {
+			iov[i].iov_base = t->slots + (size_t)i * TX_FRAME_SIZE;
+			iov[i].iov_len = t->lens[i];
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		while (sent < n) {
+			cnt = sendmmsg(t->fd, msgs + sent, n - sent, 0);
+			if (cnt == -1) {
+				if (errno == EINTR)
+					continue;
+				perror("[!] Unable to send packets!");
+				__atomic_store_n(&t->errors, t->errors + n - sent, __ATOMIC_RELAXED);
+				ret = 0;
+				break;
+			}
+			sent += cnt;
+		}
+	}
+	t->frames += sent;
+
+	/* after the syscall, so recording doesn't hold up the send. only
+	 * what went out */
+	if (t->record)
+		tx_record(t, sent);
+	return ret;
+}
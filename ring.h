@@ -0,0 +1,103 @@
+/*
+ * TPACKET_V3 mmap rings for jfap
+ *
+ * the kernel fills fixed-size blocks of frames in a ring shared with us. we
+ * walk each block in place, handing every frame to a callback, and then give
+ * the whole block back. no copies and no syscalls per frame.
+ *
+ * outgoing frames are built directly in the slots of a PACKET_TX_RING and the
+ * kernel is kicked once to send everything queued. when the kernel can't give
+ * us a TX ring, the slots are plain memory flushed with one sendmmsg() call.
+ * they can also be flushed to a sink function instead of a socket (for
+ * offline replay), and every flushed frame can be shown to a record function
+ * as well.
+ */
+
+#ifndef JFAP_RING_H
+#define JFAP_RING_H
+
+#include <sys/types.h>
+
+
+#define RING_BLOCK_SIZE (1 << 18)
+#define RING_BLOCK_NR 16
+#define RING_FRAME_SIZE 2048
+
+/* how long (ms) the kernel may hold a partially filled block. this bounds the
+ * latency before we see a probe request, so keep it tiny */
+#define RING_BLOCK_TIMEOUT 1
+
+#define TX_BLOCK_SIZE (1 << 16)
+#define TX_BLOCK_NR 8
+#define TX_FRAME_SIZE 2048
+#define TX_FRAME_NR ((TX_BLOCK_SIZE / TX_FRAME_SIZE) * TX_BLOCK_NR)
+
+/* largest frame tx_alloc() can hand out */
+#define TX_FRAME_MAX (TX_FRAME_SIZE - 64)
+
+/* most frames ring_read_batch() hands over at once */
+#define RING_BATCH 64
+
+
+/* ts is when the frame was captured (ns, CLOCK_REALTIME), or 0 if we don't
+ * know. return 0 to stop processing (fatal error) */
+typedef int (*ring_handler_t)(const u_char *data, u_int32_t len, u_int64_t ts);
+
+/* frames from one block, still in the ring until the handler returns */
+typedef struct rx_batch {
+	u_int32_t num;
+	const u_char *data[RING_BATCH];
+	u_int32_t len[RING_BATCH];
+	u_int64_t ts[RING_BATCH];
+} rx_batch_t;
+
+/* return 0 to stop processing (fatal error) */
+typedef int (*ring_batch_handler_t)(rx_batch_t *b);
+
+typedef void (*tx_sink_t)(const u_int8_t *frame, u_int32_t len, void *arg);
+typedef void (*tx_done_t)(void *arg);
+
+typedef struct rx_ring {
+	int fd;
+	u_int8_t *map;
+	size_t map_len;
+	u_int32_t block_size;
+	u_int32_t block_nr;
+	u_int32_t cur;
+	int warn_truncated;  /* off when the filter truncates on purpose */
+} rx_ring_t;
+
+typedef struct tx_ring {
+	int fd;
+	int mapped;          /* slots are in the kernel's ring, else sendmmsg */
+	u_int8_t *slots;
+	u_int32_t head;      /* next slot to fill */
+	u_int32_t queued;    /* frames committed but not sent yet */
+	u_int32_t lens[TX_FRAME_NR];
+	tx_sink_t sink;      /* if set, flushes go here rather than the socket */
+	tx_done_t sink_done; /* ... and this is called once they all have */
+	void *sink_arg;
+	tx_sink_t record;    /* if set, sees every frame once it's flushed */
+	void *record_arg;
+
+	/* counters */
+	u_int64_t frames;
+	u_int64_t flushes;
+	u_int64_t errors;    /* can be read (atomically) from other threads */
+	u_int32_t max_batch;
+} tx_ring_t;
+
+
+int ring_setup(rx_ring_t *r, tx_ring_t *t, int fd);
+int tx_setup_sink(tx_ring_t *t, tx_sink_t sink, void *arg);
+int ring_read(rx_ring_t *r, ring_handler_t fn);
+int ring_read_batch(rx_ring_t *r, ring_batch_handler_t fn);
+int ring_drops(rx_ring_t *r, u_int64_t *drops);
+void ring_close(rx_ring_t *r, tx_ring_t *t);
+
+u_int8_t *tx_alloc(tx_ring_t *t);
+void tx_commit(tx_ring_t *t, u_int8_t *frame, u_int32_t len);
+int tx_send(tx_ring_t *t, const u_int8_t *data, u_int32_t len);
+int tx_flush(tx_ring_t *t);
+
+#endif
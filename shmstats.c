@@ -0,0 +1,106 @@
+/*
+ * shared-memory statistics page for jfap
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shmstats.h"
+
+
+/*
+ * create (or replace) the page at the specified path. readers won't look at
+ * it until shmstats_ready() is called
+ *
+ * returns the page, or NULL on failure
+ */
+shm_stats_t *shmstats_create(const char *path)
+{
+	shm_stats_t *s;
+	int fd;
+
+	if ((fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1) {
+		perror("[!] Unable to create the statistics page");
+		return NULL;
+	}
+	if (ftruncate(fd, sizeof(*s)) == -1) {
+		perror("[!] Unable to size the statistics page");
+		close(fd);
+		return NULL;
+	}
+	s = mmap(NULL, sizeof(*s), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (s == MAP_FAILED) {
+		perror("[!] Unable to map the statistics page");
+		return NULL;
+	}
+
+	s->pid = getpid();
+	s->size = sizeof(*s);
+	s->version = SHM_STATS_VERSION;
+	return s;
+}
+
+
+/*
+ * let readers in, once everything that never changes is filled in
+ */
+void shmstats_ready(shm_stats_t *s)
+{
+	__atomic_store_n(&s->magic, SHM_STATS_MAGIC, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * map someone else's page to read it
+ *
+ * returns the page, or NULL on failure
+ */
+shm_stats_t *shmstats_attach(const char *path)
+{
+	shm_stats_t *s;
+	struct stat st;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) {
+		perror("[!] Unable to open the statistics page");
+		return NULL;
+	}
+	if (fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(*s)) {
+		fprintf(stderr, "[!] %s isn't a statistics page\n", path);
+		close(fd);
+		return NULL;
+	}
+	s = mmap(NULL, sizeof(*s), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (s == MAP_FAILED) {
+		perror("[!] Unable to map the statistics page");
+		return NULL;
+	}
+
+	if (__atomic_load_n(&s->magic, __ATOMIC_ACQUIRE) != SHM_STATS_MAGIC ||
+			s->version != SHM_STATS_VERSION || s->size != sizeof(*s)) {
+		fprintf(stderr, "[!] %s isn't a statistics page we understand\n", path);
+		munmap(s, sizeof(*s));
+		return NULL;
+	}
+	return s;
+}
+
+
+/*
+ * unmap a page, and remove it if we own it
+ */
+void shmstats_close(shm_stats_t *s, const char *unlink_path)
+{
+	if (!s)
+		return;
+	munmap(s, sizeof(*s));
+	if (unlink_path)
+		unlink(unlink_path);
+}
@@ -0,0 +1,120 @@
+/*
+ * shared-memory statistics page for jfap
+ *
+ * jfap keeps a copy of its counters in a file mapped shared (normally under
+ * /dev/shm), and jftop maps the same file to show them. jfap never waits for
+ * readers or makes syscalls on their behalf.
+ *
+ * each writer (every interface's worker, and the main thread for the global
+ * block) owns a block guarded by a seqlock: its sequence is odd while it is
+ * being written, and readers retry if they saw it odd or it changed while they
+ * were copying. the packet handlers only bump private counters, which the
+ * writers copy into the page at most once per ms.
+ */
+
+#ifndef JFAP_SHMSTATS_H
+#define JFAP_SHMSTATS_H
+
+#include <string.h>
+#include <sys/types.h>
+
+
+#define SHM_STATS_MAGIC 0x6a666170      /* "jfap" */
+#define SHM_STATS_VERSION 2
+#define SHM_STATS_DEFAULT "/dev/shm/jfap"
+
+#define SHM_STATS_IFACES 8
+#define SHM_STATS_STATES 5
+
+/* what an interface sent, by kind */
+enum {
+	SHM_TX_BEACON = 0,
+	SHM_TX_PROBE_RESP,
+	SHM_TX_AUTH_RESP,
+	SHM_TX_ASSOC_RESP,
+	SHM_TX_MAX
+};
+
+typedef struct shm_iface_stats {
+	u_int32_t seq;
+	u_int8_t channel;
+	char name[27];
+
+	u_int64_t frames[4][16];  /* by type and subtype */
+	u_int64_t rx_frames;
+	u_int64_t rx_bad_fcs;
+	u_int64_t rx_dups;        /* copies of frames we already had */
+	u_int64_t rx_malformed;   /* headers didn't fit */
+	u_int64_t rx_ie_truncated;
+	u_int64_t kernel_drops;
+	u_int64_t pipe_drops;     /* capture and transmit queues were full */
+
+	u_int64_t tx_frames;
+	u_int64_t tx_errors;
+	u_int64_t tx_retransmits;
+	u_int64_t tx_sent[SHM_TX_MAX];
+} __attribute__((aligned(64))) shm_iface_stats_t;
+
+typedef struct shm_global_stats {
+	u_int32_t seq;
+	u_int32_t num_ifaces;
+	u_int64_t updated;        /* ms, on jfap's monotonic clock */
+	u_int32_t stations;
+	u_int32_t states[SHM_STATS_STATES];
+	u_int64_t events_dropped;
+} __attribute__((aligned(64))) shm_global_stats_t;
+
+typedef struct shm_stats {
+	u_int32_t magic;
+	u_int32_t version;
+	u_int32_t pid;
+	u_int32_t size;
+
+	/* so the viewer doesn't need to know how we name things */
+	char type_names[4][8];
+	char subtype_names[4][16][16];
+	char state_names[SHM_STATS_STATES][24];
+
+	shm_global_stats_t global;
+	shm_iface_stats_t ifaces[SHM_STATS_IFACES];
+} shm_stats_t;
+
+
+shm_stats_t *shmstats_create(const char *path);
+void shmstats_ready(shm_stats_t *s);
+shm_stats_t *shmstats_attach(const char *path);
+void shmstats_close(shm_stats_t *s, const char *unlink_path);
+
+
+/*
+ * start and finish writing a block
+ */
+static inline void shm_write_begin(u_int32_t *seq)
+{
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void shm_write_end(u_int32_t *seq)
+{
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * take a consistent copy of a block, which starts with its sequence
+ */
+static inline void shm_read(const void *block, void *copy, size_t len)
+{
+	const u_int32_t *seq = block;
+	u_int32_t s1, s2;
+
+	do {
+		while ((s1 = __atomic_load_n(seq, __ATOMIC_ACQUIRE)) & 1)
+			;
+		memcpy(copy, block, len);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		s2 = __atomic_load_n(seq, __ATOMIC_RELAXED);
+	} while (s1 != s2);
+}
+
+#endif
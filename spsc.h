@@ -0,0 +1,95 @@
+/*
+ * single-producer / single-consumer lock-free ring of pointers for jfap
+ *
+ * one thread pushes and one thread pops, so each index is only ever written
+ * by one side. the producer and consumer halves live on separate cache lines,
+ * and each side keeps a cached copy of the other's index so it only has to
+ * look across when the ring seems full (or empty).
+ */
+
+#ifndef JFAP_SPSC_H
+#define JFAP_SPSC_H
+
+#include <stdlib.h>
+#include <sys/types.h>
+
+
+#define SPSC_CACHE_LINE 64
+
+typedef struct spsc {
+	/* producer */
+	u_int32_t head __attribute__((aligned(SPSC_CACHE_LINE)));
+	u_int32_t tail_cache;
+
+	/* consumer */
+	u_int32_t tail __attribute__((aligned(SPSC_CACHE_LINE)));
+	u_int32_t head_cache;
+
+	/* never change after setup */
+	void **slots __attribute__((aligned(SPSC_CACHE_LINE)));
+	u_int32_t mask;
+} spsc_t;
+
+
+/*
+ * set up a ring with room for size (a power of 2) pointers
+ *
+ * on success, we return 1, on failure, 0
+ */
+static inline int spsc_init(spsc_t *q, u_int32_t size)
+{
+	if (!size || (size & (size - 1)))
+		return 0;
+
+	q->head = q->tail_cache = 0;
+	q->tail = q->head_cache = 0;
+	q->mask = size - 1;
+	return (q->slots = calloc(size, sizeof(*q->slots))) != NULL;
+}
+
+static inline void spsc_free(spsc_t *q)
+{
+	free(q->slots);
+	q->slots = NULL;
+}
+
+
+/*
+ * producer only. returns 0 if the ring is full
+ */
+static inline int spsc_push(spsc_t *q, void *p)
+{
+	u_int32_t head = q->head;
+
+	if (head - q->tail_cache > q->mask) {
+		q->tail_cache = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+		if (head - q->tail_cache > q->mask)
+			return 0;
+	}
+
+	q->slots[head & q->mask] = p;
+	__atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+
+/*
+ * consumer only. returns NULL if the ring is empty
+ */
+static inline void *spsc_pop(spsc_t *q)
+{
+	u_int32_t tail = q->tail;
+	void *p;
+
+	if (tail == q->head_cache) {
+		q->head_cache = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+		if (tail == q->head_cache)
+			return NULL;
+	}
+
+	p = q->slots[tail & q->mask];
+	__atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+	return p;
+}
+
+#endif
@@ -0,0 +1,266 @@
+/*
+ * per-station state tracking for jfap
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "station.h"
+
+
+static u_int64_t sta_index[STA_HASH_SIZE];   /* (mac << 16) | pool index, 0 = empty */
+static station_t sta_pool[STA_MAX];
+static u_int16_t sta_free[STA_MAX];          /* stack of unused pool indexes */
+static u_int32_t sta_nfree;
+static tw_wheel_t *sta_wheel;
+static tw_func_t sta_retransmit_fn;
+
+#ifdef DEBUG_STATIONS
+char *mac_string(u_int8_t *mac);
+#endif
+
+
+/*
+ * pack a mac address into the low 48 bits of an integer
+ */
+static inline u_int64_t mac_key(const u_int8_t *mac)
+{
+	return ((u_int64_t)mac[0] << 40) | ((u_int64_t)mac[1] << 32)
+		| ((u_int64_t)mac[2] << 24) | ((u_int64_t)mac[3] << 16)
+		| ((u_int64_t)mac[4] << 8) | (u_int64_t)mac[5];
+}
+
+
+/*
+ * fibonacci hashing - the low bits of a mac are the most random but the
+ * multiply spreads all of them into the top bits
+ */
+static inline u_int32_t sta_hash(u_int64_t key)
+{
+	return (u_int32_t)((key * 0x9e3779b97f4a7c15ULL) >> (64 - STA_HASH_BITS));
+}
+
+
+/*
+ * find the index slot holding the specified key, or the empty slot where it
+ * would go
+ */
+static u_int32_t sta_find_slot(u_int64_t key)
+{
+	u_int32_t i = sta_hash(key);
+
+	while (sta_index[i] && (sta_index[i] >> 16) != key)
+		i = (i + 1) & (STA_HASH_SIZE - 1);
+	return i;
+}
+
+
+/*
+ * remove an index slot, shifting back any entries that probed past it so we
+ * never need tombstones
+ */
+static void sta_index_delete(u_int32_t i)
+{
+	u_int32_t j = i, k;
+
+	while (1) {
+		j = (j + 1) & (STA_HASH_SIZE - 1);
+		if (!sta_index[j])
+			break;
+
+		/* can the entry in j live in i? only if its home isn't in (i, j] */
+		k = sta_hash(sta_index[j] >> 16);
+		if (i <= j ? (k <= i || k > j) : (k <= i && k > j)) {
+			sta_index[i] = sta_index[j];
+			i = j;
+		}
+	}
+	sta_index[i] = 0;
+}
+
+
+/*
+ * reset the station table
+ *
+ * stations are aged out using the specified wheel, and each one gets a
+ * retransmit timer that calls retransmit_fn with the station as its argument
+ */
+void sta_init(tw_wheel_t *tw, tw_func_t retransmit_fn)
+{
+	u_int32_t i;
+
+	sta_wheel = tw;
+	sta_retransmit_fn = retransmit_fn;
+
+	memset(sta_index, 0, sizeof(sta_index));
+	memset(sta_pool, 0, sizeof(sta_pool));
+
+	/* hand out low indexes first */
+	for (i = 0; i < STA_MAX; i++)
+		sta_free[i] = STA_MAX - 1 - i;
+	sta_nfree = STA_MAX;
+}
+
+
+/*
+ * look up the station with the specified mac address
+ */
+station_t *sta_lookup(const u_int8_t *mac)
+{
+	u_int64_t key = mac_key(mac);
+	u_int32_t i;
+
+	if (!key)
+		return NULL;
+
+	i = sta_find_slot(key);
+	if (!sta_index[i])
+		return NULL;
+	return &sta_pool[sta_index[i] & 0xffff];
+}
+
+
+/*
+ * evict the station that has been idle the longest to make room
+ */
+static void sta_evict_oldest(void)
+{
+	station_t *oldest = NULL;
+	u_int32_t i;
+
+	for (i = 0; i < STA_MAX; i++) {
+		station_t *sta = &sta_pool[i];
+
+		if (!sta->in_use)
+			continue;
+		if (!oldest || sta->last_seen < oldest->last_seen)
+			oldest = sta;
+	}
+
+	if (oldest) {
+#ifdef DEBUG_STATIONS
+		printf("[*] (%s) Station table full, evicting\n", mac_string(oldest->mac));
+#endif
+		sta_remove(oldest);
+	}
+}
+
+
+/*
+ * the idle timer fired. stations refresh last_seen without touching the timer,
+ * so check whether they really went quiet before dropping them
+ */
+static void sta_expire_timer(tw_timer_t *t, void *arg)
+{
+	station_t *sta = arg;
+	u_int64_t deadline = sta->last_seen + STA_IDLE_TIMEOUT * 1000;
+
+	if (deadline > sta_wheel->now) {
+		tw_add(sta_wheel, t, deadline);
+		return;
+	}
+
+#ifdef DEBUG_STATIONS
+	printf("[*] (%s) Station idle, forgetting it\n", mac_string(sta->mac));
+#endif
+	sta_remove(sta);
+}
+
+
+/*
+ * look up the station with the specified mac address, creating it if needed
+ *
+ * returns NULL only for the all-zero address
+ */
+station_t *sta_get(const u_int8_t *mac, u_int64_t now)
+{
+	u_int64_t key = mac_key(mac);
+	station_t *sta;
+	u_int32_t i;
+
+	if (!key)
+		return NULL;
+
+	i = sta_find_slot(key);
+	if (sta_index[i])
+		return &sta_pool[sta_index[i] & 0xffff];
+
+	/* need a new one, make room if necessary */
+	if (!sta_nfree) {
+		sta_evict_oldest();
+		i = sta_find_slot(key);
+	}
+
+	sta_index[i] = (key << 16) | sta_free[--sta_nfree];
+	sta = &sta_pool[sta_index[i] & 0xffff];
+
+	memset(sta, 0, sizeof(*sta));
+	memcpy(sta->mac, mac, ETH_ALEN);
+	sta->in_use = 1;
+	sta->state = S_AWAITING_PROBE_REQ;
+	sta->last_seen = now;
+	tw_setup(&sta->expire_timer, sta_expire_timer, sta);
+	tw_setup(&sta->retransmit_timer, sta_retransmit_fn, sta);
+	sta->retransmit_wheel = sta_wheel;
+	tw_add(sta_wheel, &sta->expire_timer, now + STA_IDLE_TIMEOUT * 1000);
+#ifdef DEBUG_STATIONS
+	printf("[*] (%s) New station (%u tracked)\n", mac_string(sta->mac), sta_count());
+#endif
+	return sta;
+}
+
+
+/*
+ * forget about a station
+ */
+void sta_remove(station_t *sta)
+{
+	u_int32_t i = sta_find_slot(mac_key(sta->mac));
+
+	if (!sta->in_use || !sta_index[i])
+		return;
+
+	sta_index_delete(i);
+	tw_cancel(sta_wheel, &sta->expire_timer);
+	tw_cancel(sta->retransmit_wheel, &sta->retransmit_timer);
+	sta->in_use = 0;
+	sta_free[sta_nfree++] = sta - sta_pool;
+}
+
+
+/*
+ * (re)schedule a station's retransmit timer on the specified wheel, taking it
+ * off the one it was on if that was somewhere else
+ */
+void sta_retransmit_at(station_t *sta, tw_wheel_t *tw, u_int64_t expires)
+{
+	if (sta->retransmit_wheel != tw) {
+		tw_cancel(sta->retransmit_wheel, &sta->retransmit_timer);
+		sta->retransmit_wheel = tw;
+	}
+	tw_add(tw, &sta->retransmit_timer, expires);
+}
+
+
+/*
+ * return the number of stations being tracked
+ */
+u_int32_t sta_count(void)
+{
+	return STA_MAX - sta_nfree;
+}
+
+
+/*
+ * count the stations being tracked in each state. this walks the whole pool,
+ * so it's for statistics only
+ */
+void sta_count_states(u_int32_t *counts, u_int32_t n)
+{
+	u_int32_t i;
+
+	memset(counts, 0, n * sizeof(*counts));
+	for (i = 0; i < STA_MAX; i++)
+		if (sta_pool[i].in_use && sta_pool[i].state < n)
+			counts[sta_pool[i].state]++;
+}
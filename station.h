@@ -0,0 +1,104 @@
+/*
+ * per-station state tracking for jfap
+ *
+ * stations are kept in a fixed pool and found via an open-addressing (linear
+ * probing) index keyed by source MAC address. each index slot is a single
+ * 64-bit word holding the 48-bit MAC and the 16-bit pool index, so a lookup
+ * usually touches just one cache line.
+ */
+
+#ifndef JFAP_STATION_H
+#define JFAP_STATION_H
+
+#include <sys/types.h>
+#include <net/ethernet.h>
+
+#include "timer.h"
+
+
+/* the index has 2^STA_HASH_BITS slots and is never more than half full */
+#ifndef STA_HASH_BITS
+#define STA_HASH_BITS 13
+#endif
+#define STA_HASH_SIZE (1 << STA_HASH_BITS)
+#define STA_MAX (STA_HASH_SIZE / 2)
+
+#if STA_MAX > 65536
+#error "STA_HASH_BITS is too large"
+#endif
+
+/* largest response frame we keep around for retransmission */
+#define STA_PKT_MAX 512
+
+/* stations we haven't heard from in this many seconds get dropped */
+#define STA_IDLE_TIMEOUT 120
+
+/* a frame repeating the last sequence/fragment number we saw in the same
+ * cache within this many ms is a copy, even without the retry bit */
+#define STA_DUP_TIMEOUT 500
+
+/* duplicate caches - QoS data has one per TID (0-7), everything else shares
+ * the last */
+#define STA_SEQ_CACHES 9
+#define STA_SEQ_NON_QOS 8
+
+
+typedef enum {
+	S_AWAITING_PROBE_REQ = 0,
+	S_SENT_PROBE_RESP = 1,
+	S_SENT_AUTH = 2,
+	S_SENT_ASSOC_RESP = 3,
+	S_ESTABLISHED = 4,
+	S_MAX
+} state_t;
+
+typedef struct station {
+	u_int8_t mac[ETH_ALEN];
+	u_int8_t in_use;
+	u_int8_t retransmits_left;
+	u_int8_t bss;                 /* index of the network it's joining */
+	u_int8_t iface;               /* and of our interface it's talking to */
+	u_int16_t seq_valid;          /* a bit for each of last_seq */
+	u_int16_t last_seq[STA_SEQ_CACHES];  /* sequence << 4 | fragment */
+	u_int64_t last_seq_time[STA_SEQ_CACHES];  /* ms, when each was seen */
+	state_t state;
+	u_int64_t last_seen;          /* ms */
+	tw_timer_t expire_timer;      /* owned by the station table */
+	tw_timer_t retransmit_timer;
+	tw_wheel_t *retransmit_wheel; /* whichever wheel retransmit_timer goes on */
+
+	/* the last response we sent, for retransmission */
+	u_int16_t pkt_len;
+	u_int8_t pkt[STA_PKT_MAX];
+} station_t;
+
+
+void sta_init(tw_wheel_t *tw, tw_func_t retransmit_fn);
+station_t *sta_lookup(const u_int8_t *mac);
+station_t *sta_get(const u_int8_t *mac, u_int64_t now);
+void sta_remove(station_t *sta);
+void sta_retransmit_at(station_t *sta, tw_wheel_t *tw, u_int64_t expires);
+u_int32_t sta_count(void);
+void sta_count_states(u_int32_t *counts, u_int32_t n);
+
+
+/*
+ * note a frame from a station, by its sequence control field (sequence << 4 |
+ * fragment). these are the duplicate caches from the standard, an entry per
+ * transmitter and TID. it also refreshes last_seen
+ *
+ * returns 1 if the frame is a copy of the last one we saw in that cache
+ */
+static inline int sta_seen(station_t *sta, u_int32_t cache, u_int16_t seq_ctrl, int retry, u_int64_t now)
+{
+	int dup = (sta->seq_valid & (1 << cache)) && sta->last_seq[cache] == seq_ctrl
+		&& (retry || now - sta->last_seq_time[cache] <= STA_DUP_TIMEOUT);
+
+	sta->seq_valid |= 1 << cache;
+	sta->last_seq[cache] = seq_ctrl;
+	sta->last_seq_time[cache] = now;
+	sta->last_seen = now;
+	return dup;
+}
+
+#endif
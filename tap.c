@@ -0,0 +1,276 @@
+/*
+ * TAP device for jfap's data-plane bridge
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+#include <net/ethernet.h>
+#include <linux/if_tun.h>
+
+#include "tap.h"
+
+
+typedef struct tap_buf {
+	int tag;
+	u_int32_t len;
+	u_int8_t data[0];
+} tap_buf_t;
+
+#define TAP_BUF_STRIDE (sizeof(tap_buf_t) + TAP_FRAME_MAX)
+
+/*
+ * bring an interface up
+ *
+ * on success, we return 1, on failure, 0
+ */
+static int tap_up(const char *name)
+{
+	struct ifreq ifr;
+	int sock, ret = 0;
+
+	if ((sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0)) == -1) {
+		perror("[!] Unable to open a socket to configure the TAP");
+		return 0;
+	}
+
+	memset(&ifr, 0, sizeof(ifr));
+	snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", name);
+	if (ioctl(sock, SIOCGIFFLAGS, &ifr) == -1)
+		perror("[!] Unable to get the TAP's flags");
+	else {
+		ifr.ifr_flags |= IFF_UP;
+		if (ioctl(sock, SIOCSIFFLAGS, &ifr) == -1)
+			perror("[!] Unable to bring the TAP up");
+		else
+			ret = 1;
+	}
+
+	close(sock);
+	return ret;
+}
+
+
+/*
+ * create (or attach to) a TAP interface and bring it up. the kernel may pick
+ * the name if it has a %d in it, so look in t->name afterwards
+ *
+ * on success, we return 1, on failure, 0
+ */
+int tap_open(tap_t *t, const char *name)
+{
+	struct ifreq ifr;
+
+	memset(t, 0, sizeof(*t));
+	if ((t->fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK | O_CLOEXEC)) == -1) {
+		perror("[!] Unable to open /dev/net/tun");
+		return 0;
+	}
+
+	/* plain Ethernet frames, no packet info header in front */
+	memset(&ifr, 0, sizeof(ifr));
+	ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+	snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", name);
+	if (ioctl(t->fd, TUNSETIFF, &ifr) == -1) {
+		fprintf(stderr, "[!] Unable to create TAP \"%s\": %s\n", name, strerror(errno));
+		goto fail;
+	}
+	snprintf(t->name, sizeof(t->name), "%s", ifr.ifr_name);
+
+	if (!tap_up(t->name))
+		goto fail;
+
+	if (!(t->in = malloc(TAP_FRAME_MAX))) {
+		perror("[!] Unable to allocate the TAP buffer");
+		goto fail;
+	}
+	return 1;
+
+fail:
+	tap_close(t);
+	return 0;
+}
+
+
+/*
+ * read whatever frames the host has sent without waiting, up to a batch, and
+ * hand each to fn
+ *
+ * on success, we return 1, on failure, 0
+ */
+int tap_read(tap_t *t, tap_handler_t fn, void *arg)
+{
+	ssize_t len;
+	int i;
+
+	for (i = 0; i < TAP_BATCH; i++) {
+		if ((len = read(t->fd, t->in, TAP_FRAME_MAX)) == -1) {
+			if (errno == EAGAIN || errno == EINTR)
+				break;
+			perror("[!] Unable to read from the TAP");
+			return 0;
+		}
+
+		t->rx_frames++;
+		if (!fn(t->in, len, arg))
+			return 0;
+	}
+	return 1;
+}
+
+
+/*
+ * write an Ethernet frame to the host. addrs is its destination and source
+ * (12 bytes), and body the rest (ethertype and payload). they don't need to
+ * be next to each other, and neither is copied
+ *
+ * on success, we return 1, on failure, 0
+ */
+int tap_write(tap_t *t, const u_int8_t *addrs, const u_int8_t *body, u_int32_t len)
+{
+	struct iovec iov[2];
+
+	iov[0].iov_base = (void *)addrs;
+	iov[0].iov_len = 2 * ETH_ALEN;
+	iov[1].iov_base = (void *)body;
+	iov[1].iov_len = len;
+
+	/* the host isn't keeping up, its queue is full. drop it like a real
+	 * link would */
+	if (writev(t->fd, iov, 2) == -1) {
+		t->tx_errors++;
+		if (errno != EAGAIN) {
+			perror("[-] Unable to write to the TAP");
+			return 0;
+		}
+		return 1;
+	}
+	t->tx_frames++;
+	return 1;
+}
+
+
+/*
+ * close the TAP. it goes away with the fd, unless it was made persistent
+ */
+void tap_close(tap_t *t)
+{
+	if (t->fd != -1)
+		close(t->fd);
+	t->fd = -1;
+	free(t->in);
+	t->in = NULL;
+}
+
+
+/*
+ * set up a queue with every buffer free
+ *
+ * on success, we return 1, on failure, 0
+ */
+int tap_queue_init(tap_queue_t *tq)
+{
+	u_int32_t i;
+
+	memset(tq, 0, sizeof(*tq));
+	tq->efd = -1;
+	if (!spsc_init(&tq->q, TAP_QUEUE_BUFS) || !spsc_init(&tq->free, TAP_QUEUE_BUFS)
+			|| !(tq->pool = malloc(TAP_QUEUE_BUFS * TAP_BUF_STRIDE))) {
+		fprintf(stderr, "[!] Unable to allocate the TAP queue\n");
+		goto fail;
+	}
+	for (i = 0; i < TAP_QUEUE_BUFS; i++)
+		spsc_push(&tq->free, tq->pool + i * TAP_BUF_STRIDE);
+
+	if ((tq->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+		perror("[!] Unable to create the TAP queue eventfd");
+		goto fail;
+	}
+	return 1;
+
+fail:
+	tap_queue_free(tq);
+	return 0;
+}
+
+
+/*
+ * reader side - copy a frame into the queue. the worker isn't woken until
+ * tap_queue_kick()
+ *
+ * returns 0 if the queue is full
+ */
+int tap_queue_push(tap_queue_t *tq, const u_int8_t *frame, u_int32_t len, int tag)
+{
+	tap_buf_t *b;
+
+	if (len > TAP_FRAME_MAX || !(b = spsc_pop(&tq->free)))
+		return 0;
+
+	memcpy(b->data, frame, len);
+	b->len = len;
+	b->tag = tag;
+
+	/* can't fail, the ring has a slot for every buffer */
+	spsc_push(&tq->q, b);
+	tq->unkicked++;
+	return 1;
+}
+
+
+/*
+ * reader side - wake the worker if anything was queued since last time
+ */
+void tap_queue_kick(tap_queue_t *tq)
+{
+	u_int64_t one = 1;
+
+	if (!tq->unkicked)
+		return;
+	tq->unkicked = 0;
+	if (write(tq->efd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+		perror("[-] Unable to wake a worker for the TAP");
+}
+
+
+/*
+ * worker side - hand everything that's queued to fn
+ */
+void tap_queue_drain(tap_queue_t *tq, tap_queue_handler_t fn)
+{
+	tap_buf_t *b;
+	u_int64_t cnt, one = 1;
+	u_int32_t n;
+
+	if (read(tq->efd, &cnt, sizeof(cnt)) == -1 && errno != EAGAIN)
+		perror("[-] Unable to read the TAP queue eventfd");
+
+	/* a ring's worth at most, so the worker's own frames get a look in */
+	for (n = 0; n <= tq->q.mask; n++) {
+		if (!(b = spsc_pop(&tq->q)))
+			break;
+		fn(b->data, b->len, b->tag);
+		spsc_push(&tq->free, b);
+	}
+	if (n > tq->q.mask && write(tq->efd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+		perror("[-] Unable to wake a worker for the TAP");
+}
+
+
+void tap_queue_free(tap_queue_t *tq)
+{
+	if (tq->efd != -1)
+		close(tq->efd);
+	tq->efd = -1;
+	spsc_free(&tq->q);
+	spsc_free(&tq->free);
+	free(tq->pool);
+	tq->pool = NULL;
+}
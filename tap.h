@@ -0,0 +1,75 @@
+/*
+ * TAP device for jfap's data-plane bridge
+ *
+ * frames for the host are written straight out of the captured 802.11 frame
+ * they came in: the Ethernet addresses and the body are separate pieces of a
+ * writev(), so nothing is copied on our side. frames the host sends to the
+ * TAP are read in batches into one reused buffer and handed to a callback,
+ * which turns them into 802.11 frames right in a transmit slot. the kernel
+ * takes one frame per read() or write() on a TAP, so that's as far as
+ * batching goes.
+ *
+ * only one thread reads the TAP. frames for stations on another interface are
+ * copied into that interface's queue, and its worker is woken once per batch
+ * to send them from its own transmit ring.
+ */
+
+#ifndef JFAP_TAP_H
+#define JFAP_TAP_H
+
+#include <sys/types.h>
+#include <linux/if.h>
+
+#include "spsc.h"
+
+
+/* frames read per wakeup */
+#define TAP_BATCH 64
+
+/* room for the largest frame, with a standard MTU and then some */
+#define TAP_FRAME_MAX 2048
+
+/* frames that can wait for each of the other workers */
+#define TAP_QUEUE_BUFS 256
+
+/* return 0 to stop processing (fatal error) */
+typedef int (*tap_handler_t)(const u_int8_t *frame, u_int32_t len, void *arg);
+
+/* tag is whatever was queued along with the frame */
+typedef void (*tap_queue_handler_t)(const u_int8_t *frame, u_int32_t len, int tag);
+
+typedef struct tap {
+	int fd;
+	char name[IFNAMSIZ];
+
+	/* where frames are read into */
+	u_int8_t *in;
+
+	/* counters */
+	u_int64_t rx_frames;      /* from the host */
+	u_int64_t tx_frames;      /* to the host */
+	u_int64_t tx_errors;
+} tap_t;
+
+/* frames read from the TAP, on their way to another interface's worker */
+typedef struct tap_queue {
+	spsc_t q;                 /* reader -> worker */
+	spsc_t free;              /* worker -> reader */
+	u_int8_t *pool;
+	int efd;                  /* poked when frames are queued */
+	u_int32_t unkicked;       /* queued since it was last poked, reader only */
+} tap_queue_t;
+
+
+int tap_open(tap_t *t, const char *name);
+int tap_read(tap_t *t, tap_handler_t fn, void *arg);
+int tap_write(tap_t *t, const u_int8_t *addrs, const u_int8_t *body, u_int32_t len);
+void tap_close(tap_t *t);
+
+int tap_queue_init(tap_queue_t *tq);
+int tap_queue_push(tap_queue_t *tq, const u_int8_t *frame, u_int32_t len, int tag);
+void tap_queue_kick(tap_queue_t *tq);
+void tap_queue_drain(tap_queue_t *tq, tap_queue_handler_t fn);
+void tap_queue_free(tap_queue_t *tq);
+
+#endif
@@ -0,0 +1,255 @@
+/*
+ * hierarchical timer wheel for jfap
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "timer.h"
+
+
+/*
+ * get the current time in milliseconds
+ */
+u_int64_t clock_ms(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts)) {
+		perror("[!] clock_gettime failed");
+		return 0;
+	}
+	return (u_int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+/*
+ * get the current time in microseconds, on the same clock
+ */
+u_int64_t clock_us(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts)) {
+		perror("[!] clock_gettime failed");
+		return 0;
+	}
+	return (u_int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+/*
+ * reset a wheel so that the first tick processed will be "now"
+ */
+void tw_init(tw_wheel_t *w, u_int64_t now)
+{
+	memset(w, 0, sizeof(*w));
+	w->now = now;
+}
+
+
+/*
+ * prepare a timer for use
+ */
+void tw_setup(tw_timer_t *t, tw_func_t fn, void *arg)
+{
+	t->next = NULL;
+	t->pprev = NULL;
+	t->expires = 0;
+	t->fn = fn;
+	t->arg = arg;
+}
+
+
+/*
+ * link a timer into the right slot based on how far out it is
+ */
+static void tw_link(tw_wheel_t *w, tw_timer_t *t)
+{
+	u_int64_t expires = t->expires;
+	u_int64_t delta;
+	tw_timer_t **head;
+	int level;
+
+	/* already late? run it on the next tick */
+	if (expires < w->now)
+		expires = w->now;
+	delta = expires - w->now;
+	if (delta > TW_MAX_DELTA) {
+		delta = TW_MAX_DELTA;
+		expires = w->now + delta;
+	}
+
+	for (level = 0; level < TW_LEVELS - 1; level++) {
+		if (delta < (1ULL << (TW_BITS * (level + 1))))
+			break;
+	}
+	head = &w->slots[level][(expires >> (TW_BITS * level)) & TW_MASK];
+
+	t->next = *head;
+	if (t->next)
+		t->next->pprev = &t->next;
+	t->pprev = head;
+	*head = t;
+}
+
+
+/*
+ * remove a timer from whatever list it is on
+ */
+static void tw_unlink(tw_timer_t *t)
+{
+	*t->pprev = t->next;
+	if (t->next)
+		t->next->pprev = t->pprev;
+	t->next = NULL;
+	t->pprev = NULL;
+}
+
+
+/*
+ * schedule a timer to fire at the specified time, re-scheduling it if it was
+ * already pending
+ */
+void tw_add(tw_wheel_t *w, tw_timer_t *t, u_int64_t expires)
+{
+	if (tw_pending(t))
+		tw_unlink(t);
+	else
+		w->pending++;
+
+	t->expires = expires;
+	tw_link(w, t);
+}
+
+
+/*
+ * stop a timer from firing (ok to call on timers that aren't pending)
+ */
+void tw_cancel(tw_wheel_t *w, tw_timer_t *t)
+{
+	if (!tw_pending(t))
+		return;
+
+	tw_unlink(t);
+	w->pending--;
+}
+
+
+/*
+ * move every timer in a higher level slot down to where it belongs now
+ *
+ * returns the slot index so the caller knows whether to cascade the next level
+ */
+static u_int32_t tw_cascade(tw_wheel_t *w, int level)
+{
+	u_int32_t idx = (w->now >> (TW_BITS * level)) & TW_MASK;
+	tw_timer_t *t = w->slots[level][idx];
+
+	w->slots[level][idx] = NULL;
+	while (t) {
+		tw_timer_t *next = t->next;
+
+		tw_link(w, t);
+		t = next;
+	}
+	return idx;
+}
+
+
+/*
+ * run every timer that expires up to and including "now"
+ *
+ * returns the number of timers that fired
+ */
+u_int32_t tw_advance(tw_wheel_t *w, u_int64_t now)
+{
+	u_int32_t fired = 0;
+
+	while (w->now <= now) {
+		u_int32_t idx = w->now & TW_MASK;
+		tw_timer_t *work;
+		int level;
+
+		/* nothing scheduled at all - just jump ahead */
+		if (!w->pending) {
+			w->now = now + 1;
+			break;
+		}
+
+		/* skip long idle stretches instead of walking them a tick at a
+		 * time. nothing fires or cascades before the next expiry */
+		if (now - w->now > TW_SIZE) {
+			u_int64_t next = tw_next_expiry(w);
+
+			if (next > now) {
+				w->now = now + 1;
+				break;
+			}
+			if (next > w->now)
+				w->now = next;
+			idx = w->now & TW_MASK;
+		}
+
+		/* level 0 wrapped, pull the next batch down from above */
+		if (!idx) {
+			for (level = 1; level < TW_LEVELS; level++) {
+				if (tw_cascade(w, level))
+					break;
+			}
+		}
+
+		/* detach the slot so timers can safely re-add themselves */
+		work = w->slots[0][idx];
+		w->slots[0][idx] = NULL;
+		if (work)
+			work->pprev = &work;
+		w->now++;
+
+		while (work) {
+			tw_timer_t *t = work;
+
+			tw_unlink(t);
+			w->pending--;
+			fired++;
+			t->fn(t, t->arg);
+		}
+	}
+	return fired;
+}
+
+
+/*
+ * find the earliest time tw_advance() needs to be called
+ *
+ * this is exact for timers on the lowest level. for higher levels it is the
+ * time their slot cascades down, which is never later than they expire.
+ */
+u_int64_t tw_next_expiry(tw_wheel_t *w)
+{
+	u_int64_t best = TW_NEVER;
+	int level;
+
+	if (!w->pending)
+		return TW_NEVER;
+
+	for (level = 0; level < TW_LEVELS; level++) {
+		int shift = TW_BITS * level;
+		u_int64_t span = 1ULL << shift;
+		u_int64_t when = (w->now + span - 1) & ~(span - 1);
+		int i;
+
+		/* nothing on this level can beat what we already have */
+		if (when >= best)
+			break;
+
+		for (i = 0; i < TW_SIZE && when < best; i++, when += span) {
+			if (w->slots[level][(when >> shift) & TW_MASK]) {
+				best = when;
+				break;
+			}
+		}
+	}
+	return best;
+}
@@ -0,0 +1,61 @@
+/*
+ * hierarchical timer wheel for jfap
+ *
+ * time is kept in milliseconds. there are TW_LEVELS wheels of TW_SIZE slots,
+ * each level covering TW_SIZE times the range of the one below it. timers are
+ * intrusive doubly-linked list nodes, so adding and cancelling are O(1), and
+ * timers far in the future are only touched when their slot cascades down.
+ */
+
+#ifndef JFAP_TIMER_H
+#define JFAP_TIMER_H
+
+#include <sys/types.h>
+
+
+#define TW_BITS 6
+#define TW_SIZE (1 << TW_BITS)
+#define TW_MASK (TW_SIZE - 1)
+#define TW_LEVELS 4
+
+/* the furthest out we can schedule (~4.6 hours) */
+#define TW_MAX_DELTA ((1ULL << (TW_BITS * TW_LEVELS)) - 1)
+
+/* returned by tw_next_expiry() when nothing is pending */
+#define TW_NEVER (~0ULL)
+
+
+struct tw_timer;
+typedef void (*tw_func_t)(struct tw_timer *t, void *arg);
+
+typedef struct tw_timer {
+	struct tw_timer *next;
+	struct tw_timer **pprev;   /* NULL when not pending */
+	u_int64_t expires;
+	tw_func_t fn;
+	void *arg;
+} tw_timer_t;
+
+typedef struct tw_wheel {
+	u_int64_t now;             /* next tick to be processed */
+	u_int32_t pending;
+	tw_timer_t *slots[TW_LEVELS][TW_SIZE];
+} tw_wheel_t;
+
+
+u_int64_t clock_ms(void);
+u_int64_t clock_us(void);
+
+void tw_init(tw_wheel_t *w, u_int64_t now);
+void tw_setup(tw_timer_t *t, tw_func_t fn, void *arg);
+void tw_add(tw_wheel_t *w, tw_timer_t *t, u_int64_t expires);
+void tw_cancel(tw_wheel_t *w, tw_timer_t *t);
+u_int32_t tw_advance(tw_wheel_t *w, u_int64_t now);
+u_int64_t tw_next_expiry(tw_wheel_t *w);
+
+static inline int tw_pending(tw_timer_t *t)
+{
+	return t->pprev != NULL;
+}
+
+#endif
@@ -0,0 +1,65 @@
+/*
+ * TSF (timing synchronization function) counter for jfap
+ */
+
+#include "tsf.h"
+
+
+/* the clock (us) at TSF 0 */
+static u_int64_t tsf_origin;
+
+
+/*
+ * start counting from now
+ */
+void tsf_init(u_int64_t now_us)
+{
+	tsf_origin = now_us;
+}
+
+
+/*
+ * get the TSF at the specified clock time (us)
+ */
+u_int64_t tsf_get(u_int64_t now_us)
+{
+	return now_us > tsf_origin ? now_us - tsf_origin : 0;
+}
+
+
+/*
+ * get the clock time (us) at the specified TSF
+ */
+u_int64_t tsf_to_clock(u_int64_t tsf)
+{
+	return tsf + tsf_origin;
+}
+
+
+/*
+ * find the first TBTT at or after tsf, for a network whose own TSF is ours
+ * plus adjust
+ */
+u_int64_t tsf_next_tbtt(u_int64_t tsf, u_int64_t interval, u_int64_t adjust)
+{
+	u_int64_t t = tsf + adjust;
+	u_int64_t r = t % interval;
+
+	if (r)
+		t += interval - r;
+	return t - adjust;
+}
+
+
+/*
+ * account for a beacon that went out late (us) after its TBTT, having given
+ * up on missed TBTTs before it
+ */
+void tbtt_record(tbtt_stats_t *s, u_int64_t late, u_int64_t missed)
+{
+	s->beacons++;
+	s->missed += missed;
+	s->late_sum += late;
+	if (late > s->late_max)
+		s->late_max = late;
+}
@@ -0,0 +1,37 @@
+/*
+ * TSF (timing synchronization function) counter for jfap
+ *
+ * the TSF counts microseconds from when we started, on the same monotonic
+ * clock as everything else. beacons and probe responses carry it, and clients
+ * use it to work out when the next beacon is due: a TBTT (target beacon
+ * transmission time) comes every beacon interval, counted in TUs of 1024 us,
+ * starting from TSF 0. clients in power save wake up for them, so beacons
+ * should go out as close to their TBTTs as we can manage.
+ */
+
+#ifndef JFAP_TSF_H
+#define JFAP_TSF_H
+
+#include <sys/types.h>
+
+
+/* one time unit, what beacon intervals and listen intervals are counted in */
+#define TU_USEC 1024
+#define TU_TO_USEC(tu) ((u_int64_t)(tu) * TU_USEC)
+
+/* how close to their TBTTs beacons went out */
+typedef struct tbtt_stats {
+	u_int64_t beacons;
+	u_int64_t missed;          /* TBTTs we were a whole interval late for */
+	u_int64_t late_sum;        /* us */
+	u_int64_t late_max;        /* us */
+} tbtt_stats_t;
+
+
+void tsf_init(u_int64_t now_us);
+u_int64_t tsf_get(u_int64_t now_us);
+u_int64_t tsf_to_clock(u_int64_t tsf);
+u_int64_t tsf_next_tbtt(u_int64_t tsf, u_int64_t interval, u_int64_t adjust);
+void tbtt_record(tbtt_stats_t *s, u_int64_t late, u_int64_t missed);
+
+#endif